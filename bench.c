@@ -0,0 +1,517 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "common.h"
+#include "tabclient.h"
+#include "instance.h"
+
+// Load generator for the browser/tab IPC path.
+// Forks N client processes, each driving one or more synthetic tabs
+// through libtabclient against a running ./browser, and reports
+// throughput and latency.
+
+#define BENCH_TIMEOUT_MS 5000
+
+// Command mix entries understood by -m
+typedef enum {
+    BENCH_LOAD,
+    BENCH_BACK,
+    BENCH_STATUS,
+    BENCH_BOOKMARK,
+    BENCH_BROADCAST,
+    BENCH_NUM_KINDS
+} BenchKind;
+
+static const char *bench_kind_names[BENCH_NUM_KINDS] = {
+    "load", "back", "status", "bookmark", "broadcast"
+};
+
+// One latency sample, sent from a client process to the parent
+typedef struct {
+    int kind;
+    int timed_out;
+    long long latency_ns;
+} BenchSample;
+
+// Per command statistics collected by the parent
+typedef struct {
+    long long *samples;
+    int count;
+    int capacity;
+    int timeouts;
+} BenchStats;
+
+// Benchmark configuration
+static int num_clients = 4;
+static int tabs_per_client = 1;
+static int commands_per_client = 1000;
+static int base_tab_id = 1000;
+static int mix_weights[BENCH_NUM_KINDS] = { 40, 20, 20, 10, 10 };
+static char page_name[MAX_MSG] = "hello";
+static pid_t browser_pid = 0;
+
+static long long timeval_us(struct timeval tv) {
+    return (long long)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Read utime + stime (in microseconds) of another process from /proc
+static long long read_process_cpu_us(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+
+    // Fields after the command name, which is wrapped in parentheses
+    char *p = strrchr(buf, ')');
+    if (!p) return -1;
+
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &utime, &stime) != 2) {
+        return -1;
+    }
+    long ticks = sysconf(_SC_CLK_TCK);
+    return (long long)(utime + stime) * 1000000LL / ticks;
+}
+
+// Parse a mix such as "load=40,back=20,status=20,bookmark=10,broadcast=10"
+static int parse_mix(const char *spec) {
+    int weights[BENCH_NUM_KINDS] = { 0 };
+    char buf[256];
+    strncpy(buf, spec, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *saveptr;
+    for (char *tok = strtok_r(buf, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+
+        int kind;
+        for (kind = 0; kind < BENCH_NUM_KINDS; kind++) {
+            if (strcmp(tok, bench_kind_names[kind]) == 0) break;
+        }
+        if (kind == BENCH_NUM_KINDS) return -1;
+        weights[kind] = atoi(eq + 1);
+        if (weights[kind] < 0) return -1;
+    }
+
+    int total = 0;
+    for (int i = 0; i < BENCH_NUM_KINDS; i++) total += weights[i];
+    if (total == 0) return -1;
+
+    memcpy(mix_weights, weights, sizeof(mix_weights));
+    return 0;
+}
+
+static int pick_kind(unsigned int *seed) {
+    int total = 0;
+    for (int i = 0; i < BENCH_NUM_KINDS; i++) total += mix_weights[i];
+
+    int r = rand_r(seed) % total;
+    for (int i = 0; i < BENCH_NUM_KINDS; i++) {
+        if (r < mix_weights[i]) return i;
+        r -= mix_weights[i];
+    }
+    return BENCH_STATUS;
+}
+
+static void build_command(char *command, size_t size, int tab_id, int kind) {
+    switch (kind) {
+        case BENCH_LOAD:
+            snprintf(command, size, "load %.*s", (int)(size - 6), page_name);
+            break;
+        case BENCH_BACK:
+            snprintf(command, size, "back");
+            break;
+        case BENCH_STATUS:
+            snprintf(command, size, "status");
+            break;
+        case BENCH_BOOKMARK:
+            snprintf(command, size, "bookmark");
+            break;
+        case BENCH_BROADCAST:
+            snprintf(command, size, "broadcast bench tab %d", tab_id);
+            break;
+    }
+}
+
+// Closed-loop state of one synthetic tab: one command in flight at a time
+typedef struct {
+    TabClient *client;
+    int warmup_step;
+    int remaining;
+    int kind;
+    long long sent_at;           // 0 when nothing is in flight
+    long long deadline;          // When the command in flight times out
+    int answered;
+    unsigned int sync_generation; // Marker awaited after a timeout, 0 if none
+    unsigned int syncs;
+    unsigned int seed;
+    int result_fd;
+} BenchTab;
+
+static const char *warmup_commands[] = { "sync on", NULL /* load */ };
+#define WARMUP_STEPS 2
+
+static int bench_tab_send_next(BenchTab *tab) {
+    char command[MAX_MSG];
+    int tab_id = tab_client_id(tab->client);
+
+    if (tab->warmup_step < WARMUP_STEPS) {
+        // Warm up so that back, bookmark and broadcast have something to act on
+        if (warmup_commands[tab->warmup_step]) {
+            snprintf(command, sizeof(command), "%s", warmup_commands[tab->warmup_step]);
+        } else {
+            build_command(command, sizeof(command), tab_id, BENCH_LOAD);
+        }
+        tab->kind = -1;
+    } else if (tab->remaining > 0) {
+        tab->kind = pick_kind(&tab->seed);
+        build_command(command, sizeof(command), tab_id, tab->kind);
+    } else {
+        return 0;
+    }
+
+    tab->sent_at = monotonic_ns();
+    tab->deadline = tab->sent_at + BENCH_TIMEOUT_MS * 1000000LL;
+    tab->answered = 0;
+    if (tab_client_send(tab->client, command) < 0) {
+        perror("write to browser");
+        tab->sent_at = 0;
+        return -1;
+    }
+    return 1;
+}
+
+// After a timeout, the reply may still arrive and must not be taken for
+// the reply to the next command. The browser echoes unknown commands, so
+// a numbered marker is sent and everything before its echo is dropped.
+static int bench_tab_send_sync(BenchTab *tab) {
+    char command[64];
+    tab->sync_generation = ++tab->syncs;
+    snprintf(command, sizeof(command), "bench-sync %d %u", tab_client_id(tab->client), tab->sync_generation);
+
+    tab->sent_at = monotonic_ns();
+    tab->deadline = tab->sent_at + BENCH_TIMEOUT_MS * 1000000LL;
+    tab->answered = 0;
+    if (tab_client_send(tab->client, command) < 0) {
+        perror("write to browser");
+        return -1;
+    }
+    return 1;
+}
+
+static void bench_record(BenchTab *tab, int timed_out) {
+    if (tab->kind < 0) {
+        tab->warmup_step++;
+        return;
+    }
+
+    BenchSample sample;
+    sample.kind = tab->kind;
+    sample.timed_out = timed_out;
+    sample.latency_ns = monotonic_ns() - tab->sent_at;
+    if (write(tab->result_fd, &sample, sizeof(sample)) != sizeof(sample)) {
+        perror("write result");
+    }
+    tab->remaining--;
+}
+
+static void on_bench_response(TabClient *client, const TabResponse *response, void *user_data) {
+    BenchTab *tab = (BenchTab *)user_data;
+
+    // Pages painted from the client's cache are not round trips
+    if (response->from_cache || tab->answered) return;
+
+    if (tab->sync_generation) {
+        char marker[64];
+        snprintf(marker, sizeof(marker), "Unknown command: bench-sync %d %u",
+                 tab_client_id(client), tab->sync_generation);
+        if (response->kind == RESP_TEXT && response->length >= strlen(marker) &&
+            memmem(response->text, response->length, marker, strlen(marker))) {
+            tab->sync_generation = 0;
+            tab->answered = 1;
+        }
+        return;
+    }
+
+    bench_record(tab, 0);
+    tab->answered = 1;
+}
+
+// Body of one client process driving tabs_per_client synthetic tabs
+static int run_client(int index, int result_fd) {
+    BenchTab *tabs = calloc(tabs_per_client, sizeof(BenchTab));
+    struct pollfd *pfds = calloc(tabs_per_client, sizeof(struct pollfd));
+    if (!tabs || !pfds) {
+        perror("calloc");
+        return 1;
+    }
+
+    int opened = 0;
+    for (int i = 0; i < tabs_per_client; i++) {
+        int tab_id = base_tab_id + index * tabs_per_client + i;
+        TabClientCallbacks callbacks = { on_bench_response, NULL, &tabs[i] };
+
+        tabs[i].client = tab_client_open(tab_id, &callbacks);
+        if (!tabs[i].client) {
+            perror("tab_client_open");
+            break;
+        }
+        tabs[i].remaining = commands_per_client;
+        tabs[i].seed = (unsigned int)tab_id * 2654435761u;
+        tabs[i].result_fd = result_fd;
+        pfds[i].fd = tab_client_response_fd(tabs[i].client);
+        pfds[i].events = POLLIN;
+        opened++;
+    }
+
+    int in_flight = 0;
+    for (int i = 0; i < opened; i++) {
+        if (bench_tab_send_next(&tabs[i]) > 0) in_flight++;
+    }
+
+    while (in_flight > 0) {
+        // Wait until the nearest deadline of the commands in flight
+        long long now = monotonic_ns();
+        long long nearest = 0;
+        for (int i = 0; i < opened; i++) {
+            if (tabs[i].sent_at && (!nearest || tabs[i].deadline < nearest)) nearest = tabs[i].deadline;
+        }
+        int timeout = nearest > now ? (int)((nearest - now + 999999) / 1000000) : 0;
+
+        int ready = poll(pfds, opened, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        now = monotonic_ns();
+        for (int i = 0; i < opened; i++) {
+            if (pfds[i].revents & POLLIN) tab_client_dispatch(tabs[i].client);
+            if (!tabs[i].sent_at) continue;
+
+            if (!tabs[i].answered) {
+                if (now < tabs[i].deadline) continue;
+                // No response in time: count it, unless it was a marker
+                // that timed out, and send a new marker
+                if (!tabs[i].sync_generation) bench_record(&tabs[i], 1);
+                if (bench_tab_send_sync(&tabs[i]) > 0) continue;
+            }
+
+            tabs[i].sent_at = 0;
+            in_flight--;
+            if (bench_tab_send_next(&tabs[i]) > 0) in_flight++;
+        }
+    }
+
+    for (int i = 0; i < opened; i++) {
+        tab_client_send(tabs[i].client, "sync off");
+        tab_client_close(tabs[i].client);
+    }
+    free(pfds);
+    free(tabs);
+    return opened == tabs_per_client ? 0 : 1;
+}
+
+static void stats_add(BenchStats *stats, const BenchSample *sample) {
+    if (sample->timed_out) {
+        stats->timeouts++;
+        return;
+    }
+    if (stats->count == stats->capacity) {
+        stats->capacity = stats->capacity ? stats->capacity * 2 : 1024;
+        stats->samples = realloc(stats->samples, stats->capacity * sizeof(long long));
+        if (!stats->samples) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    stats->samples[stats->count++] = sample->latency_ns;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile over sorted samples
+static double percentile_us(const BenchStats *stats, double p) {
+    if (stats->count == 0) return 0.0;
+    int rank = (int)(p * stats->count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > stats->count) rank = stats->count;
+    return stats->samples[rank - 1] / 1000.0;
+}
+
+static void print_stats_row(const char *name, BenchStats *stats, double elapsed_s) {
+    qsort(stats->samples, stats->count, sizeof(long long), compare_ll);
+    printf("%-10s %8d %8d %10.0f %10.1f %10.1f %10.1f\n",
+           name, stats->count, stats->timeouts,
+           elapsed_s > 0 ? stats->count / elapsed_s : 0.0,
+           percentile_us(stats, 0.50),
+           percentile_us(stats, 0.99),
+           percentile_us(stats, 0.999));
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c clients] [-t tabs_per_client] [-n commands] [-m mix] [-P page]\n"
+            "          [-b base_tab_id] [-p browser_pid] [-i instance]\n"
+            "  mix: comma separated kind=weight, kinds: load,back,status,bookmark,broadcast\n"
+            "       default load=40,back=20,status=20,bookmark=10,broadcast=10\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:n:m:P:b:p:i:h")) != -1) {
+        switch (opt) {
+            case 'c': num_clients = atoi(optarg); break;
+            case 't': tabs_per_client = atoi(optarg); break;
+            case 'n': commands_per_client = atoi(optarg); break;
+            case 'm':
+                if (parse_mix(optarg) < 0) {
+                    fprintf(stderr, "[Bench] Invalid mix: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                strncpy(page_name, optarg, sizeof(page_name) - 1);
+                break;
+            case 'b': base_tab_id = atoi(optarg); break;
+            case 'p': browser_pid = (pid_t)atoi(optarg); break;
+            case 'i':
+                if (instance_select(optarg) < 0) {
+                    fprintf(stderr, "[Bench] Invalid instance name: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (num_clients < 1 || tabs_per_client < 1 || commands_per_client < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (access(instance_get()->browser_fifo, F_OK) != 0) {
+        fprintf(stderr, "[Bench] %s not found. Make sure ./browser is running.\n",
+                instance_get()->browser_fifo);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int result_pipe[2];
+    if (pipe(result_pipe) < 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    printf("[Bench] %d clients x %d tabs x %d commands, page '%s'\n",
+           num_clients, tabs_per_client, commands_per_client, page_name);
+
+    long long browser_cpu_start = browser_pid > 0 ? read_process_cpu_us(browser_pid) : -1;
+    long long start = monotonic_ns();
+
+    for (int i = 0; i < num_clients; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            close(result_pipe[0]);
+            int status = run_client(i, result_pipe[1]);
+            close(result_pipe[1]);
+            _exit(status);
+        }
+    }
+    close(result_pipe[1]);
+
+    // Collect samples until every client has closed its end of the pipe
+    BenchStats stats[BENCH_NUM_KINDS];
+    BenchStats total;
+    memset(stats, 0, sizeof(stats));
+    memset(&total, 0, sizeof(total));
+
+    BenchSample sample;
+    ssize_t n;
+    while ((n = read(result_pipe[0], &sample, sizeof(sample))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("read results");
+            break;
+        }
+        if (n != sizeof(sample) || sample.kind < 0 || sample.kind >= BENCH_NUM_KINDS) {
+            continue;
+        }
+        stats_add(&stats[sample.kind], &sample);
+        stats_add(&total, &sample);
+    }
+    close(result_pipe[0]);
+
+    int failed = 0;
+    for (int i = 0; i < num_clients; i++) {
+        int status;
+        if (wait(&status) > 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+            failed++;
+        }
+    }
+
+    double elapsed_s = (monotonic_ns() - start) / 1e9;
+    long long browser_cpu_end = browser_pid > 0 ? read_process_cpu_us(browser_pid) : -1;
+
+    struct rusage usage_children;
+    getrusage(RUSAGE_CHILDREN, &usage_children);
+    long long client_cpu_us = timeval_us(usage_children.ru_utime) + timeval_us(usage_children.ru_stime);
+
+    printf("\n%-10s %8s %8s %10s %10s %10s %10s\n",
+           "command", "count", "timeout", "ops/s", "p50(us)", "p99(us)", "p999(us)");
+    for (int i = 0; i < BENCH_NUM_KINDS; i++) {
+        if (mix_weights[i] > 0) {
+            print_stats_row(bench_kind_names[i], &stats[i], elapsed_s);
+        }
+    }
+    print_stats_row("total", &total, elapsed_s);
+
+    int completed = total.count + total.timeouts;
+    printf("\nElapsed: %.3f s\n", elapsed_s);
+    if (completed > 0) {
+        printf("Client CPU: %.1f us/command\n", (double)client_cpu_us / completed);
+        if (browser_cpu_start >= 0 && browser_cpu_end >= 0) {
+            printf("Browser CPU: %.1f us/command\n",
+                   (double)(browser_cpu_end - browser_cpu_start) / completed);
+        }
+    }
+    if (failed > 0) {
+        printf("[Bench] Warning: %d client(s) failed\n", failed);
+    }
+
+    for (int i = 0; i < BENCH_NUM_KINDS; i++) free(stats[i].samples);
+    free(total.samples);
+    return failed > 0 ? 1 : 0;
+}
@@ -12,34 +12,120 @@
 #include <errno.h>
 #include <pthread.h>
 #include <libgen.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <limits.h>
 #include "common.h"
 #include "shared_memory.h"
+#include "outqueue.h"
+#include "sched.h"
+#include "render.h"
+#include "cache.h"
+#include "prefetch.h"
+#include "diff.h"
+#include "log.h"
+#include "trace.h"
+#include "snapshot.h"
+#include "upgrade.h"
+#include "instance.h"
+#include "shard.h"
+#include "coalesce.h"
+#include "visits.h"
+#include "ftindex.h"
+#include "catalog.h"
 
 // Global state
-TabState tab_states[MAX_TABS];
+TabState local_tab_states[MAX_TABS];     // Used when there is no session snapshot
+TabState *tab_states = local_tab_states;  // Otherwise mapped from the snapshot file
 int shmid = -1;
 int semid = -1;
+VisitIndex *visit_index = NULL;          // Every tab's page loads, see visits.h
 SharedState *shared_state = NULL;
 pthread_t broadcast_thread;
 int running = 1;
+int prefetch_workers = PREFETCH_DEFAULT_WORKERS;
+unsigned long pages_sent = 0;
+unsigned long pages_not_modified = 0;   // Tab already had the generation
+unsigned long pages_patched = 0;        // Sent as a diff against the tab's copy
+unsigned long patch_bytes_saved = 0;
+unsigned long follower_pages = 0;       // Pages shown to followers without a render
+
+// Last document each tab was sent, the base for patches on reload
+typedef struct {
+    char url[MAX_MSG];
+    unsigned int generation;
+    OutBuffer *page;
+} SentPage;
+SentPage sent_pages[MAX_TABS];
+
+// One rendered document on its way to a tab and its followers. The page
+// and patch buffers are built on first use and shared by every tab.
+typedef struct {
+    const char *text;
+    size_t length;
+    unsigned int generation;
+    OutBuffer *page;
+    OutBuffer *patch;            // NULL if not worth sending
+    unsigned int patch_base;     // Generation the patch was made against, 0 if none
+} Delivery;
+char patch_buffer[RENDER_OUTPUT_MAX / 2];
 
 // Buffer for large data
 char content_buffer[MAX_MSG * 10];
 
+// Hot restart on SIGUSR2, see upgrade.h
+typedef enum {
+    UPGRADE_IDLE,
+    UPGRADE_STARTING,            // Waiting for the new process to be ready
+    UPGRADE_DRAINING             // Not reading BROWSER_FIFO, finishing queued work
+} UpgradePhase;
+volatile sig_atomic_t upgrade_requested = 0;
+UpgradePhase upgrade_phase = UPGRADE_IDLE;
+int upgrade_sock = -1;
+pid_t upgrade_child = 0;
+long long upgrade_deadline = 0;
+char **browser_argv = NULL;
+char browser_path[PATH_MAX];              // This binary, for shards and hot restarts
+const char *snapshot_path = NULL;        // Defaults to the instance's
+const char *index_path = NULL;           // Search index, defaults to the instance's
+const char *trace_path = NULL;
+
+// This process's part of a sharded browser, see shard.h
+int shard_index = 0;
+int broadcast_started = 0;
+char browser_fifo_path[INSTANCE_PATH_MAX + 16];
+
 void cleanup() {
+    // Shard 0 owns the segment the other shards are still using
+    if (shard_index == 0) shard_stop();
+    render_shutdown();
+    
     // Stop broadcast thread
     running = 0;
-    pthread_join(broadcast_thread, NULL);
+    if (broadcast_started) pthread_join(broadcast_thread, NULL);
+    
+    // Save the session while the segment still holds the bookmarks
+    snapshot_close(shared_state);
+    tab_states = local_tab_states;
     
     // Clean up shared memory and semaphores
     if (shared_state != NULL) {
         detach_shared_memory(shared_state);
     }
+    visits_detach(visit_index);
+    ftindex_close();
+    catalog_close();
     
-    cleanup_shared_resources(shmid, semid);
+    if (shard_index == 0) {
+        cleanup_shared_resources(shmid, semid);
+        visits_remove();
+    }
     
     // Remove FIFO
-    unlink(BROWSER_FIFO);
+    unlink(browser_fifo_path);
+    if (shard_index == 0) instance_unregister();
+    trace_close();
+    log_close();
     printf("[Browser] Resources cleaned up.\n");
 }
 
@@ -49,9 +135,13 @@ void signal_handler(int sig) {
     exit(0);
 }
 
+void upgrade_signal_handler(int sig) {
+    upgrade_requested = 1;
+}
+
 // Thread to check for inactive tabs and manage broadcast notifications
 void *broadcast_manager(void *arg) {
-    printf("[Browser] Broadcast manager thread started\n");
+    log_info("[Browser] Broadcast manager thread started");
     
     while (running) {
         if (shared_state) {
@@ -62,8 +152,8 @@ void *broadcast_manager(void *arg) {
             for (int i = 0; i < MAX_TABS; i++) {
                 if (tab_states[i].tab_id > 0) {
                     // Check if tab is still active (within last 30 seconds)
-                    if (now - tab_states[i].last_active > 30) {
-                        printf("[Browser] Tab %d appears to be inactive\n", tab_states[i].tab_id);
+                    if (now - tab_states[i].last_active > 30 && shared_state->tab_active[i]) {
+                        log_info("[Browser] Tab %d appears to be inactive", tab_states[i].tab_id);
                         shared_state->tab_active[i] = false;
                     }
                 }
@@ -73,6 +163,8 @@ void *broadcast_manager(void *arg) {
             shared_state->last_activity = now;
             
             unlock_shared_memory();
+            
+            snapshot_checkpoint(shared_state);
         }
         
         // Check every 5 seconds
@@ -82,66 +174,8 @@ void *broadcast_manager(void *arg) {
     return NULL;
 }
 
-void send_response(int tab_id, const char *response) {
-    char path[64];
-    snprintf(path, sizeof(path), "%s%d", RESPONSE_FIFO_PREFIX, tab_id);
-    int fd = open(path, O_WRONLY | O_NONBLOCK);
-    if (fd >= 0) {
-        // Attempt to optimize large writes
-        size_t len = strlen(response) + 1;
-        size_t written = 0;
-        
-        // Batch write for better performance
-        while (written < len) {
-            ssize_t bytes = write(fd, response + written, len - written);
-            if (bytes <= 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    // FIFO buffer full, sleep a bit and retry
-                    usleep(1000);
-                    continue;
-                }
-                break; // Other error
-            }
-            written += bytes;
-        }
-        
-        close(fd);
-    } else {
-        perror("open response fifo");
-    }
-}
-
-void render_html_with_w3m(const char *html_file, char *output) {
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "w3m -dump %s > /tmp/rendered.txt", html_file);
-    int ret = system(cmd);
-    if (ret == -1) {
-        strcpy(output, "[Browser] Error: Failed to execute w3m command.");
-        return;
-    } else if (WEXITSTATUS(ret) != 0) {
-        sprintf(output, "[Browser] Error: w3m command failed with status %d", WEXITSTATUS(ret));
-        return;
-    }
-
-    FILE *fp = fopen("/tmp/rendered.txt", "r");
-    if (!fp) {
-        strcpy(output, "[Browser] Error: Cannot open rendered output.");
-        return;
-    }
-
-    char line[256];
-    output[0] = '\0';
-    while (fgets(line, sizeof(line), fp)) {
-        if (strlen(output) + strlen(line) < MAX_MSG - 1)
-            strcat(output, line);
-    }
-    fclose(fp);
-}
-
-// Log history for a tab
-void log_history(int tab_id, const char *url) {
-    TabState *state = &tab_states[tab_id % MAX_TABS];
-    
+// Make url the tab's current page, as the newest history entry
+void add_history(TabState *state, const char *url) {
     // If we're not at the end of history, truncate it
     if (state->history_position < state->history_count - 1) {
         state->history_count = state->history_position + 1;
@@ -166,6 +200,253 @@ void log_history(int tab_id, const char *url) {
     
     // Update last active time
     state->last_active = time(NULL);
+}
+
+// Build the header of a response with the tab's current page and
+// history neighbours into head. Returns its length.
+size_t frame_head(int tab_id, ResponseKind kind, unsigned int generation, size_t body_length,
+                  char *head) {
+    TabState *state = &tab_states[tab_id % MAX_TABS];
+    const char *back = "";
+    const char *forward = "";
+    if (state->history_position > 0) {
+        back = state->history[state->history_position - 1];
+    }
+    if (state->history_position >= 0 && state->history_position < state->history_count - 1) {
+        forward = state->history[state->history_position + 1];
+    }
+    
+    ResponseHeader header = {
+        .magic = RESPONSE_MAGIC,
+        .kind = kind,
+        .url_length = strlen(state->current_url),
+        .back_length = strlen(back),
+        .forward_length = strlen(forward),
+        .generation = generation,
+        .body_length = body_length
+    };
+    
+    size_t length = sizeof(header);
+    memcpy(head, &header, sizeof(header));
+    memcpy(head + length, state->current_url, header.url_length);
+    length += header.url_length;
+    memcpy(head + length, back, header.back_length);
+    length += header.back_length;
+    memcpy(head + length, forward, header.forward_length);
+    length += header.forward_length;
+    return length;
+}
+
+// Frame a response and queue it. Never blocks: whatever the response
+// FIFO cannot take now is flushed later by the event loop.
+void send_frame(int tab_id, ResponseClass cls, ResponseKind kind, unsigned int generation,
+                const char *body, size_t body_length) {
+    OutQueue *q = outqueue_get(tab_id);
+    if (!q) return;
+    
+    char head[sizeof(ResponseHeader) + 3 * MAX_MSG];
+    size_t length = frame_head(tab_id, kind, generation, body_length, head);
+    trace_response(tab_id, length + body_length);
+    outqueue_push(q, cls, head, length, body, body_length);
+}
+
+// Same with a body shared with other tabs
+void send_shared_frame(int tab_id, ResponseKind kind, unsigned int generation, OutBuffer *body) {
+    OutQueue *q = outqueue_get(tab_id);
+    if (!q) return;
+    
+    char head[sizeof(ResponseHeader) + 3 * MAX_MSG];
+    size_t length = frame_head(tab_id, kind, generation, body->length, head);
+    trace_response(tab_id, length + body->length);
+    outqueue_push_shared(q, QUEUE_PAGE, head, length, body);
+}
+
+// Queue a short text response for a tab
+void send_response(int tab_id, const char *response) {
+    send_frame(tab_id, QUEUE_NOTIFY, RESP_TEXT, 0, response, strlen(response));
+}
+
+OutBuffer *delivery_page(Delivery *d) {
+    if (!d->page) d->page = outbuffer_new(d->text, d->length);
+    return d->page;
+}
+
+// Patch from a tab's last page to this one, or NULL if it would not be
+// less than half the size of the page
+OutBuffer *delivery_patch(Delivery *d, const SentPage *sent) {
+    if (d->patch_base == sent->generation) return d->patch;
+    
+    outbuffer_unref(d->patch);
+    d->patch = NULL;
+    d->patch_base = sent->generation;
+    size_t length = diff_lines(sent->page->data, sent->page->length, d->text, d->length,
+                               sent->generation, patch_buffer, d->length / 2);
+    if (length > 0) d->patch = outbuffer_new(patch_buffer, length);
+    return d->patch;
+}
+
+// Remember what a tab now shows so the next reload can be a patch
+void remember_page(SentPage *sent, const char *url, Delivery *d) {
+    if (sent->page && sent->generation == d->generation && strcmp(sent->url, url) == 0) return;
+    
+    OutBuffer *page = delivery_page(d);
+    if (!page) return;
+    outbuffer_unref(sent->page);
+    sent->page = outbuffer_ref(page);
+    sent->generation = d->generation;
+    snprintf(sent->url, sizeof(sent->url), "%s", url);
+}
+
+// Queue a document for one tab. If the tab has this generation only "not
+// modified" is sent; if it has the page it was sent last, a patch is
+// sent when that is less than half the size.
+void deliver(Delivery *d, int tab_id, unsigned int known_generation) {
+    TabState *state = &tab_states[tab_id % MAX_TABS];
+    SentPage *sent = &sent_pages[tab_id % MAX_TABS];
+    OutBuffer *body;
+    
+    if (d->generation != 0 && d->generation == known_generation) {
+        send_frame(tab_id, QUEUE_PAGE, RESP_NOT_MODIFIED, d->generation, NULL, 0);
+        pages_not_modified++;
+    } else if (sent->page && sent->generation == known_generation &&
+               strcmp(sent->url, state->current_url) == 0 && (body = delivery_patch(d, sent))) {
+        send_shared_frame(tab_id, RESP_PATCH, d->generation, body);
+        pages_patched++;
+        patch_bytes_saved += d->length - body->length;
+    } else if ((body = delivery_page(d))) {
+        send_shared_frame(tab_id, RESP_PAGE, d->generation, body);
+        pages_sent++;
+    } else {
+        return;
+    }
+    
+    remember_page(sent, state->current_url, d);
+}
+
+// Queue a rendered document for a tab and show it to every tab following
+// it, from the same buffers and without rendering it again. Under
+// backpressure a newer page may replace it.
+void send_page(int tab_id, const char *text, unsigned int generation) {
+    TabState *state = &tab_states[tab_id % MAX_TABS];
+    Delivery d = { .text = text, .length = strlen(text), .generation = generation };
+    
+    deliver(&d, tab_id, state->known_generation);
+    
+    for (int i = 0; i < MAX_TABS; i++) {
+        TabState *follower = &tab_states[i];
+        if (follower->tab_id == 0 || follower->following != tab_id) continue;
+        
+        // The follower's own navigation, if any, is overtaken
+        render_cancel(follower->tab_id);
+        if (strcmp(follower->current_url, state->current_url) != 0) {
+            add_history(follower, state->current_url);
+        }
+        
+        // It has whatever it was sent last
+        SentPage *sent = &sent_pages[i];
+        unsigned int known = strcmp(sent->url, state->current_url) == 0 ? sent->generation : 0;
+        deliver(&d, follower->tab_id, known);
+        follower_pages++;
+    }
+    
+    outbuffer_unref(d.page);
+    outbuffer_unref(d.patch);
+}
+
+// Queue the pages a tab is likely to open next: links on the page it
+// shows and its history neighbours, which back/forward will ask for
+void queue_prefetch(int tab_id, const char *links, size_t links_size) {
+    if (prefetch_workers == 0 || cache_budget() == 0) return;
+    
+    char html_file[MAX_MSG];
+    int count = 0;
+    for (const char *link = links; links_size > 0 && *link && count < PREFETCH_LINKS_PER_PAGE;
+         link += strlen(link) + 1) {
+        if (prefetch_link_file(link, html_file, sizeof(html_file)) == 0 && !cache_contains(html_file)) {
+            prefetch_push(html_file);
+            count++;
+        }
+    }
+    
+    // Pushed last so they are prefetched first, "back" before "forward"
+    TabState *state = &tab_states[tab_id % MAX_TABS];
+    int neighbours[2] = { state->history_position + 1, state->history_position - 1 };
+    for (int i = 0; i < 2; i++) {
+        int pos = neighbours[i];
+        if (pos < 0 || pos >= state->history_count || pos == state->history_position) continue;
+        snprintf(html_file, sizeof(html_file), "%.*s.html", MAX_MSG - 6, state->history[pos]);
+        if (!cache_contains(html_file)) {
+            prefetch_push(html_file);
+        }
+    }
+}
+
+// A render finished, failed or timed out. Prefetches and superseded
+// renders arrive with tab_id -1 and only feed the cache.
+void on_render_done(const RenderResult *result) {
+    // Renders the search index asked for are not worth a cache entry
+    int crawl = ftindex_rendered(result->html_file, result->text, strlen(result->text), result->ok);
+    if (result->ok && !(crawl && result->tab_id < 0)) {
+        cache_insert(result->html_file, result->text, result->links, result->links_size,
+                     result->generation, result->prefetch);
+    }
+    if (result->tab_id < 0) return;
+    
+    if (result->ok) {
+        send_page(result->tab_id, result->text, result->generation);
+        queue_prefetch(result->tab_id, result->links, result->links_size);
+    } else {
+        // Errors take the document's place in the queue
+        send_frame(result->tab_id, QUEUE_PAGE, RESP_TEXT, 0, result->text, strlen(result->text));
+    }
+}
+
+// Serve a page from the render cache, from a prefetch already under way,
+// or by starting a render
+void show_page(int tab_id, const char *html_file) {
+    const CacheEntry *entry = cache_lookup(html_file);
+    if (entry) {
+        send_page(tab_id, entry->text, entry->generation);
+        queue_prefetch(tab_id, entry->links, entry->links_size);
+        return;
+    }
+    
+    if (render_adopt(tab_id, html_file)) {
+        return;
+    }
+    render_start(tab_id, html_file);
+}
+
+// Use idle workers for queued prefetches, within the prefetch budget
+void start_prefetches() {
+    char html_file[MAX_MSG];
+    while (render_prefetching() < prefetch_workers && render_available() &&
+           prefetch_pop(html_file, sizeof(html_file))) {
+        if (cache_contains(html_file) || render_in_flight(html_file)) continue;
+        if (render_prefetch(html_file) == 0) {
+            prefetch_stats.started++;
+        }
+    }
+    
+    // Then pages that are new or changed since the search index saw them
+    while (render_prefetching() < prefetch_workers && render_available() &&
+           ftindex_next_crawl(html_file, sizeof(html_file))) {
+        if (render_in_flight(html_file)) continue;
+        render_prefetch(html_file);
+    }
+}
+
+// Runs in each renderer worker before it enters its sandbox
+void on_render_fork() {
+    if (shared_state) shmdt(shared_state);
+    visits_detach(visit_index);
+}
+
+// Log history for a tab
+void log_history(int tab_id, const char *url) {
+    TabState *state = &tab_states[tab_id % MAX_TABS];
+    add_history(state, url);
+    visits_record(visit_index, url, time(NULL));
     
     // Update shared state if synchronized
     if (state->is_synced && shared_state) {
@@ -177,32 +458,12 @@ void log_history(int tab_id, const char *url) {
         
         unlock_shared_memory();
         
-        // Broadcast to other tabs
-        if (shared_state) {
-            broadcast_message(shared_state, BROADCAST_PAGE_LOADED, tab_id, url);
-        }
+        // Broadcast to other tabs, in summaries when it loads faster
+        // than its broadcast rate
+        coalesce_page_loaded(shared_state, tab_id, url);
     }
 }
 
-// Get command type from text command
-CommandType get_command_type(const char* cmd) {
-    if (strncmp(cmd, "load ", 5) == 0) return CMD_LOAD;
-    if (strcmp(cmd, "reload") == 0) return CMD_RELOAD;
-    if (strcmp(cmd, "back") == 0) return CMD_BACK;
-    if (strcmp(cmd, "forward") == 0) return CMD_FORWARD;
-    if (strcmp(cmd, "history") == 0) return CMD_HISTORY;
-    if (strcmp(cmd, "bookmark") == 0) return CMD_BOOKMARK;
-    if (strcmp(cmd, "bookmarks") == 0) return CMD_BOOKMARK_LIST;
-    if (strncmp(cmd, "open ", 5) == 0) return CMD_BOOKMARK_OPEN;
-    if (strncmp(cmd, "delete ", 7) == 0) return CMD_BOOKMARK_DELETE;
-    if (strcmp(cmd, "sync on") == 0) return CMD_SYNC_ON;
-    if (strcmp(cmd, "sync off") == 0) return CMD_SYNC_OFF;
-    if (strncmp(cmd, "broadcast ", 10) == 0) return CMD_BROADCAST;
-    if (strcmp(cmd, "status") == 0) return CMD_STATUS;
-    if (strcmp(cmd, "CRASH") == 0) return CMD_CRASH;
-    return CMD_UNKNOWN;
-}
-
 // Show all bookmarks in shared memory
 void list_bookmarks(int tab_id) {
     if (!shared_state) {
@@ -247,7 +508,7 @@ void show_browser_status(int tab_id) {
     
     lock_shared_memory();
     
-    char buffer[MAX_MSG * 2] = "[Browser] Status:\n";
+    char buffer[MAX_MSG * 8] = "[Browser] Status:\n";
     char entry[512];
     
     // Active tabs
@@ -284,10 +545,168 @@ void show_browser_status(int tab_id) {
     snprintf(entry, sizeof(entry), "Bookmarks: %d\n", shared_state->bookmark_count);
     strcat(buffer, entry);
     
+    // Visit index (written under the same lock)
+    if (visit_index) {
+        snprintf(entry, sizeof(entry), "Visits: %d URLs, %llu visits\n",
+                 visit_index->count, (unsigned long long)visit_index->total_visits);
+        strcat(buffer, entry);
+    }
+    
     unlock_shared_memory();
+    
+    // Output queues (browser-local, no lock needed)
+    size_t queued_bytes = 0;
+    int congested = 0;
+    unsigned long dropped = 0, coalesced = 0, disconnects = 0;
+    for (int i = 0; i < outqueue_count(); i++) {
+        OutQueue *q = outqueue_at(i);
+        queued_bytes += q->queued_bytes;
+        congested += q->congested;
+        dropped += q->dropped;
+        coalesced += q->coalesced;
+        disconnects += q->disconnects;
+    }
+    snprintf(entry, sizeof(entry), "Output queues: %zu bytes queued, %d congested (policy %s)\n",
+             queued_bytes, congested, outqueue_policy_name(outqueue_config.policy));
+    strcat(buffer, entry);
+    snprintf(entry, sizeof(entry), "Slow tabs: %lu dropped, %lu coalesced, %lu disconnected\n",
+             dropped, coalesced, disconnects);
+    strcat(buffer, entry);
+    
+    snprintf(entry, sizeof(entry),
+             "Renderers: %d workers, %d busy, %lu crashed, %lu recycled\n",
+             render_worker_count(), render_busy_count(), render_stats.crashed, render_stats.recycled);
+    strcat(buffer, entry);
+    snprintf(entry, sizeof(entry),
+             "Renders: %lu started, %lu completed, %lu superseded, %lu timed out, %lu failed\n",
+             render_stats.started, render_stats.completed,
+             render_stats.superseded, render_stats.timed_out, render_stats.failed);
+    strcat(buffer, entry);
+    snprintf(entry, sizeof(entry),
+             "Render cache: %d pages, %zu of %zu bytes, %lu hits (%lu prefetched), %lu misses, %lu evicted\n",
+             cache_stats.entries, cache_stats.bytes, cache_budget(), cache_stats.hits,
+             cache_stats.prefetch_hits, cache_stats.misses, cache_stats.evictions);
+    strcat(buffer, entry);
+    snprintf(entry, sizeof(entry), "Prefetch: %d queued, %d running, %lu started\n",
+             prefetch_pending(), render_prefetching(), prefetch_stats.started);
+    strcat(buffer, entry);
+    snprintf(entry, sizeof(entry),
+             "Pages: %lu sent, %lu not modified, %lu patched (%lu bytes saved), %lu to followers\n",
+             pages_sent, pages_not_modified, pages_patched, patch_bytes_saved, follower_pages);
+    strcat(buffer, entry);
+    snprintf(entry, sizeof(entry), "Catalog: %d pages, %zu KB mapped, %lu events, %lu refreshes\n",
+             catalog_stats.pages, catalog_stats.mapped_bytes / 1024, catalog_stats.events,
+             catalog_stats.refreshes);
+    strcat(buffer, entry);
+    FtIndexStats search;
+    ftindex_stats(&search);
+    snprintf(entry, sizeof(entry),
+             "Search index: %d pages, %d terms, %zu KB postings, %d queued, %lu queries\n",
+             search.docs, search.terms, search.postings_bytes / 1024, search.queued, search.queries);
+    strcat(buffer, entry);
+    LogStats log = log_stats();
+    snprintf(entry, sizeof(entry), "Log: %lu written, %lu dropped, %lu rotations\n",
+             log.written, log.dropped, log.rotations);
+    strcat(buffer, entry);
+    if (snapshot_restored() > 0) {
+        snprintf(entry, sizeof(entry), "Session: %d tabs restored\n", snapshot_restored());
+        strcat(buffer, entry);
+    }
+    if (trace_enabled()) {
+        snprintf(entry, sizeof(entry), "Trace: %lu commands recorded\n", trace_commands());
+        strcat(buffer, entry);
+    }
+    if (instance_get()->name[0]) {
+        snprintf(entry, sizeof(entry), "Instance: %s\n", instance_get()->name);
+        strcat(buffer, entry);
+    }
+    if (shard_count() > 1) {
+        snprintf(entry, sizeof(entry), "Shard: %d of %d\n", shard_index, shard_count());
+        strcat(buffer, entry);
+    }
+    snprintf(entry, sizeof(entry), "Page broadcasts: %lu sent, %lu coalesced into %lu summaries\n",
+             coalesce_stats.sent, coalesce_stats.held, coalesce_stats.summaries);
+    strcat(buffer, entry);
+
+    // Scheduler queues, for tuning the class weights
+    snprintf(entry, sizeof(entry), "Scheduler: %d queued (%d metadata, %d render)\n",
+             sched_pending(), sched_pending_class(SCHED_META), sched_pending_class(SCHED_RENDER));
+    strcat(buffer, entry);
+    for (int i = 0; i < sched_tab_count(); i++) {
+        SchedTab *tab = sched_tab_at(i);
+        snprintf(entry, sizeof(entry),
+                 "  Tab %d: depth %d (max %d), served %lu, refused %lu, wait avg %.1f ms max %.1f ms\n",
+                 tab->tab_id, tab->depth, tab->max_depth, tab->served, tab->refused,
+                 tab->served ? tab->total_wait_ms / tab->served : 0.0, tab->max_wait_ms);
+        
+        if (strlen(buffer) + strlen(entry) < sizeof(buffer) - 1) {
+            strcat(buffer, entry);
+        }
+    }
+    
     send_response(tab_id, buffer);
 }
 
+// Change the broadcasts a tab receives: "subscribe <types> [url_prefix]"
+// receives only those types, "unsubscribe <types>" stops some, and a
+// bare "subscribe" shows the current choice
+void update_subscription(int tab_id, const char *command) {
+    if (!shared_state) {
+        send_response(tab_id, "[Browser] Broadcasts require shared memory.");
+        return;
+    }
+    
+    int subscribe = strncmp(command, "subscribe", 9) == 0;
+    const char *args = command + (subscribe ? 9 : 11);
+    while (*args == ' ') args++;
+    
+    char types[MAX_MSG];
+    const char *prefix = "";
+    size_t types_length = strcspn(args, " ");
+    snprintf(types, sizeof(types), "%.*s", (int)types_length, args);
+    if (args[types_length]) {
+        prefix = args + types_length;
+        while (*prefix == ' ') prefix++;
+    }
+    
+    unsigned int mask = 0;
+    if (types[0] && parse_broadcast_types(types, &mask) < 0) {
+        send_response(tab_id, "[Browser] Usage: subscribe|unsubscribe <types> [url_prefix]; types: "
+                      "bookmark-added, bookmark-removed, new-tab, tab-closed, page-loaded, "
+                      "bookmarks, tabs, all");
+        return;
+    }
+    
+    lock_shared_memory();
+    BroadcastFilter *filter = &shared_state->filters[tab_id % MAX_TABS];
+    if (subscribe && types[0]) {
+        filter->ignored = BROADCAST_ALL_TYPES & ~mask;
+        snprintf(filter->url_prefix, sizeof(filter->url_prefix), "%s", prefix);
+    } else if (!subscribe) {
+        filter->ignored |= mask;
+        if (mask & (1u << BROADCAST_PAGE_LOADED)) filter->url_prefix[0] = '\0';
+    }
+    BroadcastFilter current = *filter;
+    unlock_shared_memory();
+    
+    char response[MAX_MSG] = "[Browser] Receiving broadcasts:";
+    int receiving = 0;
+    for (int type = 0; type < BROADCAST_TYPE_COUNT; type++) {
+        if (current.ignored & (1u << type)) continue;
+        char entry[MAX_MSG];
+        if (type == BROADCAST_PAGE_LOADED && current.url_prefix[0]) {
+            snprintf(entry, sizeof(entry), "%s %s (under %.200s)", receiving ? "," : "",
+                     broadcast_type_name(type), current.url_prefix);
+        } else {
+            snprintf(entry, sizeof(entry), "%s %s", receiving ? "," : "", broadcast_type_name(type));
+        }
+        strncat(response, entry, sizeof(response) - strlen(response) - 1);
+        receiving++;
+    }
+    if (!receiving) strcat(response, " none");
+    send_response(tab_id, response);
+}
+
 void handle_command(BrowserMessage *msg) {
     TabState *state = &tab_states[msg->tab_id % MAX_TABS];
     
@@ -305,6 +724,9 @@ void handle_command(BrowserMessage *msg) {
             lock_shared_memory();
             shared_state->tab_active[msg->tab_id % MAX_TABS] = true;
             shared_state->active_tab_count++;
+            
+            // A new tab receives every broadcast until it subscribes
+            memset(&shared_state->filters[msg->tab_id % MAX_TABS], 0, sizeof(BroadcastFilter));
             unlock_shared_memory();
             
             // Broadcast new tab
@@ -316,10 +738,16 @@ void handle_command(BrowserMessage *msg) {
     state->last_active = time(NULL);
     
     // Set command type if not set
-    if (msg->cmd_type == CMD_UNKNOWN) {
+    if (msg->cmd_type == CMD_UNKNOWN || (unsigned)msg->cmd_type >= CMD_COUNT) {
         msg->cmd_type = get_command_type(msg->command);
     }
     
+    // Any new navigation supersedes the page this tab is still waiting for
+    if (sched_class(msg->cmd_type) == SCHED_RENDER) {
+        render_cancel(msg->tab_id);
+        state->known_generation = msg->known_generation;
+    }
+    
     char response[MAX_MSG];
     
     switch (msg->cmd_type) {
@@ -343,19 +771,15 @@ void handle_command(BrowserMessage *msg) {
             // Tạo tên file HTML
             snprintf(html_file, sizeof(html_file), "%s.html", page_name);
 
-            FILE *check = fopen(html_file, "r");
-            if (!check) {
+            if (!catalog_exists(html_file)) {
                 send_response(msg->tab_id, "[Browser] Error: Page not found.");
                 return;
             }
-            fclose(check);
 
             // Log to history
             log_history(msg->tab_id, page_name);
 
-            char content[MAX_MSG];
-            render_html_with_w3m(html_file, content);
-            send_response(msg->tab_id, content);
+            show_page(msg->tab_id, html_file);
             break;
         }
         
@@ -364,13 +788,11 @@ void handle_command(BrowserMessage *msg) {
                 send_response(msg->tab_id, "[Browser] No page to reload.");
             } else {
                 char html_file[MAX_MSG];
-                snprintf(html_file, sizeof(html_file), "%s.html", state->current_url);
+                snprintf(html_file, sizeof(html_file), "%.500s.html", state->current_url);
                 
-                char content[MAX_MSG];
-                render_html_with_w3m(html_file, content);
-                send_response(msg->tab_id, content);
+                show_page(msg->tab_id, html_file);
                 
-                printf("[Browser] Tab %d reloaded: %s\n", msg->tab_id, state->current_url);
+                log_info("[Browser] Tab %d reloaded: %s", msg->tab_id, state->current_url);
             }
             break;
             
@@ -382,12 +804,10 @@ void handle_command(BrowserMessage *msg) {
                 char html_file[MAX_MSG];
                 snprintf(html_file, sizeof(html_file), "%s.html", state->current_url);
                 
-                char content[MAX_MSG];
-                render_html_with_w3m(html_file, content);
-                send_response(msg->tab_id, content);
+                show_page(msg->tab_id, html_file);
                 
-                printf("[Browser] Tab %d navigated back to: %s\n", 
-                       msg->tab_id, state->current_url);
+                log_info("[Browser] Tab %d navigated back to: %s", 
+                         msg->tab_id, state->current_url);
             } else {
                 send_response(msg->tab_id, "[Browser] No previous page in history.");
             }
@@ -401,12 +821,10 @@ void handle_command(BrowserMessage *msg) {
                 char html_file[MAX_MSG];
                 snprintf(html_file, sizeof(html_file), "%s.html", state->current_url);
                 
-                char content[MAX_MSG];
-                render_html_with_w3m(html_file, content);
-                send_response(msg->tab_id, content);
+                show_page(msg->tab_id, html_file);
                 
-                printf("[Browser] Tab %d navigated forward to: %s\n", 
-                       msg->tab_id, state->current_url);
+                log_info("[Browser] Tab %d navigated forward to: %s", 
+                         msg->tab_id, state->current_url);
             } else {
                 send_response(msg->tab_id, "[Browser] No next page in history.");
             }
@@ -419,8 +837,9 @@ void handle_command(BrowserMessage *msg) {
                 send_response(msg->tab_id, "[Browser] Bookmark feature requires shared memory.");
             } else {
                 add_bookmark(shared_state, state->current_url, state->current_url, msg->tab_id);
+                snapshot_checkpoint(shared_state);
                 snprintf(response, sizeof(response), 
-                        "[Browser] Bookmarked: %s", state->current_url);
+                        "[Browser] Bookmarked: %.480s", state->current_url);
                 send_response(msg->tab_id, response);
             }
             break;
@@ -459,19 +878,15 @@ void handle_command(BrowserMessage *msg) {
             char html_file[MAX_MSG];
             snprintf(html_file, sizeof(html_file), "%s.html", url);
             
-            FILE *check = fopen(html_file, "r");
-            if (!check) {
+            if (!catalog_exists(html_file)) {
                 send_response(msg->tab_id, "[Browser] Error: Bookmarked page not found.");
                 break;
             }
-            fclose(check);
             
             // Log to history
             log_history(msg->tab_id, url);
             
-            char content[MAX_MSG];
-            render_html_with_w3m(html_file, content);
-            send_response(msg->tab_id, content);
+            show_page(msg->tab_id, html_file);
             break;
         }
             
@@ -488,6 +903,7 @@ void handle_command(BrowserMessage *msg) {
             }
             
             remove_bookmark(shared_state, index-1, msg->tab_id);
+            snapshot_checkpoint(shared_state);
             
             snprintf(response, sizeof(response), 
                     "[Browser] Deleted bookmark #%d", index);
@@ -542,6 +958,12 @@ void handle_command(BrowserMessage *msg) {
         case CMD_SYNC_OFF:
             state->is_synced = 0;
             
+            // Following is for synced tabs only, in either direction
+            state->following = 0;
+            for (int i = 0; i < MAX_TABS; i++) {
+                if (tab_states[i].following == msg->tab_id) tab_states[i].following = 0;
+            }
+            
             if (shared_state) {
                 lock_shared_memory();
                 shared_state->tab_active[msg->tab_id % MAX_TABS] = false;
@@ -574,6 +996,76 @@ void handle_command(BrowserMessage *msg) {
             send_response(msg->tab_id, "[Browser] Tab crashed and recovered.");
             break;
             
+        case CMD_FOLLOW: {
+            int leader = atoi(msg->command + 7);
+            TabState *target = &tab_states[leader % MAX_TABS];
+            
+            if (!state->is_synced) {
+                send_response(msg->tab_id, "[Browser] Tab must be synced to follow another tab.");
+                break;
+            }
+            if (leader <= 0 || leader == msg->tab_id || target->tab_id != leader || !target->is_synced) {
+                send_response(msg->tab_id, "[Browser] No synced tab with that number. Use 'follow <tab>'");
+                break;
+            }
+            
+            // Pages fan out from the shard that renders them
+            if (instance_shard_of(leader, shard_count()) != shard_index) {
+                send_response(msg->tab_id, "[Browser] That tab is served by another shard.");
+                break;
+            }
+            
+            // Follow the tab it follows, so pages fan out in one step
+            if (target->following) leader = target->following;
+            if (leader == msg->tab_id) {
+                send_response(msg->tab_id, "[Browser] That tab is following this one.");
+                break;
+            }
+            
+            // Tabs following this one come along
+            state->following = leader;
+            for (int i = 0; i < MAX_TABS; i++) {
+                if (tab_states[i].following == msg->tab_id) tab_states[i].following = leader;
+            }
+            
+            snprintf(response, sizeof(response), "[Browser] Following tab %d.", leader);
+            send_response(msg->tab_id, response);
+            
+            // Catch up with the page the leader is showing
+            TabState *leader_state = &tab_states[leader % MAX_TABS];
+            if (leader_state->current_url[0] != '\0' &&
+                strcmp(leader_state->current_url, state->current_url) != 0) {
+                char html_file[MAX_MSG];
+                snprintf(html_file, sizeof(html_file), "%.*s.html", MAX_MSG - 6, leader_state->current_url);
+                add_history(state, leader_state->current_url);
+                state->known_generation = 0;
+                show_page(msg->tab_id, html_file);
+            }
+            break;
+        }
+            
+        case CMD_UNFOLLOW:
+            if (!state->following) {
+                send_response(msg->tab_id, "[Browser] This tab is not following another tab.");
+            } else {
+                snprintf(response, sizeof(response), "[Browser] Stopped following tab %d.", state->following);
+                state->following = 0;
+                send_response(msg->tab_id, response);
+            }
+            break;
+            
+        case CMD_SUBSCRIBE:
+        case CMD_UNSUBSCRIBE:
+            update_subscription(msg->tab_id, msg->command);
+            break;
+            
+        case CMD_FIND: {
+            char results[4096];
+            ftindex_search(msg->command[4] == ' ' ? msg->command + 5 : "", results, sizeof(results));
+            send_response(msg->tab_id, results);
+            break;
+        }
+            
         default:
             snprintf(response, sizeof(response), 
                     "[Browser] Unknown command: %s", msg->command);
@@ -582,69 +1074,624 @@ void handle_command(BrowserMessage *msg) {
     }
 }
 
-int main() {
+// Start the new binary; this process keeps serving until it is ready
+static void begin_upgrade() {
+    if (upgrade_phase != UPGRADE_IDLE) {
+        log_warn("[Browser] Hot restart already in progress");
+        return;
+    }
+    if (shard_count() > 1) {
+        log_warn("[Browser] Hot restart is not supported with several shards");
+        return;
+    }
+    upgrade_sock = upgrade_start(browser_path, browser_argv, &upgrade_child);
+    if (upgrade_sock < 0) {
+        log_error("[Browser] Hot restart failed: cannot start %s", browser_path);
+        return;
+    }
+    upgrade_phase = UPGRADE_STARTING;
+    upgrade_deadline = monotonic_ms() + UPGRADE_READY_MS;
+    log_info("[Browser] Hot restart: started process %d", (int)upgrade_child);
+}
+
+// Keep serving as before; the new process is stopped if still running
+static void abort_upgrade(const char *reason) {
+    log_error("[Browser] Hot restart abandoned: %s", reason);
+    kill(upgrade_child, SIGKILL);
+    waitpid(upgrade_child, NULL, 0);
+    close(upgrade_sock);
+    upgrade_sock = -1;
+    upgrade_child = 0;
+    upgrade_phase = UPGRADE_IDLE;
+    
+    // Take back what was released for the handoff
+    if (tab_states == local_tab_states) {
+        TabState *mapped = snapshot_open(snapshot_path);
+        if (mapped) tab_states = mapped;
+    }
+    if (trace_path && !trace_enabled()) {
+        trace_resume(trace_path, trace_started_ns(), trace_commands());
+    }
+}
+
+// Nothing left that the tabs are waiting for: commands already read,
+// foreground renders and queued responses
+static int upgrade_drained() {
+    if (sched_pending() > 0 || render_busy_count() > render_prefetching()) return 0;
+    for (int i = 0; i < outqueue_count(); i++) {
+        if (outqueue_pending(outqueue_at(i))) return 0;
+    }
+    return 1;
+}
+
+// Hand BROWSER_FIFO, the response FIFOs and the shared memory over to
+// the new process and exit, leaving all of them in place
+static void finish_upgrade(int fifo_fd) {
+    UpgradeState state = {
+        .magic = UPGRADE_MAGIC,
+        .pid = getpid(),
+        .shmid = shmid,
+        .semid = semid,
+        .trace_started = trace_started_ns(),
+        .trace_seq = trace_enabled() ? trace_commands() : 0
+    };
+    int fds[1 + UPGRADE_MAX_QUEUES];
+    char *partials[UPGRADE_MAX_QUEUES];
+    fds[0] = fifo_fd;
+    for (int i = 0; i < outqueue_count() && state.queue_count < UPGRADE_MAX_QUEUES; i++) {
+        OutQueue *q = outqueue_at(i);
+        if (q->fd < 0) continue;
+        
+        // A response the tab is in the middle of reading goes to the new
+        // process, which finishes it; the rest were not started
+        int n = state.queue_count;
+        size_t length, offset;
+        int dropped = outqueue_take_partial(q, &partials[n], &length, &offset);
+        if (dropped < 0) {
+            for (int j = 0; j < n; j++) free(partials[j]);
+            abort_upgrade("out of memory");
+            return;
+        }
+        if (dropped > 0) {
+            log_warn("[Browser] %d responses still queued for tab %d are dropped at the handoff",
+                     dropped, q->tab_id);
+        }
+        state.tab_ids[n] = q->tab_id;
+        state.partial_length[n] = length;
+        state.partial_offset[n] = offset;
+        fds[1 + n] = q->fd;
+        state.queue_count++;
+    }
+    
+    // Held page loads would be lost with this process
+    coalesce_flush(shared_state, 1);
+    
+    // The new process loads the search index once it has taken over
+    ftindex_save();
+    
+    // The new process maps the session and appends to the trace next
+    if (tab_states != local_tab_states) {
+        snapshot_close(shared_state);
+        tab_states = local_tab_states;
+    }
+    trace_close();
+    
+    int sent = upgrade_send(upgrade_sock, &state, fds, partials);
+    for (int i = 0; i < state.queue_count; i++) free(partials[i]);
+    if (sent < 0) {
+        abort_upgrade("the new process did not take over");
+        return;
+    }
+    
+    log_info("[Browser] Handed over to process %d", (int)upgrade_child);
+    render_shutdown();
+    log_close();
+    
+    // Holding the lock keeps the broadcast manager out of the segment;
+    // SEM_UNDO releases it when the process exits
+    lock_shared_memory();
+    exit(0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-H high_watermark] [-L low_watermark] [-P drop|coalesce|disconnect]"
+            " [-d render_timeout_ms] [-w renderers] [-R renders_per_renderer]"
+            " [-C cache_bytes] [-p prefetch_renderers] [-l log_file] [-t trace_file]"
+            " [-S session_file] [-I search_index] [-n instance] [-s shards] [-B broadcast_rate[:burst]]"
+            " [-F broadcast_flush_ms]\n", prog);
+}
+
+// Read every message currently in the FIFO and queue it for the scheduler
+static void read_messages(int fd) {
+    BrowserMessage batch[16];
+    
+    for (;;) {
+        ssize_t n = read(fd, batch, sizeof(batch));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("read");
+            return;
+        }
+        
+        // Writers send whole messages atomically, so reads are message-aligned
+        int count = n / sizeof(BrowserMessage);
+        for (int i = 0; i < count; i++) {
+            BrowserMessage *msg = &batch[i];
+            msg->command[MAX_MSG - 1] = '\0';
+            log_debug("[Browser] Tab %d sent: %s", msg->tab_id, msg->command);
+            
+            // Another shard's tab, from a client that wrote to shard 0
+            int forwarded = shard_index == 0 ? shard_forward(msg) : 0;
+            if (forwarded > 0) continue;
+            if (forwarded < 0) {
+                char response[MAX_MSG];
+                snprintf(response, sizeof(response),
+                        "[Browser] Shard %d is not running, dropped: %.400s",
+                        instance_shard_of(msg->tab_id, shard_count()), msg->command);
+                send_response(msg->tab_id, response);
+                continue;
+            }
+            
+            // Add timestamp
+            msg->timestamp = time(NULL);
+            
+            // A tab disconnected for not reading is reading again
+            OutQueue *q = outqueue_get(msg->tab_id);
+            if (q) outqueue_resume(q);
+            
+            // The scheduler needs the type to pick a priority class. A
+            // value this browser does not know is classified again.
+            if (msg->cmd_type == CMD_UNKNOWN || (unsigned)msg->cmd_type >= CMD_COUNT) {
+                msg->cmd_type = get_command_type(msg->command);
+            }
+            trace_command(msg);
+            
+            if (sched_push(msg) < 0) {
+                char response[MAX_MSG];
+                snprintf(response, sizeof(response),
+                        "[Browser] Too many pending commands, dropped: %.400s", msg->command);
+                send_response(msg->tab_id, response);
+            }
+        }
+        
+        if (n < (ssize_t)sizeof(batch)) return;
+    }
+}
+
+int main(int argc, char *argv[]) {
     int fd;
-    BrowserMessage msg;
+    int opt;
+    RenderConfig render_config = {
+        .workers = sysconf(_SC_NPROCESSORS_ONLN),
+        .recycle_after = RENDER_DEFAULT_RECYCLE,
+        .timeout_ms = RENDER_DEFAULT_TIMEOUT_MS,
+        .on_done = on_render_done,
+        .child_setup = on_render_fork
+    };
+    
+    size_t cache_bytes = CACHE_DEFAULT_BUDGET;
+    const char *instance_name = NULL;        // INSTANCE_ENV if not given
+    int shards = 1;
+    CoalesceConfig coalesce_config = {
+        .rate = COALESCE_DEFAULT_RATE,
+        .burst = COALESCE_DEFAULT_BURST,
+        .flush_ms = COALESCE_DEFAULT_FLUSH_MS
+    };
+    
+    // Activity goes to the log file and, from the writer thread, to stdout
+    LogConfig log_config = {
+        .path = NULL,                // Defaults to the instance's
+        .max_bytes = LOG_DEFAULT_MAX_BYTES,
+        .keep = LOG_DEFAULT_KEEP,
+        .echo_fd = STDOUT_FILENO,
+        .level = LOG_LEVEL_INFO
+    };
+    
+    while ((opt = getopt(argc, argv, "H:L:P:d:w:R:C:p:l:t:S:I:n:s:B:F:")) != -1) {
+        switch (opt) {
+            case 'H':
+                outqueue_config.high_watermark = strtoul(optarg, NULL, 10);
+                break;
+            case 'L':
+                outqueue_config.low_watermark = strtoul(optarg, NULL, 10);
+                break;
+            case 'P':
+                if (outqueue_parse_policy(optarg, &outqueue_config.policy) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd':
+                render_config.timeout_ms = atoi(optarg);
+                if (render_config.timeout_ms <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                render_config.workers = atoi(optarg);
+                if (render_config.workers <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                render_config.recycle_after = atoi(optarg);
+                if (render_config.recycle_after <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'C':
+                cache_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                prefetch_workers = atoi(optarg);
+                if (prefetch_workers < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l':
+                log_config.path = optarg;
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'S':
+                snapshot_path = optarg;
+                break;
+            case 'I':
+                index_path = optarg;
+                break;
+            case 'n':
+                instance_name = optarg;
+                break;
+            case 'B':
+                if (coalesce_parse_rate(optarg, &coalesce_config) < 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'F':
+                coalesce_config.flush_ms = atoi(optarg);
+                if (coalesce_config.flush_ms <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                shards = atoi(optarg);
+                if (shards < 1 || shards > INSTANCE_MAX_SHARDS) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (outqueue_config.low_watermark > outqueue_config.high_watermark) {
+        fprintf(stderr, "Low watermark must not exceed the high watermark\n");
+        return 1;
+    }
+    if (instance_select(instance_name) < 0) {
+        fprintf(stderr, "Instance names are letters, digits, '-' and '_'\n");
+        return 1;
+    }
+    if (!log_config.path) log_config.path = instance_get()->log_path;
+    if (!snapshot_path) snapshot_path = instance_get()->snapshot_path;
+    if (!index_path) index_path = instance_get()->index_path;
+    
+    // Shards share the session and keep their own log and trace files;
+    // -w counts renderers across all of them
+    shard_index = shard_self();
+    static char shard_log_path[MAX_MSG], shard_trace_path[MAX_MSG];
+    shard_path(log_config.path, shard_log_path, sizeof(shard_log_path));
+    log_config.path = shard_log_path;
+    if (trace_path) {
+        shard_path(trace_path, shard_trace_path, sizeof(shard_trace_path));
+        trace_path = shard_trace_path;
+    }
+    static char shard_index_path[MAX_MSG];
+    shard_path(index_path, shard_index_path, sizeof(shard_index_path));
+    index_path = shard_index_path;
+    render_config.workers = render_config.workers / shards > 0 ? render_config.workers / shards : 1;
+    instance_shard_fifo(shard_index, browser_fifo_path, sizeof(browser_fifo_path));
     
     // Set up signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR2, upgrade_signal_handler);
+    browser_argv = argv;
+
+    // argv[0] has no slash when the browser was found through PATH, so
+    // shards and hot restarts run the binary by its real path
+    ssize_t path_length = readlink("/proc/self/exe", browser_path, sizeof(browser_path) - 1);
+    if (path_length > 0) browser_path[path_length] = '\0';
+    else snprintf(browser_path, sizeof(browser_path), "%s", argv[0]);
+    
+    // A tab exiting mid-write must surface as EPIPE, not kill the browser
+    signal(SIGPIPE, SIG_IGN);
     
     // Initialize tab states
     for (int i = 0; i < MAX_TABS; i++) {
         tab_states[i].tab_id = 0;
     }
     
-    // Initialize shared memory
-    shmid = init_shared_memory();
-    if (shmid < 0) {
-        fprintf(stderr, "Failed to initialize shared memory\n");
+    if (log_open(&log_config) < 0) {
+        fprintf(stderr, "Failed to open log file %s\n", log_config.path);
         return 1;
     }
     
-    // Initialize semaphores for synchronization
-    semid = init_semaphores();
-    if (semid < 0) {
-        fprintf(stderr, "Failed to initialize semaphores\n");
+    cache_init(cache_bytes);
+    coalesce_init(&coalesce_config);
+    
+    // Start the renderer pool
+    if (render_init(&render_config) < 0) {
+        fprintf(stderr, "Failed to start renderer processes\n");
         return 1;
     }
     
-    // Attach to shared memory
-    shared_state = (SharedState *)attach_shared_memory(shmid);
-    if (!shared_state) {
-        fprintf(stderr, "Failed to attach shared memory\n");
+    // Started by a hot restart: the old process serves the tabs until it
+    // has handed everything over
+    UpgradeState upgrade;
+    int handed_fds[1 + UPGRADE_MAX_QUEUES];
+    char *partials[UPGRADE_MAX_QUEUES];
+    int inherited_sock = upgrade_inherited();
+    if (inherited_sock >= 0) {
+        int received = upgrade_receive(inherited_sock, &upgrade, handed_fds, partials);
+        close(inherited_sock);
+        if (received < 0) {
+            render_shutdown();
+            return 1;
+        }
+    }
+    
+    // Refuse to share an instance with a running browser (the old
+    // process of a hot restart is this one's parent, as is shard 0 of
+    // a shard)
+    if (shard_index == 0 && instance_register() < 0) {
+        render_shutdown();
         return 1;
     }
     
-    // Create broadcast manager thread
-    pthread_create(&broadcast_thread, NULL, broadcast_manager, NULL);
+    // Pages are looked up and read from the catalog, falling back to the
+    // file system if the directory cannot be watched
+    if (catalog_open(".", RENDER_INPUT_MAX) < 0) {
+        log_warn("[Catalog] Cannot watch the page directory, pages are read from disk");
+    }
+    
+    // Each shard indexes the pages it renders, and keeps its own index
+    ftindex_open(index_path);
+    
+    // Tabs come back from the last session with their history
+    TabState *mapped = shard_index == 0 ? snapshot_open(snapshot_path) : snapshot_attach(snapshot_path);
+    if (mapped) {
+        tab_states = mapped;
+    } else {
+        log_warn("[Session] Cannot use %s, tab state will not be saved", snapshot_path);
+    }
     
-    // Create FIFO if it doesn't exist
-    mkfifo(BROWSER_FIFO, 0666);
+    if (inherited_sock >= 0 || shard_index > 0) {
+        // The segment and semaphore are live: attach without resetting them
+        shmid = inherited_sock >= 0 ? upgrade.shmid : find_shared_memory();
+        semid = attach_semaphores();
+        shared_state = (SharedState *)attach_shared_memory(shmid);
+        if (shmid < 0 || semid < 0 || !shared_state) {
+            fprintf(stderr, "Failed to attach the existing shared memory\n");
+            return 1;
+        }
+        visit_index = visits_attach(1);
+    } else {
+        // Initialize shared memory
+        shmid = init_shared_memory();
+        if (shmid < 0) {
+            fprintf(stderr, "Failed to initialize shared memory\n");
+            return 1;
+        }
+        
+        // Initialize semaphores for synchronization
+        semid = init_semaphores();
+        if (semid < 0) {
+            fprintf(stderr, "Failed to initialize semaphores\n");
+            return 1;
+        }
+        
+        // Attach to shared memory
+        shared_state = (SharedState *)attach_shared_memory(shmid);
+        if (!shared_state) {
+            fprintf(stderr, "Failed to attach shared memory\n");
+            return 1;
+        }
+        snapshot_restore_shared(shared_state);
+        shared_state->shard_count = shards;
+        visit_index = visits_create();
+    }
+    if (!visit_index) {
+        log_warn("[Visits] No visit index, tabs will not complete URLs");
+    }
+    
+    if (trace_path) {
+        int traced = inherited_sock >= 0 && upgrade.trace_seq > 0
+                     ? trace_resume(trace_path, upgrade.trace_started, upgrade.trace_seq)
+                     : trace_open(trace_path);
+        if (traced < 0) {
+            fprintf(stderr, "Failed to open trace file %s\n", trace_path);
+            return 1;
+        }
+    }
+    
+    // Create broadcast manager thread; one for all shards
+    if (shard_index == 0) {
+        pthread_create(&broadcast_thread, NULL, broadcast_manager, NULL);
+        broadcast_started = 1;
+    }
+    
+    if (inherited_sock >= 0) {
+        fd = handed_fds[0];
+        for (int i = 0; i < upgrade.queue_count; i++) {
+            outqueue_adopt(upgrade.tab_ids[i], handed_fds[1 + i], partials[i],
+                           upgrade.partial_length[i], upgrade.partial_offset[i]);
+            free(partials[i]);
+        }
+        log_info("[Browser] Took over from process %d with %d tabs connected",
+                 (int)upgrade.pid, upgrade.queue_count);
+    } else {
+        // Create FIFO if it doesn't exist
+        mkfifo(browser_fifo_path, 0666);
+        
+        // O_RDWR keeps the FIFO open (no EOF) when the last tab disconnects
+        fd = open(browser_fifo_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            perror("open");
+            return 1;
+        }
+    }
+    
+    if (shard_start(browser_path, argv, shards) < 0) {
+        fprintf(stderr, "Failed to start browser shards\n");
+        cleanup();
+        return 1;
+    }
 
-    printf("[Browser] Listening on %s...\n", BROWSER_FIFO);
-    printf("[Browser] Shared memory active with key %d\n", SHM_KEY);
+    printf("[Browser] Listening on %s...\n", browser_fifo_path);
+    printf("[Browser] Shared memory active with key %d\n", (int)instance_get()->shm_key);
     printf("[Browser] Tab synchronization available\n");
 
-    while (1) {
-        fd = open(BROWSER_FIFO, O_RDONLY);
-        if (fd < 0) {
-            perror("open");
-            continue;
+    // Event loop: requests from BROWSER_FIFO, doorbells from renderers,
+    // plus every tab whose output queue still has data waiting for its
+    // FIFO to drain. Commands run one per iteration, so new requests
+    // reach the scheduler between them.
+    struct pollfd *fds = NULL;
+    OutQueue **polled = NULL;
+    int fds_capacity = 0;
+
+    while (running) {
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            begin_upgrade();
+        }
+        
+        int needed = outqueue_count() + render_fd_count() + 3;
+        if (needed > fds_capacity) {
+            fds_capacity = needed * 2;
+            fds = realloc(fds, fds_capacity * sizeof(struct pollfd));
+            polled = realloc(polled, fds_capacity * sizeof(OutQueue *));
+            if (!fds || !polled) {
+                fprintf(stderr, "Out of memory\n");
+                break;
+            }
         }
 
-        while (read(fd, &msg, sizeof(msg)) > 0) {
-            printf("[Browser] Tab %d sent: %s\n", msg.tab_id, msg.command);
-            
-            // Add timestamp
-            msg.timestamp = time(NULL);
-            
+        // While draining for a hot restart, new commands wait in the FIFO
+        int nfds = 0;
+        fds[nfds].fd = fd;
+        fds[nfds].events = upgrade_phase == UPGRADE_DRAINING ? 0 : POLLIN;
+        nfds++;
+        int upgrade_index = -1;
+        if (upgrade_phase == UPGRADE_STARTING) {
+            fds[nfds].fd = upgrade_sock;
+            fds[nfds].events = POLLIN;
+            upgrade_index = nfds++;
+        }
+        int catalog_index = -1;
+        if (catalog_active()) {
+            fds[nfds].fd = catalog_fd();
+            fds[nfds].events = POLLIN;
+            catalog_index = nfds++;
+        }
+        int first_render = nfds;
+        for (int i = 0; i < render_fd_count(); i++) {
+            fds[nfds].fd = render_fd_at(i);
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+        int first_queue = nfds;
+        for (int i = 0; i < outqueue_count(); i++) {
+            OutQueue *q = outqueue_at(i);
+            if (outqueue_pending(q)) {
+                fds[nfds].fd = q->fd;
+                fds[nfds].events = POLLOUT;
+                polled[nfds] = q;
+                nfds++;
+            }
+        }
+
+        int timeout = sched_ready(render_available()) ? 0 : render_next_timeout();
+        if (upgrade_phase != UPGRADE_IDLE && (timeout < 0 || timeout > 100)) timeout = 100;
+        if (shard_count() > 1 && (timeout < 0 || timeout > 500)) timeout = 500;
+        int flush_timeout = coalesce_next_timeout();
+        if (flush_timeout >= 0 && (timeout < 0 || timeout > flush_timeout)) timeout = flush_timeout;
+        int scan_timeout = ftindex_next_timeout();
+        if (scan_timeout >= 0 && (timeout < 0 || timeout > scan_timeout)) timeout = scan_timeout;
+        if (poll(fds, nfds, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        // Page changes first, so the commands below see them
+        if (catalog_index >= 0 && fds[catalog_index].revents) {
+            catalog_handle();
+        }
+        
+        // Drain writable queues first so their space is freed before new work
+        for (int i = first_queue; i < nfds; i++) {
+            if (fds[i].revents) {
+                outqueue_flush(polled[i]);
+            }
+        }
+
+        for (int i = first_render; i < first_queue; i++) {
+            if (fds[i].revents) {
+                render_handle(fds[i].fd);
+            }
+        }
+        render_expire();
+
+        if (upgrade_index >= 0 && fds[upgrade_index].revents) {
+            if (upgrade_wait_ready(upgrade_sock) > 0) {
+                upgrade_phase = UPGRADE_DRAINING;
+                upgrade_deadline = monotonic_ms() + UPGRADE_DRAIN_MS;
+                log_info("[Browser] Hot restart: process %d is ready, draining", (int)upgrade_child);
+            } else {
+                abort_upgrade("the new process exited");
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            read_messages(fd);
+        }
+        shard_supervise();
+        coalesce_flush(shared_state, 0);
+        ftindex_scan();
+
+        BrowserMessage msg;
+        double wait_ms;
+        if (sched_next(&msg, &wait_ms, render_available())) {
             handle_command(&msg);
         }
 
-        close(fd);
+        // Prefetch only while no foreground command is waiting for a worker
+        if (sched_pending_class(SCHED_RENDER) > 0 && !render_available()) {
+            render_preempt();
+        } else if (!sched_ready(render_available()) && upgrade_phase == UPGRADE_IDLE) {
+            start_prefetches();
+        }
+
+        if (upgrade_phase == UPGRADE_STARTING && monotonic_ms() > upgrade_deadline) {
+            abort_upgrade("the new process did not become ready");
+        } else if (upgrade_phase == UPGRADE_DRAINING &&
+                   (upgrade_drained() || monotonic_ms() > upgrade_deadline)) {
+            finish_upgrade(fd);
+        }
     }
 
+    free(fds);
+    free(polled);
+    close(fd);
     cleanup();
     return 0;
 }
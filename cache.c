@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "catalog.h"
+
+CacheStats cache_stats;
+
+static size_t budget = CACHE_DEFAULT_BUDGET;
+
+// Most recently used first
+static CacheEntry *head = NULL;
+static CacheEntry *tail = NULL;
+
+static size_t entry_bytes(const CacheEntry *e) {
+    return sizeof(CacheEntry) + strlen(e->html_file) + 1 + e->length + 1 + e->links_size;
+}
+
+static void unlink_entry(CacheEntry *e) {
+    if (e->prev) e->prev->next = e->next;
+    else head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void push_front(CacheEntry *e) {
+    e->prev = NULL;
+    e->next = head;
+    if (head) head->prev = e;
+    head = e;
+    if (!tail) tail = e;
+}
+
+static void free_entry(CacheEntry *e) {
+    cache_stats.bytes -= entry_bytes(e);
+    cache_stats.entries--;
+    free(e->html_file);
+    free(e->text);
+    free(e->links);
+    free(e);
+}
+
+static CacheEntry *find(const char *html_file) {
+    for (CacheEntry *e = head; e; e = e->next) {
+        if (strcmp(e->html_file, html_file) == 0) return e;
+    }
+    return NULL;
+}
+
+// Drop the entry if the page changed on disk since it was rendered
+static int still_valid(CacheEntry *e) {
+    off_t size;
+    struct timespec mtime;
+    if (catalog_stat(e->html_file, &size, &mtime) == 0 && size == e->file_size &&
+        mtime.tv_sec == e->file_mtime.tv_sec && mtime.tv_nsec == e->file_mtime.tv_nsec) {
+        return 1;
+    }
+    unlink_entry(e);
+    free_entry(e);
+    return 0;
+}
+
+void cache_init(size_t new_budget) {
+    budget = new_budget;
+    cache_clear();
+}
+
+size_t cache_budget() {
+    return budget;
+}
+
+const CacheEntry *cache_lookup(const char *html_file) {
+    CacheEntry *e = find(html_file);
+    if (!e || !still_valid(e)) {
+        cache_stats.misses++;
+        return NULL;
+    }
+
+    unlink_entry(e);
+    push_front(e);
+    cache_stats.hits++;
+    if (e->prefetched) {
+        cache_stats.prefetch_hits++;
+        e->prefetched = 0;
+    }
+    return e;
+}
+
+int cache_contains(const char *html_file) {
+    CacheEntry *e = find(html_file);
+    return e && still_valid(e);
+}
+
+void cache_insert(const char *html_file, const char *text, const char *links,
+                  size_t links_size, unsigned int generation, int prefetched) {
+    if (budget == 0) return;
+
+    off_t file_size;
+    struct timespec file_mtime;
+    if (catalog_stat(html_file, &file_size, &file_mtime) < 0) return;
+
+    CacheEntry *old = find(html_file);
+    if (old) {
+        unlink_entry(old);
+        free_entry(old);
+    }
+
+    CacheEntry *e = calloc(1, sizeof(CacheEntry));
+    if (!e) return;
+    e->html_file = strdup(html_file);
+    e->length = strlen(text);
+    e->text = malloc(e->length + 1);
+    e->links_size = links_size;
+    e->links = malloc(links_size ? links_size : 1);
+    if (!e->html_file || !e->text || !e->links) {
+        free(e->html_file);
+        free(e->text);
+        free(e->links);
+        free(e);
+        return;
+    }
+    memcpy(e->text, text, e->length + 1);
+    if (links_size) memcpy(e->links, links, links_size);
+    else e->links[0] = '\0';
+    e->file_size = file_size;
+    e->file_mtime = file_mtime;
+    e->generation = generation;
+    e->prefetched = prefetched;
+
+    size_t size = entry_bytes(e);
+    if (size > budget) {
+        free(e->html_file);
+        free(e->text);
+        free(e->links);
+        free(e);
+        return;
+    }
+
+    // Evict least recently used entries until the new one fits
+    while (tail && cache_stats.bytes + size > budget) {
+        CacheEntry *victim = tail;
+        unlink_entry(victim);
+        free_entry(victim);
+        cache_stats.evictions++;
+    }
+
+    push_front(e);
+    cache_stats.bytes += size;
+    cache_stats.entries++;
+    cache_stats.insertions++;
+}
+
+void cache_clear() {
+    while (head) {
+        CacheEntry *e = head;
+        unlink_entry(e);
+        free_entry(e);
+    }
+}
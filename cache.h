@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Render cache: rendered text of recently shown or prefetched pages,
+// keyed by HTML file and kept within a memory budget by evicting the
+// least recently used entries. An entry is only served while the file's
+// size and modification time still match.
+
+#define CACHE_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+typedef struct CacheEntry {
+    struct CacheEntry *prev;
+    struct CacheEntry *next;
+    char *html_file;
+    char *text;
+    size_t length;
+    char *links;                 // NUL-separated hrefs found on the page
+    size_t links_size;
+    unsigned int generation;     // Content version sent to tabs with the text
+    off_t file_size;
+    struct timespec file_mtime;
+    int prefetched;              // Filled by the prefetcher and not used yet
+} CacheEntry;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long prefetch_hits; // Hits on entries the prefetcher filled
+    unsigned long insertions;
+    unsigned long evictions;
+    size_t bytes;
+    int entries;
+} CacheStats;
+
+extern CacheStats cache_stats;
+
+// Set the memory budget in bytes; 0 disables caching
+void cache_init(size_t budget);
+size_t cache_budget();
+
+// Find a still-valid entry and mark it most recently used, or NULL
+const CacheEntry *cache_lookup(const char *html_file);
+
+// Like cache_lookup() but without touching the LRU order or statistics
+int cache_contains(const char *html_file);
+
+// Store (or replace) the rendered text of a page
+void cache_insert(const char *html_file, const char *text, const char *links,
+                  size_t links_size, unsigned int generation, int prefetched);
+
+void cache_clear();
+
+#endif
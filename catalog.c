@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "common.h"
+#include "catalog.h"
+#include "log.h"
+
+#define CATALOG_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_DELETE | \
+                        IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+CatalogStats catalog_stats;
+
+static int notify_fd = -1;
+static int dir_fd = -1;
+static size_t map_limit = 0;
+
+static CatalogPage *pages = NULL;
+static int page_count = 0, page_capacity = 0;
+static NameTable table;
+
+static sigjmp_buf copy_jump;
+static volatile sig_atomic_t copying = 0;
+
+static const char *page_key(int i) { return pages[i].name; }
+
+static int find(const char *name, int create) {
+    if (table.slot_count == 0) return -1;
+    int *slot = name_table_slot(&table, name, page_key);
+    if (*slot >= 0) return *slot;
+    if (!create) return -1;
+
+    if (page_count == page_capacity) {
+        int capacity = page_capacity ? page_capacity * 2 : 256;
+        CatalogPage *grown = realloc(pages, capacity * sizeof(CatalogPage));
+        if (!grown) return -1;
+        pages = grown;
+        page_capacity = capacity;
+    }
+    CatalogPage *p = &pages[page_count];
+    memset(p, 0, sizeof(*p));
+    p->name = strdup(name);
+    *slot = page_count++;
+    if (page_count * 2 > table.slot_count) name_table_rehash(&table, page_count, page_key);
+    return page_count - 1;
+}
+
+static void unmap(CatalogPage *p) {
+    if (!p->data) return;
+    munmap((void *)p->data, p->size);
+    catalog_stats.mapped_bytes -= p->size;
+    p->data = NULL;
+}
+
+// Bring one page in line with the directory; map it unless it is
+// still being written
+static void refresh(int index, int map) {
+    CatalogPage *p = &pages[index];
+    struct stat st;
+    if (fstatat(dir_fd, p->name, &st, 0) < 0 || !S_ISREG(st.st_mode)) {
+        unmap(p);
+        if (p->present) catalog_stats.pages--;
+        p->present = 0;
+        return;
+    }
+
+    int same = p->present && p->inode == st.st_ino && p->size == st.st_size &&
+               p->mtime.tv_sec == st.st_mtim.tv_sec && p->mtime.tv_nsec == st.st_mtim.tv_nsec;
+    if (same && map && (p->data || p->size == 0 || (size_t)p->size > map_limit)) return;
+
+    unmap(p);
+    if (!p->present) catalog_stats.pages++;
+    else if (!same) catalog_stats.refreshes++;
+    p->present = 1;
+    p->inode = st.st_ino;
+    p->size = st.st_size;
+    p->mtime = st.st_mtim;
+    if (!map || p->size == 0 || (size_t)p->size > map_limit) return;
+
+    int fd = openat(dir_fd, p->name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    void *data = mmap(NULL, p->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    p->data = data;
+    catalog_stats.mapped_bytes += p->size;
+}
+
+static void scan() {
+    DIR *dir = fdopendir(dup(dir_fd));
+    if (!dir) {
+        perror("fdopendir");
+        return;
+    }
+    rewinddir(dir);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (html_name(entry->d_name)) find(entry->d_name, 1);
+    }
+    closedir(dir);
+
+    // Pages that are gone are found by refreshing them
+    for (int i = 0; i < page_count; i++) refresh(i, 1);
+}
+
+static void on_sigbus(int sig) {
+    if (copying) siglongjmp(copy_jump, 1);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+int catalog_open(const char *dir, size_t map_max) {
+    dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        perror("open page directory");
+        return -1;
+    }
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify_fd < 0 || inotify_add_watch(notify_fd, dir, CATALOG_EVENTS | IN_ONLYDIR) < 0) {
+        perror("inotify");
+        catalog_close();
+        return -1;
+    }
+
+    // Not deferred, so a fault can jump out of the handler without a
+    // signal mask to restore
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigbus;
+    sa.sa_flags = SA_NODEFER;
+    sigaction(SIGBUS, &sa, NULL);
+
+    map_limit = map_max;
+    name_table_rehash(&table, page_count, page_key);
+    scan();
+    log_info("[Catalog] %d pages, %zu bytes mapped", catalog_stats.pages, catalog_stats.mapped_bytes);
+    return 0;
+}
+
+void catalog_close() {
+    for (int i = 0; i < page_count; i++) {
+        unmap(&pages[i]);
+        free(pages[i].name);
+    }
+    free(pages);
+    free(table.slots);
+    pages = NULL;
+    table.slots = NULL;
+    page_count = page_capacity = table.slot_count = 0;
+    catalog_stats.pages = 0;
+    if (notify_fd >= 0) close(notify_fd);
+    if (dir_fd >= 0) close(dir_fd);
+    notify_fd = dir_fd = -1;
+}
+
+int catalog_active() {
+    return notify_fd >= 0;
+}
+
+int catalog_fd() {
+    return notify_fd;
+}
+
+void catalog_handle() {
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(notify_fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+
+        for (char *at = buffer; at < buffer + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)at;
+            at += sizeof(struct inotify_event) + event->len;
+            catalog_stats.events++;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                log_warn("[Catalog] Missed events, scanning the page directory again");
+                catalog_stats.rescans++;
+                scan();
+                continue;
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                log_warn("[Catalog] The page directory was moved or deleted");
+                continue;
+            }
+            if (event->len == 0 || !html_name(event->name)) continue;
+
+            int index = find(event->name, 1);
+            if (index < 0) continue;
+            // A file still being written is mapped once it is closed
+            refresh(index, !(event->mask & IN_MODIFY));
+        }
+    }
+}
+
+const CatalogPage *catalog_lookup(const char *html_file) {
+    if (notify_fd < 0) return NULL;
+    int index = find(html_file, 0);
+    return index >= 0 && pages[index].present ? &pages[index] : NULL;
+}
+
+int catalog_stat(const char *html_file, off_t *size, struct timespec *mtime) {
+    if (notify_fd >= 0) {
+        const CatalogPage *p = catalog_lookup(html_file);
+        if (!p) return -1;
+        if (size) *size = p->size;
+        if (mtime) *mtime = p->mtime;
+        return 0;
+    }
+
+    struct stat st;
+    if (stat(html_file, &st) < 0 || !S_ISREG(st.st_mode)) return -1;
+    if (size) *size = st.st_size;
+    if (mtime) *mtime = st.st_mtim;
+    return 0;
+}
+
+int catalog_exists(const char *html_file) {
+    return catalog_stat(html_file, NULL, NULL) == 0;
+}
+
+int catalog_count() {
+    return notify_fd >= 0 ? page_count : 0;
+}
+
+const CatalogPage *catalog_at(int index) {
+    return &pages[index];
+}
+
+int catalog_copy(const CatalogPage *page, void *dst) {
+    if (sigsetjmp(copy_jump, 0)) {
+        copying = 0;
+        catalog_stats.faults++;
+        return -1;
+    }
+    copying = 1;
+    memcpy(dst, page->data, page->size);
+    copying = 0;
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+// Page catalog.
+// The HTML files of the page directory, by name, with their inode, size
+// and modification time and a read-only mapping of their contents. It is
+// filled by one directory scan and then kept current by inotify events,
+// which the event loop reads from catalog_fd(). Commands look pages up
+// here instead of probing the file system, and renders copy the mapped
+// bytes, so a page that exists for a lookup is the page that gets
+// rendered.
+//
+// A file that is being written is unmapped until it is closed; a render
+// in between reads it from disk as before. Copying from a mapping is
+// guarded against SIGBUS, in case a file shrinks before its event has
+// been read.
+//
+// Without inotify (catalog_open() failed) every function falls back to
+// the file system.
+
+typedef struct {
+    char *name;
+    int present;                 // 0 once deleted; the slot is reused if it comes back
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    const char *data;            // NULL while written, if empty or larger than the limit
+} CatalogPage;
+
+typedef struct {
+    int pages;
+    size_t mapped_bytes;
+    unsigned long events;
+    unsigned long refreshes;     // Pages mapped again after a change
+    unsigned long rescans;       // After the event queue overflowed
+    unsigned long faults;        // Copies cut short by SIGBUS
+} CatalogStats;
+
+extern CatalogStats catalog_stats;
+
+// Catalog the *.html files in dir and watch it; files larger than
+// map_max are listed but not mapped. Returns -1 if inotify is unavailable.
+int catalog_open(const char *dir, size_t map_max);
+void catalog_close();
+
+int catalog_active();
+
+// inotify descriptor to poll for POLLIN, -1 if not active
+int catalog_fd();
+
+// Apply the pending events
+void catalog_handle();
+
+// The page, or NULL if there is no such file (only when active)
+const CatalogPage *catalog_lookup(const char *html_file);
+
+// Size and modification time of a page, from the catalog or from stat()
+// when it is not active. Returns -1 if the page does not exist.
+int catalog_stat(const char *html_file, off_t *size, struct timespec *mtime);
+
+int catalog_exists(const char *html_file);
+
+// Visit every page (only when active); skip those not present
+int catalog_count();
+const CatalogPage *catalog_at(int index);
+
+// Copy a mapped page (page->data) to dst. Returns -1 if the file shrank
+// under the copy.
+int catalog_copy(const CatalogPage *page, void *dst);
+
+#endif
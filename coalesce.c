@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "coalesce.h"
+
+typedef struct {
+    int tab_id;                          // 0 if the slot is unused
+    double tokens;
+    long long refilled_ms;               // When tokens was last brought up to date
+    int held;                            // Loads waiting for the summary
+    long long due_ms;                    // When the summary goes out
+    char latest_url[MAX_URL_LENGTH];
+} Sender;
+
+static CoalesceConfig config = {
+    COALESCE_DEFAULT_RATE, COALESCE_DEFAULT_BURST, COALESCE_DEFAULT_FLUSH_MS
+};
+static Sender senders[MAX_TABS];
+static int senders_holding = 0;
+CoalesceStats coalesce_stats;
+
+void coalesce_init(const CoalesceConfig *new_config) {
+    config = *new_config;
+    if (config.burst < 1) config.burst = 1;
+    if (config.flush_ms < 1) config.flush_ms = 1;
+    memset(senders, 0, sizeof(senders));
+    senders_holding = 0;
+}
+
+int coalesce_parse_rate(const char *text, CoalesceConfig *out) {
+    char *end;
+    double rate = strtod(text, &end);
+    if (end == text || rate < 0) return -1;
+    int burst = out->burst;
+    if (*end == ':') {
+        burst = atoi(end + 1);
+        if (burst < 1) return -1;
+    } else if (*end != '\0') {
+        return -1;
+    }
+    out->rate = rate;
+    out->burst = burst;
+    return 0;
+}
+
+static void send_summary(SharedState *state, Sender *s) {
+    char data[BROADCAST_MSG_SIZE];
+    if (s->held == 1) {
+        snprintf(data, sizeof(data), "%s", s->latest_url);
+    } else {
+        snprintf(data, sizeof(data), "%s (and %d more pages)", s->latest_url, s->held - 1);
+    }
+    broadcast_message(state, BROADCAST_PAGE_LOADED, s->tab_id, data);
+    coalesce_stats.summaries++;
+    s->held = 0;
+    senders_holding--;
+}
+
+void coalesce_page_loaded(SharedState *state, int tab_id, const char *url) {
+    if (config.rate <= 0) {
+        broadcast_message(state, BROADCAST_PAGE_LOADED, tab_id, url);
+        coalesce_stats.sent++;
+        return;
+    }
+
+    long long now = monotonic_ms();
+    Sender *s = &senders[tab_id % MAX_TABS];
+    if (s->tab_id != tab_id) {
+        // A new tab in the slot: whatever the old one held goes out first
+        if (s->held > 0) send_summary(state, s);
+        s->tab_id = tab_id;
+        s->tokens = config.burst;
+        s->refilled_ms = now;
+    }
+
+    s->tokens += (now - s->refilled_ms) * config.rate / 1000.0;
+    if (s->tokens > config.burst) s->tokens = config.burst;
+    s->refilled_ms = now;
+
+    // Loads keep their order: once one is held, the rest join it
+    if (s->held == 0 && s->tokens >= 1.0) {
+        s->tokens -= 1.0;
+        broadcast_message(state, BROADCAST_PAGE_LOADED, tab_id, url);
+        coalesce_stats.sent++;
+        return;
+    }
+
+    if (s->held++ == 0) {
+        s->due_ms = now + config.flush_ms;
+        senders_holding++;
+    }
+    snprintf(s->latest_url, sizeof(s->latest_url), "%s", url);
+    coalesce_stats.held++;
+}
+
+void coalesce_flush(SharedState *state, int force) {
+    if (senders_holding == 0) return;
+
+    long long now = monotonic_ms();
+    for (int i = 0; i < MAX_TABS; i++) {
+        Sender *s = &senders[i];
+        if (s->held > 0 && (force || now >= s->due_ms)) {
+            send_summary(state, s);
+        }
+    }
+}
+
+int coalesce_next_timeout() {
+    if (senders_holding == 0) return -1;
+
+    long long now = monotonic_ms();
+    long long next = -1;
+    for (int i = 0; i < MAX_TABS; i++) {
+        if (senders[i].held > 0 && (next < 0 || senders[i].due_ms < next)) {
+            next = senders[i].due_ms;
+        }
+    }
+    return next <= now ? 0 : (int)(next - now);
+}
@@ -0,0 +1,47 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include "shared_memory.h"
+
+// Page-load broadcast coalescing.
+// Every navigation of a synced tab used to become a BROADCAST_PAGE_LOADED,
+// so a tab replaying loads wrapped the broadcast ring within
+// milliseconds. Each sender now has a token bucket: loads within its
+// rate are broadcast as they happen. Loads beyond the rate are held, and
+// one summary per flush interval replaces them. The summary's data is
+// the latest URL followed by " (and N more pages)", so URL-prefix
+// subscriptions still apply to it.
+
+#define COALESCE_DEFAULT_RATE 2.0        // Broadcasts per second per tab
+#define COALESCE_DEFAULT_BURST 5         // Broadcasts a quiet tab may send at once
+#define COALESCE_DEFAULT_FLUSH_MS 1000   // Longest time a load is held
+
+typedef struct {
+    double rate;                         // 0 broadcasts every load
+    int burst;
+    int flush_ms;
+} CoalesceConfig;
+
+typedef struct {
+    unsigned long sent;                  // Broadcast as they happened
+    unsigned long held;                  // Folded into summaries
+    unsigned long summaries;
+} CoalesceStats;
+
+extern CoalesceStats coalesce_stats;
+
+void coalesce_init(const CoalesceConfig *config);
+
+// Parse "rate[:burst]" for -B. Returns -1 if it is not valid.
+int coalesce_parse_rate(const char *text, CoalesceConfig *config);
+
+// A synced tab loaded url: broadcast it now or hold it for a summary
+void coalesce_page_loaded(SharedState *state, int tab_id, const char *url);
+
+// Send the summaries that are due; force sends every held one
+void coalesce_flush(SharedState *state, int force);
+
+// Milliseconds until the next summary is due, -1 if none is held
+int coalesce_next_timeout();
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+
+extern char **environ;
+
+CommandType get_command_type(const char* cmd) {
+    if (strncmp(cmd, "load ", 5) == 0) return CMD_LOAD;
+    if (strcmp(cmd, "reload") == 0) return CMD_RELOAD;
+    if (strcmp(cmd, "back") == 0) return CMD_BACK;
+    if (strcmp(cmd, "forward") == 0) return CMD_FORWARD;
+    if (strcmp(cmd, "history") == 0) return CMD_HISTORY;
+    if (strcmp(cmd, "bookmark") == 0) return CMD_BOOKMARK;
+    if (strcmp(cmd, "bookmarks") == 0) return CMD_BOOKMARK_LIST;
+    if (strncmp(cmd, "open ", 5) == 0) return CMD_BOOKMARK_OPEN;
+    if (strncmp(cmd, "delete ", 7) == 0) return CMD_BOOKMARK_DELETE;
+    if (strcmp(cmd, "sync on") == 0) return CMD_SYNC_ON;
+    if (strcmp(cmd, "sync off") == 0) return CMD_SYNC_OFF;
+    if (strncmp(cmd, "broadcast ", 10) == 0) return CMD_BROADCAST;
+    if (strcmp(cmd, "status") == 0) return CMD_STATUS;
+    if (strcmp(cmd, "CRASH") == 0) return CMD_CRASH;
+    if (strncmp(cmd, "follow ", 7) == 0) return CMD_FOLLOW;
+    if (strcmp(cmd, "unfollow") == 0) return CMD_UNFOLLOW;
+    if (strcmp(cmd, "subscribe") == 0 || strncmp(cmd, "subscribe ", 10) == 0) return CMD_SUBSCRIBE;
+    if (strncmp(cmd, "unsubscribe ", 12) == 0) return CMD_UNSUBSCRIBE;
+    if (strcmp(cmd, "find") == 0 || strncmp(cmd, "find ", 5) == 0) return CMD_FIND;
+    return CMD_UNKNOWN;
+}
+
+char **env_with(const char *name, const char *value) {
+    size_t name_length = strlen(name);
+    size_t count = 0;
+    while (environ[count]) count++;
+
+    // Pointers, then the new entry's text
+    size_t entry_length = name_length + 1 + strlen(value) + 1;
+    char **env = malloc((count + 2) * sizeof(char *) + entry_length);
+    if (!env) return NULL;
+    char *entry = (char *)(env + count + 2);
+    strcpy(entry, name);
+    entry[name_length] = '=';
+    strcpy(entry + name_length + 1, value);
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(environ[i], name, name_length) == 0 && environ[i][name_length] == '=') continue;
+        env[n++] = environ[i];
+    }
+    env[n++] = entry;
+    env[n] = NULL;
+    return env;
+}
+
+uint32_t hash_bytes(const void *data, size_t length) {
+    const unsigned char *p = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t hash_string(const char *s) {
+    uint32_t hash = 2166136261u;
+    for (; *s; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void name_table_rehash(NameTable *table, int count, const char *(*key)(int)) {
+    int size = 1024;
+    while (size < count * 2) size *= 2;
+    free(table->slots);
+    table->slots = malloc(size * sizeof(int));
+    memset(table->slots, 0xff, size * sizeof(int));
+    table->slot_count = size;
+    for (int i = 0; i < count; i++) {
+        uint32_t h = hash_string(key(i)) & (size - 1);
+        while (table->slots[h] >= 0) h = (h + 1) & (size - 1);
+        table->slots[h] = i;
+    }
+}
+
+int *name_table_slot(const NameTable *table, const char *name, const char *(*key)(int)) {
+    uint32_t mask = table->slot_count - 1;
+    uint32_t h = hash_string(name) & mask;
+    for (; table->slots[h] >= 0; h = (h + 1) & mask) {
+        if (strcmp(key(table->slots[h]), name) == 0) break;
+    }
+    return &table->slots[h];
+}
+
+int html_name(const char *name) {
+    size_t length = strlen(name);
+    return length > 5 && strcmp(name + length - 5, ".html") == 0;
+}
+
+long long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
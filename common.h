@@ -2,6 +2,7 @@
 #define COMMON_H
 
 #include <time.h>
+#include <stdint.h>
 
 #define MAX_MSG 512
 #define BROWSER_FIFO "/tmp/browser_fifo"
@@ -25,9 +26,56 @@ typedef enum {
     CMD_BROADCAST,      // Send message to all tabs
     CMD_STATUS,         // Show browser status
     CMD_CRASH,          // Simulate crash
-    CMD_UNKNOWN         // Unknown command
+    CMD_UNKNOWN,        // Unknown command
+    // Recorded traces (trace.h) store these values, so new commands only
+    // ever go here and existing values never change. This does not make
+    // old tabs compatible: BrowserMessage is not versioned and the
+    // browser splits its FIFO by sizeof(BrowserMessage), so tabs must be
+    // built with the same message layout as the browser.
+    CMD_FOLLOW,         // Mirror another tab's navigation
+    CMD_UNFOLLOW,       // Stop mirroring
+    CMD_SUBSCRIBE,      // Choose the broadcasts the tab receives
+    CMD_UNSUBSCRIBE,    // Stop receiving some broadcasts
+    CMD_FIND,           // Search the text of local pages
+    CMD_COUNT           // Number of command types
 } CommandType;
 
+// Map a text command such as "load hello" to its type (common.c). The
+// browser and libtabclient share it, so they always agree.
+CommandType get_command_type(const char *cmd);
+
+// A copy of the environment with name set to value, built before fork()
+// so the child only has to execve() it. One allocation: free() it.
+// NULL on OOM.
+char **env_with(const char *name, const char *value);
+
+// FNV-1a, the hash of page names, URLs, lines and page text
+uint32_t hash_bytes(const void *data, size_t length);
+uint32_t hash_string(const char *s);
+
+// Open addressing table of indices into an array of named items, where
+// key(i) is the name of item i. Rebuilt when it gets half full and when
+// the items are renumbered.
+typedef struct {
+    int *slots;              // -1 if empty
+    int slot_count;          // A power of two, 0 before the first rehash
+} NameTable;
+
+void name_table_rehash(NameTable *table, int count, const char *(*key)(int));
+
+// The slot holding the index of name, or the empty slot it goes in
+int *name_table_slot(const NameTable *table, const char *name, const char *(*key)(int));
+
+// A page as CMD_LOAD names it: a file ending in .html
+int html_name(const char *name);
+
+// CLOCK_MONOTONIC in milliseconds and nanoseconds
+long long monotonic_ms();
+long long monotonic_ns();
+
+// Fixed-size message a tab writes to the browser's FIFO. Changing its
+// layout (e.g. adding known_generation) breaks the wire format for tabs
+// built before the change, including tabs kept across a hot restart.
 typedef struct {
     int tab_id;
     CommandType cmd_type;
@@ -35,8 +83,33 @@ typedef struct {
     int use_shared_memory;       // Flag to indicate if shared memory is used
     int shared_memory_id;        // ID of shared memory segment if used
     time_t timestamp;            // Timestamp of the command
+    unsigned int known_generation; // Generation of the target page the tab has cached, 0 if none
 } BrowserMessage;
 
+// Kinds of response sent on a tab's response FIFO
+typedef enum {
+    RESP_TEXT,          // Status or error text
+    RESP_PAGE,          // A rendered document for url at generation
+    RESP_NOT_MODIFIED,  // The tab's cached copy of url at generation is current
+    RESP_PATCH          // A diff.h patch turning the tab's copy of url into generation
+} ResponseKind;
+
+#define RESPONSE_MAGIC 0x42524f57  // "BROW"
+
+// Every response is a header, then url, back_url and forward_url (not
+// NUL-terminated), then body_length bytes of body. back_url and
+// forward_url are the tab's history neighbours, so it can tell which
+// cached document a later back/forward will show.
+typedef struct {
+    uint32_t magic;
+    uint16_t kind;
+    uint16_t url_length;
+    uint16_t back_length;
+    uint16_t forward_length;
+    uint32_t generation;         // Content version of the page (0 for text)
+    uint32_t body_length;
+} ResponseHeader;
+
 // Tab state
 typedef struct {
     int tab_id;
@@ -46,6 +119,8 @@ typedef struct {
     int history_position;
     time_t last_active;          // Last time this tab was active
     int is_synced;               // Whether this tab is synced with others
+    unsigned int known_generation; // From the navigation the tab is waiting for
+    int following;               // Tab whose pages this tab is shown, 0 if none
 } TabState;
 
 #endif
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "diff.h"
+#include "scan.h"
+
+typedef struct {
+    const char *start;
+    size_t length;               // Including the '\n', if any
+    uint32_t hash;
+} Line;
+
+typedef struct {
+    char *out;
+    size_t cap;
+    size_t length;
+    PatchOp op;                  // Most recent op, extended while the type repeats
+    size_t op_offset;            // Where it is stored in out
+    uint32_t op_count;
+    int overflow;
+} PatchWriter;
+
+// Split text into lines, hashing each so most comparisons are one word
+static Line *split_lines(const char *text, size_t length, int *count) {
+    // One line per newline, plus an unterminated last one
+    int n = scan_newlines(text, length, NULL, 0);
+    if (length > 0 && text[length - 1] != '\n') n++;
+
+    Line *lines = malloc((n ? n : 1) * sizeof(Line));
+    if (!lines) return NULL;
+
+    const char *p = text;
+    for (int i = 0; i < n; i++) {
+        const char *nl = memchr(p, '\n', text + length - p);
+        const char *end = nl ? nl + 1 : text + length;
+        lines[i].start = p;
+        lines[i].length = end - p;
+        lines[i].hash = hash_bytes(p, end - p);
+        p = end;
+    }
+    *count = n;
+    return lines;
+}
+
+static int same_line(const Line *a, const Line *b) {
+    return a->hash == b->hash && a->length == b->length &&
+           memcmp(a->start, b->start, a->length) == 0;
+}
+
+static void emit(PatchWriter *w, PatchOpType type, const Line *line) {
+    if (w->overflow) return;
+
+    if (w->op_count == 0 || w->op.type != type) {
+        if (w->length + sizeof(PatchOp) > w->cap) {
+            w->overflow = 1;
+            return;
+        }
+        w->op.type = type;
+        w->op.lines = 0;
+        w->op.bytes = 0;
+        w->op_offset = w->length;
+        w->length += sizeof(PatchOp);
+        w->op_count++;
+    }
+
+    w->op.lines++;
+    if (type == PATCH_INSERT) {
+        if (w->length + line->length > w->cap) {
+            w->overflow = 1;
+            return;
+        }
+        memcpy(w->out + w->length, line->start, line->length);
+        w->length += line->length;
+        w->op.bytes += line->length;
+    }
+    // Ops are unaligned in the patch, so they are only ever copied
+    memcpy(w->out + w->op_offset, &w->op, sizeof(PatchOp));
+}
+
+// Myers' O(ND) shortest edit script between a[0..n) and b[0..m), written
+// as patch ops. trace[d * d + d + k] holds the furthest x on diagonal k
+// after d edits, kept for every d so the path can be walked back.
+static int myers(const Line *a, int n, const Line *b, int m, PatchWriter *w) {
+    int max = n + m < DIFF_MAX_EDITS ? n + m : DIFF_MAX_EDITS;
+    int *trace = malloc((size_t)(max + 1) * (max + 1) * sizeof(int));
+    if (!trace) return -1;
+
+    int found = -1;
+    for (int d = 0; d <= max && found < 0; d++) {
+        int *v = trace + d * d + d;               // v[k] for k in [-d, d]
+        int *prev = trace + (d - 1) * (d - 1) + (d - 1);
+        for (int k = -d; k <= d; k += 2) {
+            int x;
+            if (d == 0) x = 0;
+            else if (k == -d || (k != d && prev[k - 1] < prev[k + 1])) x = prev[k + 1];
+            else x = prev[k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && same_line(&a[x], &b[y])) {
+                x++;
+                y++;
+            }
+            v[k] = x;
+            if (x >= n && y >= m) {
+                found = d;
+                break;
+            }
+        }
+    }
+    if (found < 0) {
+        free(trace);
+        return -1;
+    }
+
+    // Walk back from (n, m), recording where each edit happened and
+    // whether it moved down (insert b[y]) or right (delete a[x])
+    int *edit_x = malloc((found + 1) * sizeof(int));
+    char *edit_insert = malloc(found + 1);
+    if (!edit_x || !edit_insert) {
+        free(edit_x);
+        free(edit_insert);
+        free(trace);
+        return -1;
+    }
+    int x = n, y = m;
+    for (int d = found; d > 0; d--) {
+        int *prev = trace + (d - 1) * (d - 1) + (d - 1);
+        int k = x - y;
+        int down = k == -d || (k != d && prev[k - 1] < prev[k + 1]);
+        int prev_k = down ? k + 1 : k - 1;
+        x = prev[prev_k];
+        y = x - prev_k;
+        edit_x[d] = x;
+        edit_insert[d] = down;
+    }
+    free(trace);
+
+    // Replay forwards: a diagonal run of equal lines, then one edit
+    x = 0;
+    y = 0;
+    for (int d = 1; d <= found; d++) {
+        while (x < edit_x[d]) {
+            emit(w, PATCH_COPY, &a[x]);
+            x++;
+            y++;
+        }
+        if (edit_insert[d]) {
+            emit(w, PATCH_INSERT, &b[y]);
+            y++;
+        } else {
+            emit(w, PATCH_DELETE, &a[x]);
+            x++;
+        }
+    }
+    while (x < n) {
+        emit(w, PATCH_COPY, &a[x]);
+        x++;
+    }
+
+    free(edit_x);
+    free(edit_insert);
+    return 0;
+}
+
+size_t diff_lines(const char *old_text, size_t old_length, const char *new_text,
+                  size_t new_length, uint32_t base_generation, char *out, size_t cap) {
+    if (cap < sizeof(PatchHeader)) return 0;
+
+    int n, m;
+    Line *a = split_lines(old_text, old_length, &n);
+    Line *b = split_lines(new_text, new_length, &m);
+    if (!a || !b) {
+        free(a);
+        free(b);
+        return 0;
+    }
+
+    PatchWriter w = { .out = out, .cap = cap, .length = sizeof(PatchHeader) };
+
+    // Unchanged head and tail lines are cheap to find and common
+    int prefix = 0;
+    while (prefix < n && prefix < m && same_line(&a[prefix], &b[prefix])) prefix++;
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix &&
+           same_line(&a[n - 1 - suffix], &b[m - 1 - suffix])) suffix++;
+
+    for (int i = 0; i < prefix; i++) emit(&w, PATCH_COPY, &a[i]);
+    int result = myers(a + prefix, n - prefix - suffix, b + prefix, m - prefix - suffix, &w);
+    for (int i = n - suffix; i < n; i++) emit(&w, PATCH_COPY, &a[i]);
+
+    free(a);
+    free(b);
+    if (result < 0 || w.overflow) return 0;
+
+    PatchHeader header = { base_generation, w.op_count };
+    memcpy(out, &header, sizeof(header));
+    return w.length;
+}
+
+// Length of the next `lines` lines of text starting at offset, or -1
+static long skip_lines(const char *text, size_t length, size_t offset, uint32_t lines) {
+    size_t p = offset;
+    for (uint32_t i = 0; i < lines; i++) {
+        if (p >= length) return -1;
+        const char *nl = memchr(text + p, '\n', length - p);
+        p = nl ? (size_t)(nl - text) + 1 : length;
+    }
+    return p - offset;
+}
+
+char *patch_apply(const char *base, size_t base_length, const char *patch, size_t patch_length,
+                  size_t *length, int *first_changed, int *last_changed) {
+    PatchHeader header;
+    if (patch_length < sizeof(header)) return NULL;
+    memcpy(&header, patch, sizeof(header));
+
+    // First pass: validate and size the result
+    size_t total = 0;
+    size_t base_pos = 0;
+    size_t pos = sizeof(header);
+    for (uint32_t i = 0; i < header.op_count; i++) {
+        PatchOp op;
+        if (patch_length - pos < sizeof(op)) return NULL;
+        memcpy(&op, patch + pos, sizeof(op));
+        pos += sizeof(op);
+        if (op.type == PATCH_INSERT) {
+            if (patch_length - pos < op.bytes) return NULL;
+            pos += op.bytes;
+            total += op.bytes;
+        } else {
+            long n = skip_lines(base, base_length, base_pos, op.lines);
+            if (n < 0) return NULL;
+            base_pos += n;
+            if (op.type == PATCH_COPY) total += n;
+        }
+    }
+    if (base_pos != base_length) return NULL;
+
+    char *text = malloc(total + 1);
+    if (!text) return NULL;
+
+    int line = 0;
+    int first = -1, last = -1;
+    int old_lines = 0;
+    size_t out = 0;
+    base_pos = 0;
+    pos = sizeof(header);
+    for (uint32_t i = 0; i < header.op_count; i++) {
+        PatchOp op;
+        memcpy(&op, patch + pos, sizeof(op));
+        pos += sizeof(op);
+        if (op.type == PATCH_COPY) {
+            long n = skip_lines(base, base_length, base_pos, op.lines);
+            memcpy(text + out, base + base_pos, n);
+            out += n;
+            base_pos += n;
+            line += op.lines;
+            old_lines += op.lines;
+            continue;
+        }
+
+        if (first < 0) first = line;
+        if (op.type == PATCH_INSERT) {
+            memcpy(text + out, patch + pos, op.bytes);
+            out += op.bytes;
+            pos += op.bytes;
+            line += op.lines;
+            last = line - 1;
+        } else {
+            base_pos += skip_lines(base, base_length, base_pos, op.lines);
+            old_lines += op.lines;
+            if (last < line) last = line;
+        }
+    }
+    text[out] = '\0';
+
+    // Lines were added or removed: everything after the first change moved
+    if (old_lines != line && first >= 0) last = line;
+
+    if (first_changed) *first_changed = first < 0 ? 0 : first;
+    if (last_changed) *last_changed = last;
+    *length = out;
+    return text;
+}
@@ -0,0 +1,50 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Line-level document patches.
+// The browser diffs the page it last sent a tab against the new render
+// and sends the patch (RESP_PATCH) instead of the page when it is
+// smaller; the tab applies it to its copy. A line is everything up to
+// and including a '\n', so the last line may have no newline.
+//
+// A patch is a PatchHeader followed by op_count PatchOps. Only
+// PATCH_INSERT ops are followed by data: the `bytes` bytes of the
+// `lines` inserted lines.
+
+#define DIFF_MAX_EDITS 512       // Larger changes are sent as whole pages
+
+typedef enum {
+    PATCH_COPY,                  // Keep the next `lines` lines of the base
+    PATCH_DELETE,                // Skip the next `lines` lines of the base
+    PATCH_INSERT                 // Insert `lines` lines from the patch
+} PatchOpType;
+
+typedef struct {
+    uint32_t base_generation;    // Generation the patch applies to
+    uint32_t op_count;
+} PatchHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t lines;
+    uint32_t bytes;              // Data following a PATCH_INSERT
+} PatchOp;
+
+// Write a patch turning old_text into new_text into out. Returns its
+// length, or 0 if it would not fit in cap or needs more than
+// DIFF_MAX_EDITS line insertions and deletions.
+size_t diff_lines(const char *old_text, size_t old_length, const char *new_text,
+                  size_t new_length, uint32_t base_generation, char *out, size_t cap);
+
+// Apply a patch to base. Returns the new text (malloc'd, with a NUL
+// after *length bytes) or NULL if the patch does not fit the base.
+// If first_changed/last_changed are given they receive the range of
+// lines of the new text that changed or moved, i.e. to the end of the
+// text if lines were added or removed.
+char *patch_apply(const char *base, size_t base_length, const char *patch, size_t patch_length,
+                  size_t *length, int *first_changed, int *last_changed);
+
+#endif
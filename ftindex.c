@@ -0,0 +1,802 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "ftindex.h"
+#include "log.h"
+#include "catalog.h"
+
+#define BM25_K1 1.2
+#define BM25_B 0.75
+#define COMPACT_MIN_TOKENS 65536         // Dead postings tolerated before compacting
+#define SNIPPET_BEFORE 30                // Bytes shown before the match
+#define SNIPPET_LENGTH 90
+
+typedef struct {
+    char *name;
+    int doc;                             // Current version, -1 if none
+    off_t size;                          // Of the version indexed or attempted, -1 if none
+    struct timespec mtime;
+    int queued;
+    int crawling;                        // Handed out by ftindex_next_crawl()
+    long long crawl_started;
+    int seen;                            // Found by the running scan
+} File;
+
+typedef struct {
+    int file;
+    char *text;                          // NULL once superseded
+    size_t length;
+    int tokens;
+} Doc;
+
+typedef struct {
+    char *token;
+    unsigned char *postings;
+    size_t size;
+    size_t capacity;
+    int doc_count;
+    int last_doc;                        // -1 before the first posting
+} Term;
+
+// A token of a page being indexed, grouped by term before encoding
+typedef struct {
+    int term;
+    uint32_t offset;
+} Occurrence;
+
+static char *index_path = NULL;
+static int dirty = 0;
+static long long next_scan_ms = 0;
+
+static File *files = NULL;
+static int file_count = 0, file_capacity = 0;
+static NameTable file_table;
+
+static Doc *docs = NULL;
+static int doc_count = 0, doc_capacity = 0;
+static int live_docs = 0;
+static long live_tokens = 0, dead_tokens = 0;
+static size_t text_bytes = 0, postings_bytes = 0;
+
+static Term *terms = NULL;
+static int term_count = 0, term_capacity = 0;
+static NameTable term_table;
+
+static int *crawl_queue = NULL;
+static int crawl_head = 0, crawl_tail = 0, crawl_capacity = 0;
+
+static FtIndexStats totals;
+
+static void *grow(void *array, int *capacity, int needed, size_t item) {
+    if (needed <= *capacity) return array;
+    int new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *grown = realloc(array, new_capacity * item);
+    if (!grown) {
+        perror("realloc");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+// Tables of indices into files[] and terms[]; rebuilt whenever they grow
+// or the arrays are renumbered
+static const char *file_key(int i) { return files[i].name; }
+static const char *term_key(int i) { return terms[i].token; }
+
+static int find_file(const char *name, int create) {
+    if ((file_count + 1) * 2 > file_table.slot_count) name_table_rehash(&file_table, file_count, file_key);
+    int *slot = name_table_slot(&file_table, name, file_key);
+    if (*slot >= 0) return *slot;
+    if (!create) return -1;
+
+    files = grow(files, &file_capacity, file_count + 1, sizeof(File));
+    File *f = &files[file_count];
+    memset(f, 0, sizeof(*f));
+    f->name = strdup(name);
+    f->doc = -1;
+    f->size = -1;
+    *slot = file_count;
+    return file_count++;
+}
+
+static int find_term(const char *token, int create) {
+    if ((term_count + 1) * 2 > term_table.slot_count) name_table_rehash(&term_table, term_count, term_key);
+    int *slot = name_table_slot(&term_table, token, term_key);
+    if (*slot >= 0) return *slot;
+    if (!create) return -1;
+
+    terms = grow(terms, &term_capacity, term_count + 1, sizeof(Term));
+    Term *t = &terms[term_count];
+    memset(t, 0, sizeof(*t));
+    t->token = strdup(token);
+    t->last_doc = -1;
+    *slot = term_count;
+    return term_count++;
+}
+
+static size_t put_varint(unsigned char *p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+// NULL if the value runs past end
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint32_t *v) {
+    uint32_t value = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        unsigned char byte = *p++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = value;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void append_bytes(Term *t, const unsigned char *bytes, size_t length) {
+    if (t->size + length > t->capacity) {
+        size_t capacity = t->capacity ? t->capacity * 2 : 16;
+        while (capacity < t->size + length) capacity *= 2;
+        t->postings = realloc(t->postings, capacity);
+        if (!t->postings) {
+            perror("realloc");
+            exit(1);
+        }
+        t->capacity = capacity;
+    }
+    memcpy(t->postings + t->size, bytes, length);
+    t->size += length;
+    postings_bytes += length;
+}
+
+// Lowercase ASCII letters and digits; bytes of UTF-8 sequences are kept
+// as they are, so accented words are tokens too
+static int token_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+static int next_token(const char *text, size_t length, size_t *at, char *token, uint32_t *offset) {
+    size_t i = *at;
+    while (i < length) {
+        while (i < length && !token_char(text[i])) i++;
+        size_t start = i;
+        int n = 0;
+        for (; i < length && token_char(text[i]); i++) {
+            char c = text[i];
+            if (n < FTINDEX_TOKEN_MAX) token[n++] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+        }
+        if (n >= FTINDEX_TOKEN_MIN) {
+            token[n] = '\0';
+            *offset = (uint32_t)start;
+            *at = i;
+            return 1;
+        }
+    }
+    *at = i;
+    return 0;
+}
+
+static int doc_live(int d) {
+    return d >= 0 && d < doc_count && files[docs[d].file].doc == d;
+}
+
+// The file's indexed version is gone; its postings stay until compaction
+static void retire(File *f) {
+    if (f->doc < 0) return;
+    Doc *d = &docs[f->doc];
+    live_docs--;
+    live_tokens -= d->tokens;
+    dead_tokens += d->tokens;
+    text_bytes -= d->length;
+    free(d->text);
+    d->text = NULL;
+    f->doc = -1;
+    dirty = 1;
+}
+
+static int compare_occurrences(const void *a, const void *b) {
+    const Occurrence *x = a, *y = b;
+    if (x->term != y->term) return x->term < y->term ? -1 : 1;
+    return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static void index_text(int file, const char *text, size_t length) {
+    retire(&files[file]);
+
+    docs = grow(docs, &doc_capacity, doc_count + 1, sizeof(Doc));
+    int id = doc_count++;
+    Doc *d = &docs[id];
+    d->file = file;
+    d->text = malloc(length + 1);
+    memcpy(d->text, text, length);
+    d->text[length] = '\0';
+    d->length = length;
+
+    Occurrence *found = NULL;
+    int count = 0, capacity = 0;
+    char token[FTINDEX_TOKEN_MAX + 1];
+    uint32_t offset;
+    size_t at = 0;
+    while (next_token(text, length, &at, token, &offset)) {
+        found = grow(found, &capacity, count + 1, sizeof(Occurrence));
+        found[count].term = find_term(token, 1);
+        found[count].offset = offset;
+        count++;
+    }
+    qsort(found, count, sizeof(Occurrence), compare_occurrences);
+
+    // One posting per term: page delta, count, offset deltas
+    unsigned char buffer[64];
+    for (int i = 0; i < count; ) {
+        int j = i;
+        while (j < count && found[j].term == found[i].term) j++;
+        Term *t = &terms[found[i].term];
+        size_t n = put_varint(buffer, id - t->last_doc);
+        n += put_varint(buffer + n, j - i);
+        append_bytes(t, buffer, n);
+        uint32_t previous = 0;
+        for (int k = i; k < j; k++) {
+            n = put_varint(buffer, found[k].offset - previous);
+            append_bytes(t, buffer, n);
+            previous = found[k].offset;
+        }
+        t->last_doc = id;
+        t->doc_count++;
+        i = j;
+    }
+    free(found);
+
+    d->tokens = count;
+    files[file].doc = id;
+    live_docs++;
+    live_tokens += count;
+    text_bytes += length;
+    totals.indexed++;
+    dirty = 1;
+}
+
+// Renumber the current versions densely and drop every superseded
+// posting (and the terms left without any)
+static void compact() {
+    int *remap = malloc((doc_count + 1) * sizeof(int));
+    int kept = 0;
+    for (int d = 0; d < doc_count; d++) {
+        if (doc_live(d)) {
+            remap[d] = kept;
+            docs[kept] = docs[d];
+            files[docs[kept].file].doc = kept;
+            kept++;
+        } else {
+            remap[d] = -1;
+        }
+    }
+
+    postings_bytes = 0;
+    int terms_kept = 0;
+    for (int i = 0; i < term_count; i++) {
+        Term old = terms[i];
+        Term *t = &terms[terms_kept];
+        *t = old;
+        t->postings = NULL;
+        t->size = t->capacity = 0;
+        t->doc_count = 0;
+        t->last_doc = -1;
+
+        const unsigned char *p = old.postings, *end = old.postings + old.size;
+        int doc = -1;
+        uint32_t delta, count;
+        unsigned char buffer[16];
+        while (p < end && (p = get_varint(p, end, &delta)) && (p = get_varint(p, end, &count))) {
+            doc += delta;
+            const unsigned char *positions = p;
+            for (uint32_t k = 0; k < count && p; k++) p = get_varint(p, end, &delta);
+            if (!p || doc >= doc_count) break;
+            if (remap[doc] < 0) continue;
+
+            size_t n = put_varint(buffer, remap[doc] - t->last_doc);
+            n += put_varint(buffer + n, count);
+            append_bytes(t, buffer, n);
+            append_bytes(t, positions, p - positions);
+            t->last_doc = remap[doc];
+            t->doc_count++;
+        }
+        free(old.postings);
+        if (t->doc_count > 0) {
+            terms_kept++;
+        } else {
+            free(t->token);
+        }
+    }
+
+    free(remap);
+    doc_count = kept;
+    term_count = terms_kept;
+    dead_tokens = 0;
+    name_table_rehash(&term_table, term_count, term_key);
+    totals.compactions++;
+    dirty = 1;
+}
+
+static void maybe_compact() {
+    if (dead_tokens > COMPACT_MIN_TOKENS && dead_tokens > live_tokens) compact();
+}
+
+static int up_to_date(const File *f, off_t size, const struct timespec *mtime) {
+    return f->size == size && f->mtime.tv_sec == mtime->tv_sec && f->mtime.tv_nsec == mtime->tv_nsec;
+}
+
+static void queue_crawl(int file) {
+    File *f = &files[file];
+    if (f->queued || f->crawling) return;
+    int pending = crawl_tail - crawl_head;
+    if (crawl_head > 0 && crawl_tail == crawl_capacity) {
+        memmove(crawl_queue, crawl_queue + crawl_head, pending * sizeof(int));
+        crawl_head = 0;
+        crawl_tail = pending;
+    }
+    crawl_queue = grow(crawl_queue, &crawl_capacity, crawl_tail + 1, sizeof(int));
+    crawl_queue[crawl_tail++] = file;
+    f->queued = 1;
+}
+
+static void clear() {
+    for (int i = 0; i < file_count; i++) free(files[i].name);
+    for (int d = 0; d < doc_count; d++) free(docs[d].text);
+    for (int i = 0; i < term_count; i++) {
+        free(terms[i].token);
+        free(terms[i].postings);
+    }
+    free(files);
+    free(file_table.slots);
+    free(docs);
+    free(terms);
+    free(term_table.slots);
+    free(crawl_queue);
+    files = NULL;
+    file_table.slots = NULL;
+    docs = NULL;
+    terms = NULL;
+    term_table.slots = NULL;
+    crawl_queue = NULL;
+    file_count = file_capacity = file_table.slot_count = 0;
+    doc_count = doc_capacity = live_docs = 0;
+    term_count = term_capacity = term_table.slot_count = 0;
+    crawl_head = crawl_tail = crawl_capacity = 0;
+    live_tokens = dead_tokens = 0;
+    text_bytes = postings_bytes = 0;
+}
+
+static void load(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(FtFileHeader)) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    const unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+
+    const FtFileHeader *header = (const FtFileHeader *)map;
+    size_t docs_at = sizeof(FtFileHeader);
+    size_t terms_at = docs_at + (size_t)header->doc_count * sizeof(FtFileDoc);
+    size_t postings_at = terms_at + (size_t)header->term_count * sizeof(FtFileTerm);
+    size_t strings_at = postings_at + header->postings_size;
+    if (header->magic != FTINDEX_MAGIC || header->version != FTINDEX_VERSION ||
+        header->doc_count > size / sizeof(FtFileDoc) || header->term_count > size / sizeof(FtFileTerm) ||
+        header->postings_size > size || header->strings_size > size ||
+        strings_at + header->strings_size != size || (size > 0 && map[size - 1] != '\0')) {
+        log_warn("[Search] Ignoring %s: not an index of this version", path);
+        munmap((void *)map, size);
+        return;
+    }
+    const FtFileDoc *file_docs = (const FtFileDoc *)(map + docs_at);
+    const FtFileTerm *file_terms = (const FtFileTerm *)(map + terms_at);
+    const char *strings = (const char *)(map + strings_at);
+
+    int damaged = 0;
+    for (uint32_t i = 0; i < header->doc_count && !damaged; i++) {
+        const FtFileDoc *fd = &file_docs[i];
+        if (fd->name >= header->strings_size || fd->text + fd->length >= header->strings_size) {
+            damaged = 1;
+            break;
+        }
+        int file = find_file(strings + fd->name, 1);
+        docs = grow(docs, &doc_capacity, doc_count + 1, sizeof(Doc));
+        Doc *d = &docs[doc_count];
+        d->file = file;
+        d->length = fd->length;
+        d->text = malloc(d->length + 1);
+        memcpy(d->text, strings + fd->text, d->length + 1);
+        d->tokens = fd->tokens;
+        files[file].doc = doc_count++;
+        files[file].size = fd->file_size;
+        files[file].mtime.tv_sec = fd->mtime_sec;
+        files[file].mtime.tv_nsec = fd->mtime_nsec;
+        live_docs++;
+        live_tokens += d->tokens;
+        text_bytes += d->length;
+    }
+
+    // Posting lists are copied as they are, in the same encoding
+    for (uint32_t i = 0; i < header->term_count && !damaged; i++) {
+        const FtFileTerm *ft = &file_terms[i];
+        if (ft->token >= header->strings_size || ft->postings + ft->size > header->postings_size) {
+            damaged = 1;
+            break;
+        }
+        int term = find_term(strings + ft->token, 1);
+        Term *t = &terms[term];
+        append_bytes(t, map + postings_at + ft->postings, ft->size);
+        t->doc_count = ft->doc_count;
+
+        // Pages are delta-coded from the last one in the list, which the
+        // next page indexed continues from
+        const unsigned char *p = t->postings, *end = t->postings + t->size;
+        uint32_t delta, count;
+        while (p < end && (p = get_varint(p, end, &delta)) && (p = get_varint(p, end, &count))) {
+            t->last_doc += delta;
+            for (uint32_t k = 0; k < count && p; k++) p = get_varint(p, end, &delta);
+            if (!p) break;
+        }
+        if (p != end || t->last_doc >= doc_count) damaged = 1;
+    }
+    munmap((void *)map, size);
+
+    // Offsets and sizes are checked here, postings as they are decoded
+    if (damaged) {
+        log_warn("[Search] %s is damaged, rebuilding the index", path);
+        clear();
+        return;
+    }
+    log_info("[Search] Loaded %d pages and %d terms from %s", live_docs, term_count, path);
+}
+
+void ftindex_open(const char *path) {
+    free(index_path);
+    index_path = strdup(path);
+    load(path);
+    dirty = 0;
+    next_scan_ms = 0;
+}
+
+static int compare_terms(const void *a, const void *b) {
+    return strcmp(terms[*(const int *)a].token, terms[*(const int *)b].token);
+}
+
+int ftindex_save() {
+    if (!index_path || !dirty) return 0;
+    if (doc_count > live_docs) compact();
+
+    int *order = malloc((term_count + 1) * sizeof(int));
+    for (int i = 0; i < term_count; i++) order[i] = i;
+    qsort(order, term_count, sizeof(int), compare_terms);
+
+    FtFileHeader header = {
+        .magic = FTINDEX_MAGIC,
+        .version = FTINDEX_VERSION,
+        .doc_count = doc_count,
+        .term_count = term_count,
+        .postings_size = postings_bytes,
+        .saved = time(NULL)
+    };
+    size_t strings = 0;
+    for (int d = 0; d < doc_count; d++) {
+        strings += strlen(files[docs[d].file].name) + 1 + docs[d].length + 1;
+    }
+    for (int i = 0; i < term_count; i++) strings += strlen(terms[i].token) + 1;
+    header.strings_size = strings;
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", index_path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        perror("fopen");
+        free(order);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+
+    uint64_t at = 0;
+    for (int d = 0; d < doc_count; d++) {
+        const File *f = &files[docs[d].file];
+        FtFileDoc fd = {
+            .name = at,
+            .text = at + strlen(f->name) + 1,
+            .length = docs[d].length,
+            .tokens = docs[d].tokens,
+            .file_size = f->size,
+            .mtime_sec = f->mtime.tv_sec,
+            .mtime_nsec = f->mtime.tv_nsec
+        };
+        at = fd.text + fd.length + 1;
+        fwrite(&fd, sizeof(fd), 1, fp);
+    }
+    uint64_t postings = 0;
+    for (int i = 0; i < term_count; i++) {
+        const Term *t = &terms[order[i]];
+        FtFileTerm ft = { at, postings, t->size, t->doc_count };
+        at += strlen(t->token) + 1;
+        postings += t->size;
+        fwrite(&ft, sizeof(ft), 1, fp);
+    }
+    for (int i = 0; i < term_count; i++) {
+        fwrite(terms[order[i]].postings, 1, terms[order[i]].size, fp);
+    }
+    for (int d = 0; d < doc_count; d++) {
+        const char *name = files[docs[d].file].name;
+        fwrite(name, 1, strlen(name) + 1, fp);
+        fwrite(docs[d].text, 1, docs[d].length + 1, fp);
+    }
+    for (int i = 0; i < term_count; i++) {
+        fwrite(terms[order[i]].token, 1, strlen(terms[order[i]].token) + 1, fp);
+    }
+    free(order);
+
+    if (fclose(fp) != 0 || rename(tmp, index_path) < 0) {
+        perror("save search index");
+        unlink(tmp);
+        return -1;
+    }
+    dirty = 0;
+    return 0;
+}
+
+void ftindex_close() {
+    ftindex_save();
+    clear();
+    free(index_path);
+    index_path = NULL;
+}
+
+int ftindex_rendered(const char *html_file, const char *text, size_t length, int ok) {
+    int file = find_file(html_file, 1);
+    File *f = &files[file];
+    int crawl = f->crawling;
+    f->crawling = 0;
+
+    off_t size;
+    struct timespec mtime;
+    if (catalog_stat(html_file, &size, &mtime) < 0) return crawl;
+    if (!ok) {
+        // Not tried again until the page changes
+        if (crawl) {
+            retire(f);
+            f->size = size;
+            f->mtime = mtime;
+        }
+        return crawl;
+    }
+    if (f->doc >= 0 && up_to_date(f, size, &mtime)) return crawl;
+
+    index_text(file, text, length);
+    f = &files[file];
+    f->size = size;
+    f->mtime = mtime;
+    maybe_compact();
+    return crawl;
+}
+
+static void seen_page(const char *name, off_t size, const struct timespec *mtime) {
+    int file = find_file(name, 1);
+    files[file].seen = 1;
+    if (!up_to_date(&files[file], size, mtime)) queue_crawl(file);
+}
+
+void ftindex_scan() {
+    long long now = monotonic_ms();
+    if (!index_path || now < next_scan_ms) return;
+    next_scan_ms = now + FTINDEX_SCAN_MS;
+
+    for (int i = 0; i < file_count; i++) {
+        files[i].seen = 0;
+        if (files[i].crawling && now - files[i].crawl_started > FTINDEX_SCAN_MS) files[i].crawling = 0;
+    }
+
+    // Pages are the HTML files in the working directory, as CMD_LOAD names
+    // them. The catalog already knows them; without it, list the directory.
+    if (catalog_active()) {
+        for (int i = 0; i < catalog_count(); i++) {
+            const CatalogPage *p = catalog_at(i);
+            if (p->present) seen_page(p->name, p->size, &p->mtime);
+        }
+    } else {
+        DIR *dir = opendir(".");
+        if (!dir) {
+            perror("opendir");
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            struct stat st;
+            if (!html_name(entry->d_name) || stat(entry->d_name, &st) < 0 || !S_ISREG(st.st_mode)) continue;
+            seen_page(entry->d_name, st.st_size, &st.st_mtim);
+        }
+        closedir(dir);
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        if (!files[i].seen && files[i].doc >= 0) {
+            retire(&files[i]);
+            files[i].size = -1;
+        }
+    }
+    maybe_compact();
+
+    // Written once the pages found changed are indexed
+    if (crawl_head == crawl_tail) ftindex_save();
+}
+
+int ftindex_next_timeout() {
+    if (!index_path) return -1;
+    long long left = next_scan_ms - monotonic_ms();
+    return left < 0 ? 0 : (int)left;
+}
+
+int ftindex_next_crawl(char *html_file, size_t size) {
+    while (crawl_head < crawl_tail) {
+        File *f = &files[crawl_queue[crawl_head++]];
+        f->queued = 0;
+
+        // Rendered for a tab meanwhile, or gone
+        off_t size;
+        struct timespec mtime;
+        if (catalog_stat(f->name, &size, &mtime) < 0 || up_to_date(f, size, &mtime)) continue;
+
+        f->crawling = 1;
+        f->crawl_started = monotonic_ms();
+        snprintf(html_file, size, "%s", f->name);
+        return 1;
+    }
+    crawl_head = crawl_tail = 0;
+    return 0;
+}
+
+// Up to SNIPPET_LENGTH bytes of the page from shortly before offset, on
+// one line
+static void snippet(const Doc *d, uint32_t offset, char *out, size_t size) {
+    size_t start = offset > SNIPPET_BEFORE ? offset - SNIPPET_BEFORE : 0;
+    while (start > 0 && start < offset && d->text[start - 1] != ' ' && d->text[start - 1] != '\n') start++;
+    size_t end = start + SNIPPET_LENGTH < d->length ? start + SNIPPET_LENGTH : d->length;
+
+    size_t n = 0;
+    if (start > 0 && n + 3 < size) n += snprintf(out + n, size - n, "...");
+    int space = 1;
+    for (size_t i = start; i < end && n + 4 < size; i++) {
+        char c = d->text[i];
+        if (c == '\n' || c == '\t' || c == '\r' || c == ' ') {
+            if (!space) out[n++] = ' ';
+            space = 1;
+        } else {
+            out[n++] = c;
+            space = 0;
+        }
+    }
+    if (end < d->length && n + 3 < size) n += snprintf(out + n, size - n, "...");
+    out[n] = '\0';
+}
+
+static int by_doc_count(const void *a, const void *b) {
+    return terms[*(const int *)a].doc_count - terms[*(const int *)b].doc_count;
+}
+
+void ftindex_search(const char *query, char *out, size_t size) {
+    long long started = monotonic_ns();
+    totals.queries++;
+
+    // Terms of the query, rarest first; a term no page has matches nothing
+    int query_terms[FTINDEX_QUERY_TERMS];
+    int nterms = 0, missing = 0;
+    char token[FTINDEX_TOKEN_MAX + 1];
+    uint32_t offset;
+    size_t at = 0;
+    while (next_token(query, strlen(query), &at, token, &offset) && nterms < FTINDEX_QUERY_TERMS) {
+        int t = find_term(token, 0);
+        if (t < 0) {
+            missing = 1;
+            continue;
+        }
+        int duplicate = 0;
+        for (int i = 0; i < nterms; i++) duplicate |= query_terms[i] == t;
+        if (!duplicate) query_terms[nterms++] = t;
+    }
+    if (nterms == 0 && !missing) {
+        snprintf(out, size, "[Browser] Usage: find <terms>");
+        return;
+    }
+    qsort(query_terms, nterms, sizeof(int), by_doc_count);
+
+    // BM25, accumulated only for pages that have every term so far
+    double *score = calloc(doc_count + 1, sizeof(double));
+    unsigned char *matched = calloc(doc_count + 1, 1);
+    uint32_t *first = calloc(doc_count + 1, sizeof(uint32_t));
+    double average = live_docs > 0 ? (double)live_tokens / live_docs : 1.0;
+    for (int k = 0; k < nterms && !missing; k++) {
+        const Term *t = &terms[query_terms[k]];
+        int df = t->doc_count < live_docs ? t->doc_count : live_docs;
+        double idf = log(1.0 + (live_docs - df + 0.5) / (df + 0.5));
+
+        const unsigned char *p = t->postings, *end = t->postings + t->size;
+        int doc = -1;
+        uint32_t delta, count, position;
+        while (p < end && (p = get_varint(p, end, &delta)) && (p = get_varint(p, end, &count))) {
+            doc += delta;
+            const unsigned char *positions = p;
+            for (uint32_t i = 0; i < count && p; i++) p = get_varint(p, end, &position);
+            if (!p || doc >= doc_count) break;
+            if (matched[doc] != k || !doc_live(doc)) continue;
+
+            double length_norm = 1.0 - BM25_B + BM25_B * docs[doc].tokens / average;
+            score[doc] += idf * count * (BM25_K1 + 1.0) / (count + BM25_K1 * length_norm);
+            if (k == 0) get_varint(positions, end, &first[doc]);
+            matched[doc]++;
+        }
+    }
+
+    // The best few, in order
+    int best[FTINDEX_RESULTS];
+    int found = 0, total = 0;
+    for (int d = 0; d < doc_count && !missing && nterms > 0; d++) {
+        if (matched[d] != nterms) continue;
+        total++;
+        int i = found < FTINDEX_RESULTS ? found++ : FTINDEX_RESULTS;
+        if (i == FTINDEX_RESULTS && score[d] <= score[best[FTINDEX_RESULTS - 1]]) continue;
+        if (i == FTINDEX_RESULTS) i--;
+        while (i > 0 && score[best[i - 1]] < score[d]) {
+            best[i] = best[i - 1];
+            i--;
+        }
+        best[i] = d;
+    }
+
+    double ms = (monotonic_ns() - started) / 1e6;
+    size_t n;
+    if (total == 0) {
+        n = snprintf(out, size, "[Browser] No page matches \"%s\" (%d pages indexed, %.2f ms)",
+                     query, live_docs, ms);
+    } else {
+        n = snprintf(out, size, "[Browser] %d page%s match \"%s\" (%.2f ms):\n",
+                     total, total == 1 ? "" : "s", query, ms);
+    }
+    for (int i = 0; i < found && n < size; i++) {
+        const Doc *d = &docs[best[i]];
+        const char *name = files[d->file].name;
+        char text[SNIPPET_LENGTH + 16];
+        snippet(d, first[best[i]], text, sizeof(text));
+        n += snprintf(out + n, size - n, "%2d. %.*s  %.2f\n    %s\n", i + 1,
+                      (int)(strlen(name) - 5), name, score[best[i]], text);
+    }
+
+    free(score);
+    free(matched);
+    free(first);
+}
+
+void ftindex_stats(FtIndexStats *stats) {
+    *stats = totals;
+    stats->docs = live_docs;
+    stats->terms = term_count;
+    stats->postings_bytes = postings_bytes;
+    stats->text_bytes = text_bytes;
+    stats->queued = crawl_tail - crawl_head;
+}
@@ -0,0 +1,105 @@
+#ifndef FTINDEX_H
+#define FTINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Full-text search over local pages.
+// An inverted index from each token of the rendered text to the pages it
+// appears in, with the byte offsets where it does. Every render that
+// completes updates it, and a directory scan queues the local pages that
+// are new or have changed on disk since they were indexed, which idle
+// renderers then render for the index alone (see start_prefetches()).
+// The find command ranks the pages that contain every term (BM25) and
+// shows a snippet around the first match.
+//
+// Pages get increasing numbers, so a posting list only ever grows at
+// its end: a changed page is added again under a new number and its old
+// postings are skipped until enough of them pile up to compact the
+// index. Posting lists are varint-encoded: page delta, occurrence
+// count, then offset deltas.
+//
+// The file is the same encoding laid out flat, and is loaded by mapping
+// it and copying each list as it is: header, FtFileDoc[doc_count],
+// FtFileTerm[term_count] sorted by token, the posting bytes, then the
+// strings (page names, texts and tokens, NUL-terminated).
+
+#define FTINDEX_MAGIC 0x58495446         // "FTIX"
+#define FTINDEX_VERSION 1
+#define FTINDEX_DEFAULT_PATH "browser_search.idx"
+#define FTINDEX_SCAN_MS 10000            // Between scans for changed pages
+#define FTINDEX_TOKEN_MIN 2
+#define FTINDEX_TOKEN_MAX 32             // Longer tokens are cut
+#define FTINDEX_RESULTS 10
+#define FTINDEX_QUERY_TERMS 8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint64_t postings_size;
+    uint64_t strings_size;
+    int64_t saved;
+} FtFileHeader;
+
+typedef struct {
+    uint64_t name;                       // Offsets into the strings
+    uint64_t text;
+    uint32_t length;
+    uint32_t tokens;
+    int64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} FtFileDoc;
+
+typedef struct {
+    uint64_t token;                      // Offset into the strings
+    uint64_t postings;                   // Offset into the posting bytes
+    uint32_t size;
+    uint32_t doc_count;
+} FtFileTerm;
+
+typedef struct {
+    int docs;                            // Indexed pages, current versions only
+    int terms;
+    size_t postings_bytes;
+    size_t text_bytes;
+    int queued;                          // Waiting to be rendered for the index
+    unsigned long indexed;
+    unsigned long compactions;
+    unsigned long queries;
+} FtIndexStats;
+
+// Load the index saved at path, if there is a usable one, and remember
+// path for ftindex_save(). Pages are checked against the disk by the
+// first scan, which is due at once.
+void ftindex_open(const char *path);
+
+// Write the index (if it changed) next to path and rename it into place
+int ftindex_save();
+
+void ftindex_close();
+
+// A render of html_file finished (text is only valid if ok). Indexes the
+// page unless it is indexed as it is on disk now. Returns 1 if the render
+// was one the index asked for, so the page does not need to be cached.
+int ftindex_rendered(const char *html_file, const char *text, size_t length, int ok);
+
+// Queue new and changed pages and forget deleted ones, when a scan is due
+void ftindex_scan();
+
+// Milliseconds until the next scan
+int ftindex_next_timeout();
+
+// Next page to render for the index. Returns 0 if none is queued. A
+// render that never reports back (preempted) is retried after a scan.
+int ftindex_next_crawl(char *html_file, size_t size);
+
+// Answer "find <terms>": the best FTINDEX_RESULTS pages containing every
+// term, with snippets, written to out
+void ftindex_search(const char *query, char *out, size_t size);
+
+void ftindex_stats(FtIndexStats *stats);
+
+#endif
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "html2text.h"
+#include "scan.h"
+
+#define CANCEL_CHECK_INTERVAL 4096
+
+typedef struct {
+    char *out;
+    size_t length;
+    size_t capacity;             // Usable bytes, excluding the terminating NUL
+    int truncated;
+    int pending_space;           // Collapsed whitespace not written yet
+    int trailing_newlines;
+    int pre_depth;
+} TextWriter;
+
+static void put(TextWriter *w, char c) {
+    if (w->length < w->capacity) {
+        w->out[w->length++] = c;
+    } else {
+        w->truncated = 1;
+    }
+}
+
+static void put_string(TextWriter *w, const char *s) {
+    while (*s) put(w, *s++);
+}
+
+static void put_bytes(TextWriter *w, const char *s, size_t n) {
+    size_t room = w->capacity - w->length;
+    if (n > room) {
+        n = room;
+        w->truncated = 1;
+    }
+    memcpy(w->out + w->length, s, n);
+    w->length += n;
+}
+
+// Regular text: collapses runs of whitespace unless inside <pre>
+static void put_text(TextWriter *w, char c) {
+    if (w->pre_depth > 0) {
+        put(w, c);
+        w->trailing_newlines = (c == '\n') ? w->trailing_newlines + 1 : 0;
+        return;
+    }
+
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f') {
+        w->pending_space = 1;
+        return;
+    }
+
+    if (w->pending_space && w->length > 0 && w->trailing_newlines == 0) {
+        put(w, ' ');
+    }
+    w->pending_space = 0;
+    put(w, c);
+    w->trailing_newlines = 0;
+}
+
+// A run of text up to the next tag or entity, as scan_text() or (inside
+// <pre>) scan_special() found it; the same as put_text() for each byte
+static void put_run(TextWriter *w, const char *s, size_t n) {
+    if (w->pre_depth > 0) {
+        size_t newlines = 0;
+        while (newlines < n && s[n - 1 - newlines] == '\n') newlines++;
+        w->trailing_newlines = (newlines == n) ? w->trailing_newlines + n : newlines;
+        put_bytes(w, s, n);
+        return;
+    }
+
+    if (w->pending_space && w->length > 0 && w->trailing_newlines == 0) {
+        put(w, ' ');
+    }
+    w->pending_space = 0;
+    put_bytes(w, s, n);
+    w->trailing_newlines = 0;
+}
+
+// End the current line, leaving at least `lines` newlines in a row
+// (2 gives a blank line between paragraphs)
+static void break_line(TextWriter *w, int lines) {
+    w->pending_space = 0;
+    if (w->length == 0) return;
+    while (w->trailing_newlines < lines) {
+        put(w, '\n');
+        w->trailing_newlines++;
+    }
+}
+
+static void put_codepoint(TextWriter *w, unsigned long cp) {
+    if (cp < 0x80) {
+        put_text(w, (char)cp);
+    } else if (cp < 0x800) {
+        put_text(w, (char)(0xC0 | (cp >> 6)));
+        put_text(w, (char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        put_text(w, (char)(0xE0 | (cp >> 12)));
+        put_text(w, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        put_text(w, (char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x110000) {
+        put_text(w, (char)(0xF0 | (cp >> 18)));
+        put_text(w, (char)(0x80 | ((cp >> 12) & 0x3F)));
+        put_text(w, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        put_text(w, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Decode the entity starting at html[i] == '&'; returns bytes consumed
+static size_t put_entity(TextWriter *w, const char *html, size_t i, size_t length) {
+    size_t end = i + 1;
+    while (end < length && end - i < 12 && html[end] != ';' && html[end] != '<' &&
+           !isspace((unsigned char)html[end])) {
+        end++;
+    }
+    if (end >= length || html[end] != ';') {
+        put_text(w, '&');
+        return 1;
+    }
+
+    const char *name = html + i + 1;
+    size_t name_len = end - i - 1;
+
+    if (name_len > 1 && name[0] == '#') {
+        unsigned long cp = 0;
+        int hex = (name[1] == 'x' || name[1] == 'X');
+        for (size_t k = hex ? 2 : 1; k < name_len; k++) {
+            int c = (unsigned char)name[k];
+            if (hex && isxdigit(c)) cp = cp * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+            else if (!hex && isdigit(c)) cp = cp * 10 + (c - '0');
+            else { put_text(w, '&'); return 1; }
+        }
+        put_codepoint(w, cp);
+        return end - i + 1;
+    }
+
+    static const struct { const char *name; unsigned long cp; } entities[] = {
+        {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''},
+        {"nbsp", 0xA0}, {"copy", 0xA9}, {"reg", 0xAE}, {"mdash", 0x2014},
+        {"ndash", 0x2013}, {"hellip", 0x2026}, {"laquo", 0xAB}, {"raquo", 0xBB}
+    };
+    for (size_t k = 0; k < sizeof(entities) / sizeof(entities[0]); k++) {
+        if (strlen(entities[k].name) == name_len && strncmp(entities[k].name, name, name_len) == 0) {
+            if (entities[k].cp == 0xA0) {
+                // Non-breaking space: a real space that does not collapse
+                if (w->pending_space && w->trailing_newlines == 0 && w->length > 0) put(w, ' ');
+                w->pending_space = 0;
+                put(w, ' ');
+                w->trailing_newlines = 0;
+            } else {
+                put_codepoint(w, entities[k].cp);
+            }
+            return end - i + 1;
+        }
+    }
+
+    put_text(w, '&');
+    return 1;
+}
+
+static int tag_is(const char *tag, const char *const *names) {
+    for (; *names; names++) {
+        if (strcmp(tag, *names) == 0) return 1;
+    }
+    return 0;
+}
+
+// Find the end of the element named tag (e.g. the "</script>"); returns
+// the index just past it, or length if it is never closed
+static size_t skip_element(const char *html, size_t i, size_t length, const char *tag) {
+    size_t tag_len = strlen(tag);
+    for (; i + 2 + tag_len <= length; i++) {
+        const char *lt = memchr(html + i, '<', length - i);
+        if (!lt) break;
+        i = lt - html;
+        if (i + 2 + tag_len <= length && html[i + 1] == '/' && strncasecmp(html + i + 2, tag, tag_len) == 0) {
+            const char *gt = memchr(html + i, '>', length - i);
+            return gt ? (size_t)(gt - html) + 1 : length;
+        }
+    }
+    return length;
+}
+
+size_t html_to_text(const char *html, size_t length, char *out, size_t capacity,
+                    const volatile int *cancel, int *truncated) {
+    static const char *const paragraph_tags[] = {
+        "p", "h1", "h2", "h3", "h4", "h5", "h6", "ul", "ol", "dl", "table",
+        "pre", "blockquote", NULL
+    };
+    static const char *const line_tags[] = {
+        "div", "li", "tr", "dt", "dd", "section", "article", "header", "footer",
+        "nav", "form", "main", "aside", "figure", "caption", "address", NULL
+    };
+    static const char *const hidden_tags[] = {
+        "head", "title", "script", "style", "noscript", "template", NULL
+    };
+
+    TextWriter w;
+    memset(&w, 0, sizeof(w));
+    w.out = out;
+    w.capacity = capacity > 0 ? capacity - 1 : 0;
+
+    size_t next_check = CANCEL_CHECK_INTERVAL;
+    size_t i = 0;
+    while (i < length) {
+        if (i >= next_check) {
+            if (cancel && *cancel) return HTML2TEXT_CANCELLED;
+            next_check = i + CANCEL_CHECK_INTERVAL;
+        }
+
+        char c = html[i];
+        if (c == '&') {
+            i += put_entity(&w, html, i, length);
+            continue;
+        }
+        if (c != '<') {
+            // Runs of text are found with the scan kernels, at most up
+            // to the next cancel check
+            size_t left = length - i;
+            if (left > CANCEL_CHECK_INTERVAL) left = CANCEL_CHECK_INTERVAL;
+            size_t n;
+            if (w.pre_depth > 0) {
+                n = scan_special(html + i, left);
+            } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f') {
+                w.pending_space = 1;
+                i += scan_space(html + i, left);
+                continue;
+            } else {
+                // A space at the end is left to the next round, which
+                // collapses it with whatever whitespace follows
+                n = scan_text(html + i, left);
+                if (html[i + n - 1] == ' ') n--;
+            }
+            put_run(&w, html + i, n);
+            i += n;
+            continue;
+        }
+
+        // Comments, doctype and processing instructions
+        if (i + 3 < length && strncmp(html + i, "<!--", 4) == 0) {
+            const char *end = memmem(html + i + 4, length - i - 4, "-->", 3);
+            i = end ? (size_t)(end - html) + 3 : length;
+            continue;
+        }
+        if (i + 1 < length && (html[i + 1] == '!' || html[i + 1] == '?')) {
+            const char *gt = memchr(html + i, '>', length - i);
+            i = gt ? (size_t)(gt - html) + 1 : length;
+            continue;
+        }
+
+        // Tag name, lower-cased
+        size_t j = i + 1;
+        int closing = 0;
+        if (j < length && html[j] == '/') {
+            closing = 1;
+            j++;
+        }
+        char tag[16];
+        size_t tag_len = 0;
+        while (j < length && isalnum((unsigned char)html[j])) {
+            if (tag_len < sizeof(tag) - 1) tag[tag_len++] = tolower((unsigned char)html[j]);
+            j++;
+        }
+        tag[tag_len] = '\0';
+
+        if (tag_len == 0) {
+            // A lone '<' is text
+            put_text(&w, '<');
+            i++;
+            continue;
+        }
+
+        // Skip attributes, honouring quotes so a '>' inside them does not end the tag
+        char quote = 0;
+        while (j < length && (quote || html[j] != '>')) {
+            if (quote && html[j] == quote) quote = 0;
+            else if (!quote && (html[j] == '"' || html[j] == '\'')) quote = html[j];
+            j++;
+        }
+        i = (j < length) ? j + 1 : length;
+
+        if (!closing && tag_is(tag, hidden_tags)) {
+            i = skip_element(html, i, length, tag);
+        } else if (strcmp(tag, "br") == 0) {
+            w.pending_space = 0;
+            put(&w, '\n');
+            w.trailing_newlines++;
+        } else if (strcmp(tag, "hr") == 0) {
+            break_line(&w, 1);
+            put_string(&w, "----------------------------------------");
+            w.trailing_newlines = 0;
+            break_line(&w, 1);
+        } else if (strcmp(tag, "pre") == 0) {
+            break_line(&w, 2);
+            if (closing && w.pre_depth > 0) w.pre_depth--;
+            else if (!closing) w.pre_depth++;
+        } else if (tag_is(tag, paragraph_tags)) {
+            break_line(&w, 2);
+        } else if (tag_is(tag, line_tags)) {
+            break_line(&w, 1);
+            if (!closing && strcmp(tag, "li") == 0) {
+                put_string(&w, "  * ");
+                w.trailing_newlines = 0;
+            }
+        } else if (closing && (strcmp(tag, "td") == 0 || strcmp(tag, "th") == 0)) {
+            w.pending_space = 1;
+        }
+    }
+
+    break_line(&w, 1);
+
+    // Paragraph breaks at the very end are just noise
+    while (w.length > 1 && w.out[w.length - 1] == '\n' && w.out[w.length - 2] == '\n') {
+        w.length--;
+    }
+    if (capacity > 0) out[w.length] = '\0';
+    if (truncated) *truncated = w.truncated;
+    return w.length;
+}
+
+int html_extract_links(const char *html, size_t length, char *out, size_t capacity) {
+    size_t used = 0;
+    int count = 0;
+
+    for (const char *p = html; (p = memchr(p, '<', html + length - p)) != NULL; p++) {
+        size_t left = html + length - p;
+        if (left < 3 || (p[1] != 'a' && p[1] != 'A') || !isspace((unsigned char)p[2])) continue;
+
+        const char *gt = memchr(p, '>', left);
+        if (!gt) break;
+
+        // Find href= inside this tag
+        for (const char *a = p + 2; a + 5 < gt; a++) {
+            if (strncasecmp(a, "href=", 5) != 0 || !isspace((unsigned char)a[-1])) continue;
+
+            const char *value = a + 5;
+            const char *end;
+            if (*value == '"' || *value == '\'') {
+                end = memchr(value + 1, *value, gt - value - 1);
+                value++;
+            } else {
+                end = value;
+                while (end < gt && !isspace((unsigned char)*end)) end++;
+            }
+            if (!end) break;
+
+            size_t len = end - value;
+            if (len > 0 && used + len + 2 <= capacity) {
+                memcpy(out + used, value, len);
+                used += len;
+                out[used++] = '\0';
+                count++;
+            }
+            break;
+        }
+        p = gt;
+    }
+
+    if (capacity > 0) out[used < capacity ? used : capacity - 1] = '\0';
+    return count;
+}
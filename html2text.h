@@ -0,0 +1,25 @@
+#ifndef HTML2TEXT_H
+#define HTML2TEXT_H
+
+#include <stddef.h>
+
+// Minimal HTML to plain text conversion, in the spirit of `w3m -dump`.
+// Tags are dropped, block elements start new lines, whitespace outside
+// <pre> collapses, <head>/<script>/<style> are skipped and common
+// entities are decoded. It never allocates, so it can run inside a
+// strict seccomp sandbox.
+
+#define HTML2TEXT_CANCELLED ((size_t)-1)
+
+// Convert html[0..length) into out (at most capacity bytes, always
+// NUL-terminated). Returns the text length, or HTML2TEXT_CANCELLED if
+// *cancel became non-zero. *truncated is set if the text did not fit.
+size_t html_to_text(const char *html, size_t length, char *out, size_t capacity,
+                    const volatile int *cancel, int *truncated);
+
+// Collect the href of every <a> tag as NUL-separated strings in out,
+// ending with an empty string. Stops when out is full. Also does not
+// allocate. Returns the number of links stored.
+int html_extract_links(const char *html, size_t length, char *out, size_t capacity);
+
+#endif
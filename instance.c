@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "instance.h"
+#include "common.h"
+#include "shared_memory.h"
+#include "snapshot.h"
+#include "ftindex.h"
+
+#define INSTANCE_KEY_BASE 0x42000000   // Derived keys: base | 24 bits of the name's hash
+#define INSTANCE_VISITS_KEY_BASE 0x43000000
+
+static Instance current;
+static int selected = 0;
+
+static int valid_name(const char *name) {
+    if (strlen(name) >= INSTANCE_NAME_MAX) return 0;
+    for (const char *p = name; *p; p++) {
+        if (!(*p >= 'a' && *p <= 'z') && !(*p >= 'A' && *p <= 'Z') &&
+            !(*p >= '0' && *p <= '9') && *p != '-' && *p != '_') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int instance_select(const char *name) {
+    if (!name) name = getenv(INSTANCE_ENV);
+    if (!name || strcmp(name, INSTANCE_DEFAULT_NAME) == 0) name = "";
+    if (!valid_name(name)) return -1;
+
+    memset(&current, 0, sizeof(current));
+    snprintf(current.name, sizeof(current.name), "%s", name);
+
+    if (name[0] == '\0') {
+        snprintf(current.browser_fifo, sizeof(current.browser_fifo), "%s", BROWSER_FIFO);
+        snprintf(current.response_prefix, sizeof(current.response_prefix), "%s",
+                 RESPONSE_FIFO_PREFIX);
+        current.shm_key = SHM_KEY;
+        current.sem_key = SEM_KEY;
+        current.visits_key = VISITS_KEY;
+        snprintf(current.log_path, sizeof(current.log_path), "browser_log.txt");
+        snprintf(current.snapshot_path, sizeof(current.snapshot_path), "%s", SNAPSHOT_DEFAULT_PATH);
+        snprintf(current.index_path, sizeof(current.index_path), "%s", FTINDEX_DEFAULT_PATH);
+    } else {
+        snprintf(current.browser_fifo, sizeof(current.browser_fifo), "%s_%s", BROWSER_FIFO, name);
+        snprintf(current.response_prefix, sizeof(current.response_prefix), "%s%s_",
+                 RESPONSE_FIFO_PREFIX, name);
+
+        // Shared memory and semaphore keys are separate namespaces, so
+        // one key serves for both
+        uint32_t hash = hash_string(name);
+        current.shm_key = INSTANCE_KEY_BASE | (hash & 0xffffff);
+        current.sem_key = current.shm_key;
+        current.visits_key = INSTANCE_VISITS_KEY_BASE | (hash & 0xffffff);
+        snprintf(current.log_path, sizeof(current.log_path), "browser_log_%s.txt", name);
+        snprintf(current.snapshot_path, sizeof(current.snapshot_path), "browser_session_%s.snap", name);
+        snprintf(current.index_path, sizeof(current.index_path), "browser_search_%s.idx", name);
+    }
+    selected = 1;
+    return 0;
+}
+
+const Instance *instance_get() {
+    // An invalid INSTANCE_ENV falls back to the default instance
+    if (!selected && instance_select(NULL) < 0) instance_select("");
+    return &current;
+}
+
+int instance_shard_of(int tab_id, int shard_count) {
+    if (shard_count <= 1 || tab_id <= 0) return 0;
+    return tab_id % shard_count;
+}
+
+void instance_shard_fifo(int shard, char *path, size_t size) {
+    const Instance *inst = instance_get();
+    if (shard == 0) snprintf(path, size, "%s", inst->browser_fifo);
+    else snprintf(path, size, "%s.%d", inst->browser_fifo, shard);
+}
+
+static void registry_path(const char *name, char *path, size_t size) {
+    snprintf(path, size, "%s/%.31s", INSTANCE_REGISTRY_DIR, name[0] ? name : INSTANCE_DEFAULT_NAME);
+}
+
+static int process_alive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+int instance_register() {
+    const Instance *inst = instance_get();
+
+    // Two browsers on one instance, or on colliding keys, would corrupt
+    // each other's shared memory
+    InstanceEntry *entries;
+    int count = instance_read_registry(&entries);
+    for (int i = 0; i < count; i++) {
+        InstanceEntry *e = &entries[i];
+        if (!process_alive(e->pid) || e->pid == getpid() || e->pid == getppid()) continue;
+        if (strcmp(e->name, inst->name[0] ? inst->name : INSTANCE_DEFAULT_NAME) == 0) {
+            fprintf(stderr, "[Browser] Instance %s is already served by process %d\n",
+                    e->name, (int)e->pid);
+            free(entries);
+            return -1;
+        }
+        if (e->shm_key == inst->shm_key) {
+            fprintf(stderr, "[Browser] Keys of instance %s collide with instance %s\n",
+                    inst->name, e->name);
+            free(entries);
+            return -1;
+        }
+    }
+    free(entries);
+
+    if (mkdir(INSTANCE_REGISTRY_DIR, 0777) < 0 && errno != EEXIST) {
+        perror("mkdir registry");
+        return -1;
+    }
+    chmod(INSTANCE_REGISTRY_DIR, 01777);
+
+    // Written aside and renamed, so readers never see half an entry
+    char path[INSTANCE_PATH_MAX + 64], tmp[INSTANCE_PATH_MAX + 80];
+    registry_path(inst->name, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        perror("fopen registry");
+        return -1;
+    }
+    fprintf(fp, "%d %ld %d %d %s\n", (int)getpid(), (long)time(NULL), (int)inst->shm_key,
+            (int)inst->sem_key, inst->browser_fifo);
+    if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+        perror("write registry");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void instance_unregister() {
+    const Instance *inst = instance_get();
+    char path[INSTANCE_PATH_MAX + 64];
+    registry_path(inst->name, path, sizeof(path));
+
+    // A successor started by a hot restart owns the entry now
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+    int pid = 0;
+    int owned = fscanf(fp, "%d", &pid) == 1 && pid == getpid();
+    fclose(fp);
+    if (owned) unlink(path);
+}
+
+int instance_read_registry(InstanceEntry **entries) {
+    *entries = NULL;
+    DIR *dir = opendir(INSTANCE_REGISTRY_DIR);
+    if (!dir) return 0;
+
+    int count = 0, capacity = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.' || strchr(de->d_name, '.') ||
+            strlen(de->d_name) >= INSTANCE_NAME_MAX) {
+            continue;
+        }
+
+        char path[INSTANCE_PATH_MAX + 64];
+        snprintf(path, sizeof(path), "%s/%s", INSTANCE_REGISTRY_DIR, de->d_name);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+
+        InstanceEntry e;
+        memset(&e, 0, sizeof(e));
+        int pid, shm_key, sem_key;
+        long started;
+        int fields = fscanf(fp, "%d %ld %d %d %127s", &pid, &started, &shm_key, &sem_key,
+                            e.browser_fifo);
+        fclose(fp);
+        if (fields != 5) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            InstanceEntry *grown = realloc(*entries, capacity * sizeof(InstanceEntry));
+            if (!grown) break;
+            *entries = grown;
+        }
+        snprintf(e.name, sizeof(e.name), "%s", de->d_name);
+        e.pid = pid;
+        e.started = started;
+        e.shm_key = shm_key;
+        e.sem_key = sem_key;
+        (*entries)[count++] = e;
+    }
+    closedir(dir);
+    return count;
+}
@@ -0,0 +1,70 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+
+// Instance namespaces.
+// Every name a browser and its tabs share (FIFOs, System V keys, log and
+// session files) is derived from an instance name. This lets
+// independent browsers run on one host. The name comes from -n or from
+// INSTANCE_ENV. The unnamed default instance keeps the historical names
+// (BROWSER_FIFO, SHM_KEY, ...).
+//
+// A running browser registers its instance as a file in
+// INSTANCE_REGISTRY_DIR; ./instances lists them.
+
+#define INSTANCE_ENV "BROWSER_INSTANCE"
+#define INSTANCE_NAME_MAX 32
+#define INSTANCE_PATH_MAX 128
+#define INSTANCE_REGISTRY_DIR "/tmp/browser_instances"
+#define INSTANCE_DEFAULT_NAME "default"    // Registry entry of the unnamed instance
+#define INSTANCE_MAX_SHARDS 16
+
+typedef struct {
+    char name[INSTANCE_NAME_MAX];          // "" for the default instance
+    char browser_fifo[INSTANCE_PATH_MAX];
+    char response_prefix[INSTANCE_PATH_MAX]; // Followed by the tab id
+    key_t shm_key;
+    key_t sem_key;
+    key_t visits_key;                      // Visit index segment (see visits.h)
+    char log_path[INSTANCE_PATH_MAX];
+    char snapshot_path[INSTANCE_PATH_MAX];
+    char index_path[INSTANCE_PATH_MAX];    // Search index (see ftindex.h)
+} Instance;
+
+// One registry entry, as read back by instance_read_registry()
+typedef struct {
+    char name[INSTANCE_NAME_MAX];
+    pid_t pid;
+    time_t started;
+    key_t shm_key;
+    key_t sem_key;
+    char browser_fifo[INSTANCE_PATH_MAX];
+} InstanceEntry;
+
+// Select the instance: name, or INSTANCE_ENV if name is NULL. Names are
+// letters, digits, '-' and '_'. Returns -1 if the name is invalid.
+int instance_select(const char *name);
+
+// The selected instance, selected from INSTANCE_ENV on first use if
+// instance_select() was not called
+const Instance *instance_get();
+
+// A browser started with several shards serves tab_id on shard
+// instance_shard_of(tab_id, count). Shard 0 reads browser_fifo; shard k
+// reads browser_fifo.k.
+int instance_shard_of(int tab_id, int shard_count);
+void instance_shard_fifo(int shard, char *path, size_t size);
+
+// Record this process as the instance's browser. Fails if another live
+// browser already serves it (other than its parent, which is how a hot
+// restart starts).
+int instance_register();
+void instance_unregister();
+
+// Read every registry entry into entries (malloc'd). Returns the count.
+int instance_read_registry(InstanceEntry **entries);
+
+#endif
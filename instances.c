@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "shared_memory.h"
+#include "instance.h"
+
+// Lists the browser instances registered on this host (see instance.h),
+// with what each one's shared memory shows of its tabs.
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c]\n"
+            "  -c  remove the entries of browsers that are no longer running\n",
+            prog);
+}
+
+static int process_alive(pid_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static void format_uptime(time_t started, char *out, size_t size) {
+    long s = (long)(time(NULL) - started);
+    if (s < 0) s = 0;
+    if (s >= 86400) snprintf(out, size, "%ldd%02ldh", s / 86400, s % 86400 / 3600);
+    else if (s >= 3600) snprintf(out, size, "%ldh%02ldm", s / 3600, s % 3600 / 60);
+    else snprintf(out, size, "%ldm%02lds", s / 60, s % 60);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, clean = 0;
+    while ((opt = getopt(argc, argv, "ch")) != -1) {
+        switch (opt) {
+            case 'c': clean = 1; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    InstanceEntry *entries;
+    int count = instance_read_registry(&entries);
+    if (count == 0) {
+        printf("No browser instances registered in %s\n", INSTANCE_REGISTRY_DIR);
+        return 0;
+    }
+
+    printf("%-16s %7s %-8s %8s %6s %5s %9s %7s  %s\n",
+           "INSTANCE", "PID", "STATE", "UPTIME", "SHARDS", "TABS", "BOOKMARKS", "PAGES", "FIFO");
+    for (int i = 0; i < count; i++) {
+        InstanceEntry *e = &entries[i];
+        char uptime[32];
+        format_uptime(e->started, uptime, sizeof(uptime));
+
+        if (!process_alive(e->pid)) {
+            printf("%-16s %7d %-8s %8s %6s %5s %9s %7s  %s\n",
+                   e->name, (int)e->pid, "stale", "-", "-", "-", "-", "-", e->browser_fifo);
+            if (clean) {
+                char path[INSTANCE_PATH_MAX + 64];
+                snprintf(path, sizeof(path), "%s/%s", INSTANCE_REGISTRY_DIR, e->name);
+                if (unlink(path) < 0) perror("unlink");
+            }
+            continue;
+        }
+
+        struct stat st;
+        const char *state = stat(e->browser_fifo, &st) == 0 && S_ISFIFO(st.st_mode)
+                            ? "running" : "no-fifo";
+
+        // Read-only and without the semaphore: the counts are a snapshot
+        int shmid = shmget(e->shm_key, sizeof(SharedState), 0);
+        SharedState *shared = shmid < 0 ? (void *)-1 : shmat(shmid, NULL, SHM_RDONLY);
+        if (shared == (void *)-1) {
+            printf("%-16s %7d %-8s %8s %6s %5s %9s %7s  %s\n",
+                   e->name, (int)e->pid, state, uptime, "?", "?", "?", "?", e->browser_fifo);
+            continue;
+        }
+        printf("%-16s %7d %-8s %8s %6d %5d %9d %7d  %s\n",
+               e->name, (int)e->pid, state, uptime,
+               shared->shard_count > 0 ? shared->shard_count : 1, shared->active_tab_count,
+               shared->bookmark_count, shared->total_pages_loaded, e->browser_fifo);
+        shmdt(shared);
+    }
+
+    free(entries);
+    return 0;
+}
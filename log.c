@@ -0,0 +1,533 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "log.h"
+
+// Argument tags inside a record
+enum {
+    ARG_INT = 'i',
+    ARG_LONG = 'l',
+    ARG_DOUBLE = 'd',
+    ARG_STRING = 's',
+    ARG_POINTER = 'p'
+};
+
+#define RECORD_DATA_SIZE (LOG_RECORD_SIZE - 2 * sizeof(uint64_t) - 2 * sizeof(uint16_t))
+
+typedef struct {
+    uint64_t time_ns;
+    const char *format;
+    uint16_t level;
+    uint16_t length;             // Bytes of data used
+    unsigned char data[RECORD_DATA_SIZE];
+} LogRecord;
+
+// Single producer (the owning thread), single consumer (the writer)
+typedef struct LogRing {
+    struct LogRing *next;
+    unsigned long head;          // Next slot the producer fills
+    unsigned long tail;          // Next slot the writer reads
+    unsigned long dropped;
+    int closed;                  // Owning thread exited; freed once drained
+    LogRecord slots[LOG_RING_SLOTS];
+} LogRing;
+
+int log_level = LOG_LEVEL_INFO;
+
+static LogConfig config;
+static int running = 0;
+static pthread_t writer_thread;
+static int stop_writer = 0;
+static int log_fd = -1;
+static size_t log_size = 0;
+static LogStats stats;
+
+// Rings are only added under the lock; the writer walks the list with it held
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static LogRing *rings = NULL;
+static pthread_key_t ring_key;
+static __thread LogRing *thread_ring = NULL;
+
+// Bumped for every record; the writer sleeps on it as a futex
+static unsigned int log_seq = 0;
+static int writer_sleeping = 0;
+
+static void ring_release(void *ring) {
+    __atomic_store_n(&((LogRing *)ring)->closed, 1, __ATOMIC_RELEASE);
+}
+
+static LogRing *ring_for_thread() {
+    if (thread_ring) return thread_ring;
+
+    LogRing *ring = calloc(1, sizeof(LogRing));
+    if (!ring) return NULL;
+    pthread_setspecific(ring_key, ring);
+
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+
+    thread_ring = ring;
+    return ring;
+}
+
+// Append a tagged value; returns -1 once the record is full
+static int put(LogRecord *r, char tag, const void *value, size_t size) {
+    if (r->length + 1 + size > RECORD_DATA_SIZE) return -1;
+    r->data[r->length++] = tag;
+    memcpy(r->data + r->length, value, size);
+    r->length += size;
+    return 0;
+}
+
+static int put_string(LogRecord *r, const char *s) {
+    if (!s) s = "(null)";
+    if (r->length + 1 + sizeof(uint16_t) + 1 > RECORD_DATA_SIZE) return -1;
+    size_t room = RECORD_DATA_SIZE - r->length - 1 - sizeof(uint16_t);
+    uint16_t n = strnlen(s, room);
+    r->data[r->length++] = ARG_STRING;
+    memcpy(r->data + r->length, &n, sizeof(n));
+    r->length += sizeof(n);
+    memcpy(r->data + r->length, s, n);
+    r->length += n;
+    return 0;
+}
+
+// Walk a printf format, calling back with each conversion's length
+// modifier and conversion character. '*' widths come through as 'd'.
+typedef int (*ConversionFn)(const char *spec, size_t spec_length, char length_mod, char conversion,
+                            void *context);
+
+static void for_each_conversion(const char *format, ConversionFn fn, void *context) {
+    for (const char *p = format; *p; p++) {
+        if (*p != '%') continue;
+        const char *spec = p++;
+        if (*p == '%') continue;
+
+        while (*p && strchr("-+ #0'", *p)) p++;
+        if (*p == '*') {
+            if (fn(NULL, 0, 0, '*', context) < 0) return;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                if (fn(NULL, 0, 0, '*', context) < 0) return;
+                p++;
+            }
+            while (*p >= '0' && *p <= '9') p++;
+        }
+
+        char length_mod = 0;
+        while (*p && strchr("hlLqjzt", *p)) {
+            length_mod = (length_mod == 'l' && *p == 'l') ? 'q' : *p;
+            p++;
+        }
+        if (!*p) return;
+        if (fn(spec, p - spec + 1, length_mod, *p, context) < 0) return;
+    }
+}
+
+typedef struct {
+    LogRecord *record;
+    va_list *args;
+} CaptureContext;
+
+static int capture(const char *spec, size_t spec_length, char length_mod, char conversion,
+                   void *context) {
+    CaptureContext *c = context;
+    LogRecord *r = c->record;
+
+    switch (conversion) {
+        case '*':
+        case 'c': {
+            int v = va_arg(*c->args, int);
+            return put(r, ARG_INT, &v, sizeof(v));
+        }
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': {
+            if (length_mod == 0 || length_mod == 'h') {
+                int v = va_arg(*c->args, int);
+                return put(r, ARG_INT, &v, sizeof(v));
+            }
+            long long v = va_arg(*c->args, long long);
+            return put(r, ARG_LONG, &v, sizeof(v));
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+            double v = va_arg(*c->args, double);
+            return put(r, ARG_DOUBLE, &v, sizeof(v));
+        }
+        case 's':
+            return put_string(r, va_arg(*c->args, const char *));
+        case 'p': {
+            void *v = va_arg(*c->args, void *);
+            return put(r, ARG_POINTER, &v, sizeof(v));
+        }
+        default:
+            return -1;               // %n and unknown conversions are not supported
+    }
+}
+
+void log_write(int level, const char *format, ...) {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) return;
+
+    LogRing *ring = ring_for_thread();
+    if (!ring) return;
+
+    unsigned long head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SLOTS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    LogRecord *r = &ring->slots[head % LOG_RING_SLOTS];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    r->time_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    r->format = format;
+    r->level = level;
+    r->length = 0;
+
+    va_list args;
+    va_start(args, format);
+    CaptureContext c = { r, &args };
+    for_each_conversion(format, capture, &c);
+    va_end(args);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&log_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer_sleeping, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &log_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+// Writer side: expand one record into out
+
+typedef struct {
+    const LogRecord *record;
+    size_t read;                 // Offset into record->data
+    int stars[2];
+    int star_count;
+    char *out;
+    size_t cap;
+    size_t length;
+} FormatContext;
+
+static void append(FormatContext *f, const char *text, size_t n) {
+    if (f->length + n >= f->cap) n = f->cap - f->length - 1;
+    memcpy(f->out + f->length, text, n);
+    f->length += n;
+}
+
+static int take(FormatContext *f, char tag, void *value, size_t size) {
+    const LogRecord *r = f->record;
+    if (f->read + 1 + size > r->length || r->data[f->read] != tag) return -1;
+    memcpy(value, r->data + f->read + 1, size);
+    f->read += 1 + size;
+    return 0;
+}
+
+// Copy the literal text up to the next conversion, then format it with
+// its stored argument
+static int expand(const char *spec, size_t spec_length, char length_mod, char conversion,
+                  void *context) {
+    FormatContext *f = context;
+    const LogRecord *r = f->record;
+
+    if (conversion == '*') {
+        if (f->star_count == 2 || take(f, ARG_INT, &f->stars[f->star_count], sizeof(int)) < 0) return -1;
+        f->star_count++;
+        return 0;
+    }
+
+    // A copy of the spec with the length modifier normalised to what was stored
+    char one[32];
+    size_t n = 0;
+    for (size_t i = 0; i < spec_length - 1 && n < sizeof(one) - 4; i++) {
+        if (!strchr("hlLqjzt", spec[i])) one[n++] = spec[i];
+    }
+
+    char buffer[LOG_RECORD_SIZE];
+    int written = -1;
+    union { int i; long long l; double d; void *p; } v;
+
+    if (conversion == 's') {
+        uint16_t len;
+        if (f->read + 1 + sizeof(len) > r->length || r->data[f->read] != ARG_STRING) return -1;
+        memcpy(&len, r->data + f->read + 1, sizeof(len));
+        char s[RECORD_DATA_SIZE + 1];
+        memcpy(s, r->data + f->read + 1 + sizeof(len), len);
+        s[len] = '\0';
+        f->read += 1 + sizeof(len) + len;
+        one[n++] = 's';
+        one[n] = '\0';
+        if (f->star_count == 2) written = snprintf(buffer, sizeof(buffer), one, f->stars[0], f->stars[1], s);
+        else if (f->star_count == 1) written = snprintf(buffer, sizeof(buffer), one, f->stars[0], s);
+        else written = snprintf(buffer, sizeof(buffer), one, s);
+    } else {
+        char tag = f->read < r->length ? r->data[f->read] : 0;
+        if (tag == ARG_LONG) {
+            one[n++] = 'l';
+            one[n++] = 'l';
+        }
+        one[n++] = conversion;
+        one[n] = '\0';
+
+        size_t size = tag == ARG_INT ? sizeof(int) : tag == ARG_LONG ? sizeof(long long) :
+                      tag == ARG_DOUBLE ? sizeof(double) : sizeof(void *);
+        if (take(f, tag, &v, size) < 0) return -1;
+
+#define FORMAT_WITH_STARS(value) \
+        (f->star_count == 2 ? snprintf(buffer, sizeof(buffer), one, f->stars[0], f->stars[1], value) : \
+         f->star_count == 1 ? snprintf(buffer, sizeof(buffer), one, f->stars[0], value) : \
+                              snprintf(buffer, sizeof(buffer), one, value))
+        switch (tag) {
+            case ARG_INT: written = FORMAT_WITH_STARS(v.i); break;
+            case ARG_LONG: written = FORMAT_WITH_STARS(v.l); break;
+            case ARG_DOUBLE: written = FORMAT_WITH_STARS(v.d); break;
+            case ARG_POINTER: written = FORMAT_WITH_STARS(v.p); break;
+        }
+#undef FORMAT_WITH_STARS
+    }
+
+    f->star_count = 0;
+    if (written < 0) return -1;
+    append(f, buffer, (size_t)written < sizeof(buffer) ? (size_t)written : sizeof(buffer) - 1);
+    return 0;
+}
+
+// Literal text is copied by walking the format alongside the conversions
+typedef struct {
+    FormatContext *f;
+    const char *from;            // Literal text not yet copied
+} LiteralContext;
+
+static int expand_with_literals(const char *spec, size_t spec_length, char length_mod,
+                                char conversion, void *context) {
+    LiteralContext *l = context;
+    if (spec) {
+        // Copy the text before the spec, collapsing "%%"
+        for (const char *p = l->from; p < spec; p++) {
+            append(l->f, p, 1);
+            if (p[0] == '%' && p[1] == '%') p++;
+        }
+        l->from = spec + spec_length;
+    }
+    return expand(spec, spec_length, length_mod, conversion, l->f);
+}
+
+static size_t format_record(const LogRecord *r, char *out, size_t cap, int with_time) {
+    FormatContext f = { .record = r, .out = out, .cap = cap };
+
+    if (with_time) {
+        // Same stamp as ctime(), as in the existing browser_log.txt
+        time_t seconds = r->time_ns / 1000000000ull;
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        char stamp[64];
+        size_t n = strftime(stamp, sizeof(stamp), "[%a %b %e %H:%M:%S %Y] ", &tm);
+        append(&f, stamp, n);
+    }
+    if (r->level == LOG_LEVEL_WARN) append(&f, "Warning: ", 9);
+    else if (r->level == LOG_LEVEL_ERROR) append(&f, "Error: ", 7);
+    else if (r->level == LOG_LEVEL_DEBUG) append(&f, "Debug: ", 7);
+
+    LiteralContext l = { &f, r->format };
+    for_each_conversion(r->format, expand_with_literals, &l);
+    for (const char *p = l.from; *p; p++) {
+        append(&f, p, 1);
+        if (p[0] == '%' && p[1] == '%') p++;
+    }
+
+    // One record per line
+    while (f.length > 0 && out[f.length - 1] == '\n') f.length--;
+    append(&f, "\n", 1);
+    return f.length;
+}
+
+static void write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+static int open_log_file() {
+    log_fd = open(config.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) return -1;
+    struct stat st;
+    log_size = fstat(log_fd, &st) == 0 ? st.st_size : 0;
+    return 0;
+}
+
+// Shift path -> path.1 -> ... -> path.keep and start a new file. Several
+// processes may share one file; whoever notices first rotates it and the
+// others follow when they see the inode change.
+static void rotate_if_needed() {
+    if (log_fd < 0 || config.max_bytes == 0) return;
+
+    struct stat current, ours;
+    if (stat(config.path, &current) < 0 || fstat(log_fd, &ours) < 0 ||
+        current.st_ino != ours.st_ino) {
+        close(log_fd);
+        open_log_file();
+        return;
+    }
+    if ((size_t)current.st_size < config.max_bytes) {
+        log_size = current.st_size;
+        return;
+    }
+
+    char from[PATH_MAX], to[PATH_MAX];
+    for (int i = config.keep; i > 0; i--) {
+        if (i == 1) snprintf(from, sizeof(from), "%s", config.path);
+        else snprintf(from, sizeof(from), "%s.%d", config.path, i - 1);
+        snprintf(to, sizeof(to), "%s.%d", config.path, i);
+        rename(from, to);
+    }
+    if (config.keep == 0) unlink(config.path);
+
+    close(log_fd);
+    open_log_file();
+    stats.rotations++;
+}
+
+// Format and write every pending record. Returns the number written.
+static unsigned long drain() {
+    static char file_buffer[64 * 1024];
+    static char echo_buffer[64 * 1024];
+    size_t file_length = 0, echo_length = 0;
+    unsigned long count = 0;
+
+    pthread_mutex_lock(&rings_lock);
+    for (LogRing **link = &rings; *link; ) {
+        LogRing *ring = *link;
+        int closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (unsigned long tail = ring->tail; tail != head; tail++) {
+            const LogRecord *r = &ring->slots[tail % LOG_RING_SLOTS];
+            if (file_length + LOG_RECORD_SIZE * 2 > sizeof(file_buffer)) {
+                write_all(log_fd, file_buffer, file_length);
+                log_size += file_length;
+                file_length = 0;
+            }
+            if (echo_length + LOG_RECORD_SIZE * 2 > sizeof(echo_buffer)) {
+                write_all(config.echo_fd, echo_buffer, echo_length);
+                echo_length = 0;
+            }
+            if (log_fd >= 0) {
+                file_length += format_record(r, file_buffer + file_length, LOG_RECORD_SIZE * 2, 1);
+            }
+            if (config.echo_fd >= 0) {
+                echo_length += format_record(r, echo_buffer + echo_length, LOG_RECORD_SIZE * 2, 0);
+            }
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+            count++;
+        }
+
+        stats.dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (closed && ring->tail == head) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    if (file_length > 0) {
+        write_all(log_fd, file_buffer, file_length);
+        log_size += file_length;
+    }
+    if (echo_length > 0) write_all(config.echo_fd, echo_buffer, echo_length);
+    if (log_size >= config.max_bytes) rotate_if_needed();
+
+    stats.written += count;
+    return count;
+}
+
+static void *writer_main(void *arg) {
+    for (;;) {
+        __atomic_store_n(&writer_sleeping, 1, __ATOMIC_SEQ_CST);
+        unsigned int seen = __atomic_load_n(&log_seq, __ATOMIC_SEQ_CST);
+        int stopping = __atomic_load_n(&stop_writer, __ATOMIC_ACQUIRE);
+        if (drain() == 0 && !stopping) {
+            // Wake up now and then anyway to notice rotation by another process
+            struct timespec timeout = { 1, 0 };
+            syscall(SYS_futex, &log_seq, FUTEX_WAIT_PRIVATE, seen, &timeout, NULL, 0);
+            rotate_if_needed();
+        }
+        __atomic_store_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST);
+        if (stopping) break;
+    }
+    drain();
+    return NULL;
+}
+
+int log_open(const LogConfig *new_config) {
+    if (running) return 0;
+
+    config = *new_config;
+    log_level = config.level;
+    if (config.path && open_log_file() < 0) {
+        perror("open log file");
+        return -1;
+    }
+
+    static int key_created = 0;
+    if (!key_created) {
+        pthread_key_create(&ring_key, ring_release);
+        key_created = 1;
+    }
+
+    stop_writer = 0;
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        if (log_fd >= 0) close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_close() {
+    if (!__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL)) return;
+
+    __atomic_store_n(&stop_writer, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&log_seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &log_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    pthread_join(writer_thread, NULL);
+
+    if (log_fd >= 0) close(log_fd);
+    log_fd = -1;
+}
+
+LogStats log_stats() {
+    LogStats copy = stats;
+    pthread_mutex_lock(&rings_lock);
+    for (LogRing *ring = rings; ring; ring = ring->next) {
+        copy.dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&rings_lock);
+    return copy;
+}
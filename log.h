@@ -0,0 +1,69 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stddef.h>
+
+// Asynchronous logging.
+// A log call copies its format pointer and raw arguments into a ring
+// owned by the calling thread (no locks, no formatting, no I/O) and
+// returns. A background writer thread drains every ring, formats the
+// records and appends them to a rotating log file, optionally echoing
+// them to a terminal. A full ring drops the record rather than block.
+//
+// Formats must be string literals; %s arguments are copied (truncated
+// to fit a record), other conversions are stored as binary values.
+// Nothing is recorded until log_open() has been called.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+// Calls below this level compile to nothing; build with
+// -DLOG_MIN_LEVEL=0 to keep log_debug()
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SLOTS 1024          // Records buffered per thread
+#define LOG_RECORD_SIZE 256          // Bytes per record, arguments included
+#define LOG_DEFAULT_MAX_BYTES (1024 * 1024)
+#define LOG_DEFAULT_KEEP 3
+
+typedef struct {
+    const char *path;                // Log file, NULL for none
+    size_t max_bytes;                // Rotate once the file passes this; 0 never
+    int keep;                        // Rotated files kept as path.1 .. path.keep
+    int echo_fd;                     // Also write messages here, -1 for none
+    int level;                       // Records below this are discarded
+} LogConfig;
+
+typedef struct {
+    unsigned long written;
+    unsigned long dropped;           // Lost to full rings
+    unsigned long rotations;
+} LogStats;
+
+extern int log_level;
+
+// Start the writer thread. Returns -1 if the file cannot be opened.
+int log_open(const LogConfig *config);
+
+// Write out everything recorded so far and stop the writer
+void log_close();
+
+LogStats log_stats();
+
+void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, format, ...) do { \
+        if ((level) >= LOG_MIN_LEVEL && (level) >= log_level) \
+            log_write((level), "" format, ##__VA_ARGS__); \
+    } while (0)
+
+#define log_debug(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define log_info(format, ...)  LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define log_warn(format, ...)  LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define log_error(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+#endif
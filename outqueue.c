@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "common.h"
+#include "outqueue.h"
+#include "log.h"
+#include "instance.h"
+
+struct OutChunk {
+    OutChunk *next;
+    ResponseClass cls;
+    size_t length;           // Inline data plus the shared body
+    size_t offset;           // Bytes already written; > 0 means it must be finished
+    OutBuffer *body;         // Shared body sent after data, or NULL
+    char data[];
+};
+
+OutQueueConfig outqueue_config = {
+    .high_watermark = 256 * 1024,
+    .low_watermark = 64 * 1024,
+    .policy = SLOW_COALESCE
+};
+
+// Registry of queues, in creation order
+static OutQueue **queues = NULL;
+static int queue_count = 0;
+static int queue_capacity = 0;
+
+int outqueue_parse_policy(const char *name, SlowConsumerPolicy *policy) {
+    if (strcmp(name, "drop") == 0) *policy = SLOW_DROP;
+    else if (strcmp(name, "coalesce") == 0) *policy = SLOW_COALESCE;
+    else if (strcmp(name, "disconnect") == 0) *policy = SLOW_DISCONNECT;
+    else return -1;
+    return 0;
+}
+
+const char *outqueue_policy_name(SlowConsumerPolicy policy) {
+    switch (policy) {
+        case SLOW_DROP: return "drop";
+        case SLOW_COALESCE: return "coalesce";
+        case SLOW_DISCONNECT: return "disconnect";
+    }
+    return "unknown";
+}
+
+OutQueue *outqueue_get(int tab_id) {
+    for (int i = 0; i < queue_count; i++) {
+        if (queues[i]->tab_id == tab_id) return queues[i];
+    }
+
+    if (queue_count == queue_capacity) {
+        int capacity = queue_capacity ? queue_capacity * 2 : 16;
+        OutQueue **grown = realloc(queues, capacity * sizeof(OutQueue *));
+        if (!grown) return NULL;
+        queues = grown;
+        queue_capacity = capacity;
+    }
+
+    OutQueue *q = calloc(1, sizeof(OutQueue));
+    if (!q) return NULL;
+    q->tab_id = tab_id;
+    q->fd = -1;
+    queues[queue_count++] = q;
+    return q;
+}
+
+int outqueue_adopt(int tab_id, int fd, const char *partial, size_t length, size_t offset) {
+    OutQueue *q = outqueue_get(tab_id);
+    OutChunk *chunk = length > 0 ? malloc(sizeof(OutChunk) + length) : NULL;
+    if (!q || (length > 0 && !chunk)) {
+        free(chunk);
+        close(fd);
+        return -1;
+    }
+    if (q->fd >= 0) close(q->fd);
+    q->fd = fd;
+
+    // Finished before anything else, so the tab's stream stays framed
+    if (chunk) {
+        chunk->cls = QUEUE_PAGE;
+        chunk->length = length;
+        chunk->offset = offset;
+        chunk->body = NULL;
+        memcpy(chunk->data, partial, length);
+        chunk->next = q->head;
+        q->head = chunk;
+        if (!q->tail) q->tail = chunk;
+        q->queued_bytes += length - offset;
+    }
+    return 0;
+}
+
+int outqueue_count() {
+    return queue_count;
+}
+
+OutQueue *outqueue_at(int index) {
+    return queues[index];
+}
+
+int outqueue_pending(const OutQueue *q) {
+    return q->head != NULL;
+}
+
+OutBuffer *outbuffer_new(const void *data, size_t length) {
+    OutBuffer *buffer = malloc(sizeof(OutBuffer) + length + 1);
+    if (!buffer) return NULL;
+    buffer->refs = 1;
+    buffer->length = length;
+    memcpy(buffer->data, data, length);
+    buffer->data[length] = '\0';
+    return buffer;
+}
+
+OutBuffer *outbuffer_ref(OutBuffer *buffer) {
+    buffer->refs++;
+    return buffer;
+}
+
+void outbuffer_unref(OutBuffer *buffer) {
+    if (buffer && --buffer->refs == 0) free(buffer);
+}
+
+static void free_chunk(OutChunk *chunk) {
+    outbuffer_unref(chunk->body);
+    free(chunk);
+}
+
+void outqueue_reset(OutQueue *q) {
+    OutChunk *chunk = q->head;
+    while (chunk) {
+        OutChunk *next = chunk->next;
+        free_chunk(chunk);
+        chunk = next;
+    }
+    q->head = q->tail = NULL;
+    q->queued_bytes = 0;
+    q->congested = 0;
+
+    if (q->fd >= 0) {
+        close(q->fd);
+        q->fd = -1;
+    }
+}
+
+// Open the tab's response FIFO without blocking; fails if no tab is reading
+static int outqueue_open(OutQueue *q) {
+    if (q->fd >= 0) return 0;
+
+    char path[INSTANCE_PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s%d", instance_get()->response_prefix, q->tab_id);
+    q->fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (q->fd < 0) {
+        log_warn("[Browser] Cannot open response FIFO of tab %d: %s", q->tab_id, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Unlink chunks matching cls that have not started going out
+static void outqueue_discard_unsent(OutQueue *q, ResponseClass cls, unsigned long *counter) {
+    OutChunk **link = &q->head;
+    q->tail = NULL;
+    while (*link) {
+        OutChunk *chunk = *link;
+        if (chunk->cls == cls && chunk->offset == 0) {
+            *link = chunk->next;
+            q->queued_bytes -= chunk->length;
+            free_chunk(chunk);
+            (*counter)++;
+        } else {
+            q->tail = chunk;
+            link = &chunk->next;
+        }
+    }
+}
+
+int outqueue_take_partial(OutQueue *q, char **partial, size_t *length, size_t *offset) {
+    unsigned long dropped = 0;
+    outqueue_discard_unsent(q, QUEUE_PAGE, &dropped);
+    outqueue_discard_unsent(q, QUEUE_NOTIFY, &dropped);
+    *partial = NULL;
+    *length = *offset = 0;
+
+    OutChunk *chunk = q->head;
+    if (!chunk) return dropped;
+    size_t body_length = chunk->body ? chunk->body->length : 0;
+    size_t inline_length = chunk->length - body_length;
+    *partial = malloc(chunk->length);
+    if (!*partial) return -1;
+    memcpy(*partial, chunk->data, inline_length);
+    if (body_length > 0) memcpy(*partial + inline_length, chunk->body->data, body_length);
+    *length = chunk->length;
+    *offset = chunk->offset;
+    return dropped;
+}
+
+void outqueue_disconnect(OutQueue *q) {
+    outqueue_discard_unsent(q, QUEUE_PAGE, &q->dropped);
+    outqueue_discard_unsent(q, QUEUE_NOTIFY, &q->dropped);
+    q->disconnected = 1;
+    q->congested = 0;
+    if (!q->head && q->fd >= 0) {
+        close(q->fd);
+        q->fd = -1;
+    }
+}
+
+void outqueue_resume(OutQueue *q) {
+    q->disconnected = 0;
+}
+
+// Bytes waiting behind the response at the head of the queue. That one
+// is going out and may be a page larger than the high watermark on its
+// own; only what piles up behind it means the tab is not keeping up.
+static size_t outqueue_backlog(const OutQueue *q) {
+    return q->head ? q->queued_bytes - (q->head->length - q->head->offset) : 0;
+}
+
+// Queue head and body (copied) plus an optional shared body
+static int outqueue_enqueue(OutQueue *q, ResponseClass cls, const void *head, size_t head_length,
+                            const void *body, size_t body_length, OutBuffer *shared) {
+    if (q->disconnected || outqueue_open(q) < 0) {
+        return -1;
+    }
+
+    size_t inline_length = head_length + body_length;
+    size_t length = inline_length + (shared ? shared->length : 0);
+
+    if (q->congested || outqueue_backlog(q) > outqueue_config.high_watermark) {
+        q->congested = 1;
+
+        switch (outqueue_config.policy) {
+            case SLOW_DISCONNECT:
+                log_warn("[Browser] Tab %d is not reading, disconnecting it", q->tab_id);
+                q->disconnects++;
+                outqueue_disconnect(q);
+                return -1;
+
+            case SLOW_COALESCE:
+                if (cls == QUEUE_PAGE) {
+                    outqueue_discard_unsent(q, QUEUE_PAGE, &q->coalesced);
+                }
+                // fall through: stale notifications go as well
+            case SLOW_DROP:
+                outqueue_discard_unsent(q, QUEUE_NOTIFY, &q->dropped);
+                if (cls == QUEUE_NOTIFY) {
+                    q->dropped++;
+                    return -1;
+                }
+                break;
+        }
+    }
+
+    OutChunk *chunk = malloc(sizeof(OutChunk) + inline_length);
+    if (!chunk) return -1;
+    chunk->next = NULL;
+    chunk->cls = cls;
+    chunk->length = length;
+    chunk->offset = 0;
+    chunk->body = shared ? outbuffer_ref(shared) : NULL;
+    memcpy(chunk->data, head, head_length);
+    memcpy(chunk->data + head_length, body, body_length);
+
+    if (q->tail) q->tail->next = chunk;
+    else q->head = chunk;
+    q->tail = chunk;
+    q->queued_bytes += length;
+
+    // Fast path: most responses fit in the FIFO and go out immediately
+    return outqueue_flush(q) < 0 ? -1 : 0;
+}
+
+int outqueue_push(OutQueue *q, ResponseClass cls, const void *head, size_t head_length,
+                  const void *body, size_t body_length) {
+    return outqueue_enqueue(q, cls, head, head_length, body, body_length, NULL);
+}
+
+int outqueue_push_shared(OutQueue *q, ResponseClass cls, const void *head, size_t head_length,
+                         OutBuffer *body) {
+    return outqueue_enqueue(q, cls, head, head_length, NULL, 0, body);
+}
+
+int outqueue_flush(OutQueue *q) {
+    while (q->head) {
+        OutChunk *chunk = q->head;
+        size_t body_length = chunk->body ? chunk->body->length : 0;
+        size_t inline_length = chunk->length - body_length;
+        struct iovec iov[2];
+        int count = 0;
+        if (chunk->offset < inline_length) {
+            iov[count].iov_base = chunk->data + chunk->offset;
+            iov[count].iov_len = inline_length - chunk->offset;
+            count++;
+        }
+        if (body_length > 0) {
+            size_t skip = chunk->offset > inline_length ? chunk->offset - inline_length : 0;
+            iov[count].iov_base = chunk->body->data + skip;
+            iov[count].iov_len = body_length - skip;
+            count++;
+        }
+        ssize_t n = writev(q->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+            // EPIPE: the tab closed its FIFO
+            outqueue_reset(q);
+            return -1;
+        }
+
+        chunk->offset += n;
+        q->queued_bytes -= n;
+        if (chunk->offset == chunk->length) {
+            q->head = chunk->next;
+            if (!q->head) q->tail = NULL;
+            free_chunk(chunk);
+        }
+    }
+
+    if (q->congested && outqueue_backlog(q) <= outqueue_config.low_watermark) {
+        q->congested = 0;
+    }
+    // A disconnected tab's last response is out
+    if (q->disconnected && !q->head && q->fd >= 0) {
+        close(q->fd);
+        q->fd = -1;
+    }
+    return q->head != NULL;
+}
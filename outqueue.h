@@ -0,0 +1,112 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include <stddef.h>
+
+// Bounded, non-blocking per-tab output queues.
+// Responses are appended to the tab's queue and written to its response
+// FIFO only as far as the FIFO accepts; the browser's event loop keeps
+// flushing the rest when the descriptor becomes writable. A slow or
+// frozen tab therefore only fills its own queue.
+
+// What a queued response is, so slow-consumer policies know what is safe to drop
+typedef enum {
+    QUEUE_NOTIFY,    // Short status text ("Bookmarked: ...")
+    QUEUE_PAGE       // A rendered document; a newer one supersedes it
+} ResponseClass;
+
+// What to do once a tab's queue goes over the high watermark
+typedef enum {
+    SLOW_DROP,       // Drop unsent notifications, keep pages
+    SLOW_COALESCE,   // Drop unsent notifications and keep only the newest page
+    SLOW_DISCONNECT  // Stop sending to the tab until it sends a command again
+} SlowConsumerPolicy;
+
+typedef struct {
+    size_t high_watermark;   // Queue becomes congested above this many bytes
+    size_t low_watermark;    // ... and stops being congested below this
+    SlowConsumerPolicy policy;
+} OutQueueConfig;
+
+typedef struct OutChunk OutChunk;
+
+// Immutable, reference-counted response body that can be queued for any
+// number of tabs without copying it
+typedef struct {
+    int refs;
+    size_t length;
+    char data[];                 // NUL-terminated after length bytes
+} OutBuffer;
+
+typedef struct {
+    int tab_id;
+    int fd;                  // Response FIFO, -1 until a response is queued
+    OutChunk *head;
+    OutChunk *tail;
+    size_t queued_bytes;
+    int congested;
+    int disconnected;        // Refuses responses until the tab sends a command
+    unsigned long dropped;
+    unsigned long coalesced;
+    unsigned long disconnects;
+} OutQueue;
+
+extern OutQueueConfig outqueue_config;
+
+// Parse "drop", "coalesce" or "disconnect"; returns -1 if unknown
+int outqueue_parse_policy(const char *name, SlowConsumerPolicy *policy);
+const char *outqueue_policy_name(SlowConsumerPolicy policy);
+
+// Find the queue for a tab, creating it on first use
+OutQueue *outqueue_get(int tab_id);
+
+// Give a tab's queue a response FIFO that is already open, e.g. one
+// handed over by the previous browser process, with the response that
+// process was in the middle of writing (length bytes of which offset
+// are written; length 0 if none) queued first. Closes fd on failure.
+int outqueue_adopt(int tab_id, int fd, const char *partial, size_t length, size_t offset);
+
+// Hot restart, old process: drop the responses that have not started
+// going out and return a copy of the one partly written, if any, in
+// *partial (malloc'd; NULL if none) with how much of it is written.
+// Returns the number of responses dropped, or -1 on OOM.
+int outqueue_take_partial(OutQueue *q, char **partial, size_t *length, size_t *offset);
+
+// Visit every queue, e.g. to build the poll() set
+int outqueue_count();
+OutQueue *outqueue_at(int index);
+
+// Queue a response made of a header and a body and try to write it
+// straight away. Never blocks. Returns 0 if queued or sent, -1 if it
+// was dropped.
+int outqueue_push(OutQueue *q, ResponseClass cls, const void *head, size_t head_length,
+                  const void *body, size_t body_length);
+
+// Same, with a shared body; the queue holds a reference until it is sent
+int outqueue_push_shared(OutQueue *q, ResponseClass cls, const void *head, size_t head_length,
+                         OutBuffer *body);
+
+// A new buffer holding a copy of data, with one reference. NULL on OOM.
+OutBuffer *outbuffer_new(const void *data, size_t length);
+OutBuffer *outbuffer_ref(OutBuffer *buffer);
+void outbuffer_unref(OutBuffer *buffer);
+
+// Write as much as the FIFO accepts. Returns 1 if data is still pending,
+// 0 if the queue is empty, -1 if the tab went away and the queue was reset.
+int outqueue_flush(OutQueue *q);
+
+// Discard everything queued for the tab and close its FIFO
+void outqueue_reset(OutQueue *q);
+
+// Disconnect a tab that is not reading: discard the responses that have
+// not started going out and refuse new ones until outqueue_resume(). A
+// response partly written is still finished, so the tab's stream stays
+// framed. Then the FIFO is closed.
+void outqueue_disconnect(OutQueue *q);
+
+// The tab sent a command, so it is reading again
+void outqueue_resume(OutQueue *q);
+
+int outqueue_pending(const OutQueue *q);
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "outqueue.h"
+#include "instance.h"
+
+// Checks that a page larger than the high watermark, followed by a
+// status reply, reaches a tab that reads normally intact under every
+// slow-consumer policy: nothing dropped, coalesced or disconnected.
+// Then that a tab which stops reading halfway through that page and gets
+// disconnected still receives the whole page, and after it sends a
+// command again the status reply, with nothing in between.
+
+#define TEST_TAB 7
+#define TEST_PAGE_BYTES (1024 * 1024)
+#define TEST_STATUS "[Browser] Status: ok"
+
+static char fifo_path[INSTANCE_PATH_MAX + 16];
+
+static void fill_page(char *page, size_t length) {
+    for (size_t i = 0; i < length; i++) page[i] = 'a' + (i * 7 + i / 4096) % 26;
+}
+
+// Reader: read everything until EOF, a little at a time, and compare.
+// With go_fd, only starts reading once the test writes to it.
+static int run_reader(int ready_fd, int go_fd, const char *expected, size_t expected_length) {
+    // Not blocking in open(), which would wait for the writer
+    int fd = open(fifo_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0 || fcntl(fd, F_SETFL, 0) < 0) {
+        perror("open fifo");
+        return 1;
+    }
+    if (write(ready_fd, "r", 1) != 1) return 1;
+    close(ready_fd);
+    char c;
+    if (go_fd >= 0 && read(go_fd, &c, 1) != 1) return 1;
+
+    char *got = malloc(expected_length + 4096);
+    size_t length = 0;
+    int idle = 0;
+    for (;;) {
+        ssize_t n = read(fd, got + length, 4096);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        // EOF between a disconnect and the FIFO being opened again
+        if (n == 0) {
+            if (length >= expected_length || ++idle > 5000) break;
+            usleep(1000);
+            continue;
+        }
+        length += n;
+        if (length > expected_length) break;
+        usleep(50);
+    }
+    close(fd);
+
+    int ok = length == expected_length && memcmp(got, expected, length) == 0;
+    if (!ok) fprintf(stderr, "[OutQueueTest] Reader got %zu bytes, expected %zu\n", length, expected_length);
+    free(got);
+    return ok ? 0 : 1;
+}
+
+static const char head[] = "PAGE";
+static char *expected;
+static size_t expected_length;
+
+// The page frame followed by the status reply
+static void build_expected() {
+    size_t page_length = TEST_PAGE_BYTES;
+    expected_length = sizeof(head) + page_length + strlen(TEST_STATUS);
+    expected = malloc(expected_length);
+    memcpy(expected, head, sizeof(head));
+    fill_page(expected + sizeof(head), page_length);
+    memcpy(expected + sizeof(head) + page_length, TEST_STATUS, strlen(TEST_STATUS));
+}
+
+// Make the FIFO and fork a reader that has it open. Returns its pid or -1.
+static pid_t start_reader(int go_fd) {
+    unlink(fifo_path);
+    if (mkfifo(fifo_path, 0666) < 0) {
+        perror("mkfifo");
+        return -1;
+    }
+
+    int ready[2];
+    if (pipe(ready) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        close(ready[0]);
+        _exit(run_reader(ready[1], go_fd, expected, expected_length));
+    }
+    close(ready[1]);
+    char c;
+    if (read(ready[0], &c, 1) != 1) {
+        fprintf(stderr, "[OutQueueTest] Reader did not start\n");
+        close(ready[0]);
+        return -1;
+    }
+    close(ready[0]);
+    return pid;
+}
+
+// Flush the way the event loop does, until everything is written
+static int flush_all(OutQueue *q) {
+    while (outqueue_pending(q)) {
+        struct pollfd pfd = { q->fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, 5000) <= 0 || outqueue_flush(q) < 0) {
+            fprintf(stderr, "[OutQueueTest] Flush failed\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Wait for the reader; failed if it did not get exactly what was expected
+static int finish_reader(pid_t pid, int failed) {
+    int status;
+    if (failed) kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    unlink(fifo_path);
+    return failed;
+}
+
+static int run_policy(SlowConsumerPolicy policy) {
+    outqueue_config.policy = policy;
+    size_t page_length = TEST_PAGE_BYTES;
+
+    pid_t pid = start_reader(-1);
+    if (pid < 0) return 1;
+
+    int failed = 0;
+    OutQueue *q = outqueue_get(TEST_TAB);
+    q->dropped = q->coalesced = q->disconnects = 0;
+    if (outqueue_push(q, QUEUE_PAGE, head, sizeof(head), expected + sizeof(head), page_length) < 0 ||
+        outqueue_push(q, QUEUE_NOTIFY, TEST_STATUS, strlen(TEST_STATUS), NULL, 0) < 0) {
+        fprintf(stderr, "[OutQueueTest] Push refused\n");
+        failed = 1;
+    }
+
+    if (!failed && flush_all(q) < 0) failed = 1;
+    if (q->dropped || q->coalesced || q->disconnects) {
+        fprintf(stderr, "[OutQueueTest] %lu dropped, %lu coalesced, %lu disconnects\n",
+                q->dropped, q->coalesced, q->disconnects);
+        failed = 1;
+    }
+    outqueue_reset(q);
+
+    failed = finish_reader(pid, failed);
+    printf("[OutQueueTest] Policy %-10s %s\n", outqueue_policy_name(policy), failed ? "FAILED" : "ok");
+    return failed;
+}
+
+// The tab stops reading with the first page only partly written to its
+// FIFO, and a second page makes it congested
+static int run_disconnect() {
+    outqueue_config.policy = SLOW_DISCONNECT;
+    size_t page_length = TEST_PAGE_BYTES;
+
+    int go[2];
+    if (pipe(go) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    pid_t pid = start_reader(go[0]);
+    close(go[0]);
+    if (pid < 0) return 1;
+
+    int failed = 0;
+    OutQueue *q = outqueue_get(TEST_TAB);
+    q->dropped = q->coalesced = q->disconnects = 0;
+    const char *page = expected + sizeof(head);
+    if (outqueue_push(q, QUEUE_PAGE, head, sizeof(head), page, page_length) < 0 ||
+        outqueue_push(q, QUEUE_PAGE, head, sizeof(head), page, page_length) < 0) {
+        fprintf(stderr, "[OutQueueTest] Push refused before congestion\n");
+        failed = 1;
+    }
+    // Congested: this disconnects the tab, and while it is disconnected
+    // nothing else is taken
+    if (!failed && (outqueue_push(q, QUEUE_PAGE, head, sizeof(head), page, page_length) == 0 ||
+                    outqueue_push(q, QUEUE_NOTIFY, TEST_STATUS, strlen(TEST_STATUS), NULL, 0) == 0 ||
+                    q->disconnects != 1 || !q->disconnected)) {
+        fprintf(stderr, "[OutQueueTest] Congested tab was not disconnected\n");
+        failed = 1;
+    }
+
+    // The tab reads again: the first page is finished, then the FIFO closed
+    if (write(go[1], "g", 1) != 1) failed = 1;
+    close(go[1]);
+    if (!failed && (flush_all(q) < 0 || q->fd >= 0)) {
+        fprintf(stderr, "[OutQueueTest] Partly written page was not finished\n");
+        failed = 1;
+    }
+
+    // ... and sends a command, so responses go to it again
+    outqueue_resume(q);
+    if (!failed && (outqueue_push(q, QUEUE_NOTIFY, TEST_STATUS, strlen(TEST_STATUS), NULL, 0) < 0 ||
+                    flush_all(q) < 0)) {
+        fprintf(stderr, "[OutQueueTest] Push refused after the tab came back\n");
+        failed = 1;
+    }
+    outqueue_reset(q);
+
+    failed = finish_reader(pid, failed);
+    printf("[OutQueueTest] Disconnect mid-page %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    if (instance_select("outqueue-test") < 0) return 1;
+    snprintf(fifo_path, sizeof(fifo_path), "%s%d", instance_get()->response_prefix, TEST_TAB);
+
+    build_expected();
+    int failed = 0;
+    failed |= run_policy(SLOW_DROP);
+    failed |= run_policy(SLOW_COALESCE);
+    failed |= run_policy(SLOW_DISCONNECT);
+    failed |= run_disconnect();
+    free(expected);
+    return failed;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "common.h"
+#include "prefetch.h"
+#include "catalog.h"
+
+PrefetchStats prefetch_stats;
+
+// Newest candidates are the likeliest next pages, so the queue is a stack
+static char queue[PREFETCH_QUEUE_MAX][MAX_MSG];
+static int queue_count = 0;
+
+void prefetch_push(const char *html_file) {
+    if (strlen(html_file) >= MAX_MSG) return;
+
+    for (int i = 0; i < queue_count; i++) {
+        if (strcmp(queue[i], html_file) == 0) {
+            // Already queued: move it to the top
+            memmove(queue[i], queue[i + 1], (queue_count - i - 1) * MAX_MSG);
+            queue_count--;
+            break;
+        }
+    }
+
+    if (queue_count == PREFETCH_QUEUE_MAX) {
+        memmove(queue[0], queue[1], (PREFETCH_QUEUE_MAX - 1) * MAX_MSG);
+        queue_count--;
+        prefetch_stats.dropped++;
+    }
+
+    strcpy(queue[queue_count++], html_file);
+    prefetch_stats.queued++;
+}
+
+int prefetch_pop(char *html_file, size_t size) {
+    if (queue_count == 0) return 0;
+    snprintf(html_file, size, "%s", queue[--queue_count]);
+    return 1;
+}
+
+int prefetch_pending() {
+    return queue_count;
+}
+
+int prefetch_link_file(const char *href, char *html_file, size_t size) {
+    if (href[0] == '\0' || href[0] == '#' || strstr(href, "://") || strncmp(href, "mailto:", 7) == 0) {
+        return -1;
+    }
+
+    // Same naming as CMD_LOAD: last path component without its extension
+    const char *name = strrchr(href, '/');
+    name = name ? name + 1 : href;
+
+    char page[MAX_MSG];
+    snprintf(page, sizeof(page), "%s", name);
+    page[strcspn(page, "#?")] = '\0';
+    char *dot = strrchr(page, '.');
+    if (dot) *dot = '\0';
+    if (page[0] == '\0') return -1;
+
+    snprintf(html_file, size, "%s.html", page);
+    return catalog_exists(html_file) ? 0 : -1;
+}
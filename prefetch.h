@@ -0,0 +1,38 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+
+// Idle-time prefetcher queue.
+// After a tab shows a page, its likely next pages (history neighbours
+// and links on the page) are queued here. The browser's event loop
+// renders them into the render cache only while no foreground command
+// is waiting, with at most a configured number of workers at once.
+
+#define PREFETCH_QUEUE_MAX 32
+#define PREFETCH_LINKS_PER_PAGE 8
+#define PREFETCH_DEFAULT_WORKERS 1
+
+typedef struct {
+    unsigned long queued;
+    unsigned long started;
+    unsigned long dropped;       // Pushed out of a full queue
+} PrefetchStats;
+
+extern PrefetchStats prefetch_stats;
+
+// Queue a page (an HTML file name); duplicates are ignored and the
+// oldest candidate makes room when the queue is full
+void prefetch_push(const char *html_file);
+
+// Take the most recently queued candidate. Returns 0 if none.
+int prefetch_pop(char *html_file, size_t size);
+
+int prefetch_pending();
+
+// Map an href from a page to a local HTML file the way CMD_LOAD names
+// pages ("docs/intro.html" -> "intro.html"). Returns -1 for external
+// links, fragments and pages that do not exist.
+int prefetch_link_file(const char *href, char *html_file, size_t size);
+
+#endif
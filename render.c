@@ -0,0 +1,479 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/seccomp.h>
+#include "common.h"
+#include "html2text.h"
+#include "render.h"
+#include "log.h"
+#include "catalog.h"
+
+typedef enum {
+    SLOT_OK,
+    SLOT_TRUNCATED,
+    SLOT_CANCELLED
+} SlotStatus;
+
+// Shared between the browser and one worker
+typedef struct {
+    volatile int cancel;         // Set by the browser to stop the current render
+    SlotStatus status;
+    size_t in_len;
+    size_t out_len;
+    int link_count;
+    unsigned int generation;     // Content hash of out, never 0
+    char in[RENDER_INPUT_MAX];
+    char out[RENDER_OUTPUT_MAX + 1];
+    char links[RENDER_LINKS_MAX];
+} RenderSlot;
+
+typedef struct {
+    pid_t pid;
+    int bell_fd;                 // Browser -> worker doorbell (write end)
+    int done_fd;                 // Worker -> browser doorbell (read end)
+    RenderSlot *slot;
+    int busy;
+    int tab_id;                  // Tab waiting for the result, -1 if abandoned
+    int prefetch;                // Rendering for the cache only
+    char html_file[MAX_MSG];
+    int renders;
+    struct timespec deadline;
+} RenderWorker;
+
+RenderStats render_stats;
+
+static RenderConfig config;
+static RenderWorker workers[RENDER_MAX_WORKERS];
+static int worker_count = 0;
+
+// FNV-1a of the rendered text. Tabs compare it to decide whether the
+// copy they cached is still current, so it only has to change when the
+// text does.
+static unsigned int text_generation(const char *text, size_t length) {
+    uint32_t hash = hash_bytes(text, length);
+    return hash ? hash : 1;
+}
+
+// Worker side: wait for a doorbell, render the slot, ring back. Runs
+// under seccomp strict mode, so only read(), write() and exit() work;
+// html_to_text() does not allocate.
+static void worker_loop(RenderSlot *slot) {
+    for (;;) {
+        char bell;
+        if (read(STDIN_FILENO, &bell, 1) != 1) break;
+
+        int truncated = 0;
+        size_t n = html_to_text(slot->in, slot->in_len, slot->out, sizeof(slot->out),
+                                &slot->cancel, &truncated);
+        if (n == HTML2TEXT_CANCELLED) {
+            slot->status = SLOT_CANCELLED;
+            slot->out_len = 0;
+        } else {
+            slot->status = truncated ? SLOT_TRUNCATED : SLOT_OK;
+            slot->out_len = n;
+            slot->generation = text_generation(slot->out, n);
+            slot->link_count = html_extract_links(slot->in, slot->in_len,
+                                                  slot->links, sizeof(slot->links));
+        }
+
+        if (write(STDOUT_FILENO, &bell, 1) != 1) break;
+    }
+
+    // exit_group() is not allowed in strict mode, plain exit() is
+    syscall(SYS_exit, 0);
+}
+
+static void worker_main(RenderWorker *self, int bell_fd, int done_fd) {
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    // Keep only the two doorbells (as stdin/stdout) and our own slot
+    int bell = fcntl(bell_fd, F_DUPFD, 10);
+    int done = fcntl(done_fd, F_DUPFD, 10);
+    if (bell < 0 || done < 0) _exit(1);
+    dup2(bell, STDIN_FILENO);
+    dup2(done, STDOUT_FILENO);
+    close_range(STDERR_FILENO, ~0U, 0);
+
+    for (int i = 0; i < worker_count; i++) {
+        if (&workers[i] != self && workers[i].slot) {
+            munmap(workers[i].slot, sizeof(RenderSlot));
+        }
+    }
+
+    if (config.child_setup) config.child_setup();
+
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_STRICT) < 0) _exit(1);
+    worker_loop(self->slot);
+}
+
+static int spawn_worker(RenderWorker *w) {
+    int bell[2], done[2];
+    if (pipe2(bell, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    if (pipe2(done, O_CLOEXEC) < 0) {
+        perror("pipe");
+        close(bell[0]);
+        close(bell[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(bell[0]);
+        close(bell[1]);
+        close(done[0]);
+        close(done[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        worker_main(w, bell[0], done[1]);
+    }
+
+    close(bell[0]);
+    close(done[1]);
+    fcntl(done[0], F_SETFL, O_NONBLOCK);
+
+    w->pid = pid;
+    w->bell_fd = bell[1];
+    w->done_fd = done[0];
+    w->busy = 0;
+    w->tab_id = -1;
+    w->renders = 0;
+    return 0;
+}
+
+static void stop_worker(RenderWorker *w) {
+    if (w->pid <= 0) return;
+    kill(w->pid, SIGKILL);
+    close(w->bell_fd);
+    close(w->done_fd);
+    while (waitpid(w->pid, NULL, 0) < 0 && errno == EINTR);
+    w->pid = -1;
+    w->bell_fd = w->done_fd = -1;
+    w->busy = 0;
+}
+
+// Kill a worker and start a fresh one in its slot
+static void replace_worker(RenderWorker *w) {
+    stop_worker(w);
+    if (spawn_worker(w) < 0) {
+        log_error("[Browser] Failed to restart renderer, pool shrinks");
+    }
+}
+
+int render_init(const RenderConfig *cfg) {
+    config = *cfg;
+    if (config.workers < 1) config.workers = 1;
+    if (config.workers > RENDER_MAX_WORKERS) config.workers = RENDER_MAX_WORKERS;
+
+    for (int i = 0; i < config.workers; i++) {
+        // Pages are only touched as they are used, so idle slots stay cheap
+        RenderSlot *slot = mmap(NULL, sizeof(RenderSlot), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (slot == MAP_FAILED) {
+            perror("mmap");
+            break;
+        }
+        workers[worker_count].slot = slot;
+        workers[worker_count].pid = -1;
+        worker_count++;
+    }
+
+    int started = 0;
+    for (int i = 0; i < worker_count; i++) {
+        if (spawn_worker(&workers[i]) == 0) started++;
+    }
+    return started > 0 ? 0 : -1;
+}
+
+void render_shutdown() {
+    for (int i = 0; i < worker_count; i++) {
+        stop_worker(&workers[i]);
+        munmap(workers[i].slot, sizeof(RenderSlot));
+    }
+    worker_count = 0;
+}
+
+static RenderWorker *idle_worker() {
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].pid > 0 && !workers[i].busy) return &workers[i];
+    }
+    return NULL;
+}
+
+int render_available() {
+    return idle_worker() != NULL;
+}
+
+// Copy the page into the worker's slot; returns an error message or NULL
+static const char *load_page(RenderSlot *slot, const char *html_file) {
+    // A mapped page is copied without a system call
+    const CatalogPage *page = catalog_lookup(html_file);
+    if (catalog_active() && !page) return "[Browser] Error: Page not found.";
+    if (page && page->size > RENDER_INPUT_MAX) return "[Browser] Error: Page too large to render.";
+    if (page && page->data && catalog_copy(page, slot->in) == 0) {
+        slot->in_len = page->size;
+        return NULL;
+    }
+    
+    int fd = open(html_file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return "[Browser] Error: Page not found.";
+
+    size_t length = 0;
+    for (;;) {
+        ssize_t n = read(fd, slot->in + length, RENDER_INPUT_MAX - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            close(fd);
+            return "[Browser] Error: Cannot read page.";
+        }
+        if (n == 0) break;
+        length += n;
+        if (length == RENDER_INPUT_MAX) {
+            char probe;
+            if (read(fd, &probe, 1) > 0) {
+                close(fd);
+                return "[Browser] Error: Page too large to render.";
+            }
+            break;
+        }
+    }
+    close(fd);
+
+    slot->in_len = length;
+    return NULL;
+}
+
+// Report a failure to the tab (if any) that was waiting for html_file
+static void fail(int tab_id, const char *html_file, int prefetch, const char *error) {
+    RenderResult result = {
+        .tab_id = tab_id,
+        .html_file = html_file,
+        .text = error,
+        .ok = 0,
+        .prefetch = prefetch
+    };
+    config.on_done(&result);
+}
+
+// Hand a page to an idle worker; tab_id is -1 for prefetches
+static int start_job(RenderWorker *w, int tab_id, const char *html_file, int prefetch) {
+    const char *error = load_page(w->slot, html_file);
+    if (error) {
+        render_stats.failed++;
+        fail(tab_id, html_file, prefetch, error);
+        return -1;
+    }
+
+    w->slot->cancel = 0;
+    char bell = 1;
+    if (write(w->bell_fd, &bell, 1) != 1) {
+        render_stats.crashed++;
+        replace_worker(w);
+        fail(tab_id, html_file, prefetch, "[Browser] Error: Renderer crashed.");
+        return -1;
+    }
+
+    w->busy = 1;
+    w->tab_id = tab_id;
+    w->prefetch = prefetch;
+    snprintf(w->html_file, sizeof(w->html_file), "%s", html_file);
+    clock_gettime(CLOCK_MONOTONIC, &w->deadline);
+    w->deadline.tv_sec += config.timeout_ms / 1000;
+    w->deadline.tv_nsec += (config.timeout_ms % 1000) * 1000000L;
+    if (w->deadline.tv_nsec >= 1000000000L) {
+        w->deadline.tv_sec++;
+        w->deadline.tv_nsec -= 1000000000L;
+    }
+
+    render_stats.started++;
+    return 0;
+}
+
+int render_start(int tab_id, const char *html_file) {
+    render_cancel(tab_id);
+
+    RenderWorker *w = idle_worker();
+    if (!w) {
+        fail(tab_id, html_file, 0, "[Browser] Error: Too many renders in progress.");
+        return -1;
+    }
+    return start_job(w, tab_id, html_file, 0);
+}
+
+int render_prefetch(const char *html_file) {
+    RenderWorker *w = idle_worker();
+    if (!w) return -1;
+    return start_job(w, -1, html_file, 1);
+}
+
+void render_preempt() {
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].busy && workers[i].prefetch) {
+            workers[i].slot->cancel = 1;
+        }
+    }
+}
+
+int render_adopt(int tab_id, const char *html_file) {
+    for (int i = 0; i < worker_count; i++) {
+        RenderWorker *w = &workers[i];
+        if (w->busy && w->prefetch && !w->slot->cancel && strcmp(w->html_file, html_file) == 0) {
+            w->prefetch = 0;
+            w->tab_id = tab_id;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int render_in_flight(const char *html_file) {
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].busy && strcmp(workers[i].html_file, html_file) == 0) return 1;
+    }
+    return 0;
+}
+
+int render_prefetching() {
+    int count = 0;
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].busy && workers[i].prefetch) count++;
+    }
+    return count;
+}
+
+void render_cancel(int tab_id) {
+    for (int i = 0; i < worker_count; i++) {
+        RenderWorker *w = &workers[i];
+        if (w->busy && w->tab_id == tab_id) {
+            // The worker notices between chunks and rings back early
+            w->slot->cancel = 1;
+            w->tab_id = -1;
+            render_stats.superseded++;
+        }
+    }
+}
+
+int render_fd_count() {
+    return worker_count;
+}
+
+int render_fd_at(int index) {
+    return workers[index].done_fd;
+}
+
+void render_handle(int fd) {
+    RenderWorker *w = NULL;
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].pid > 0 && workers[i].done_fd == fd) {
+            w = &workers[i];
+            break;
+        }
+    }
+    if (!w) return;
+
+    char bell;
+    ssize_t n = read(w->done_fd, &bell, 1);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+
+    int was_busy = w->busy;
+    int tab_id = w->tab_id;
+    if (n != 1) {
+        // Hang-up: the worker died, most likely killed by the sandbox
+        log_warn("[Browser] Renderer %d crashed, restarting it", w->pid);
+        render_stats.crashed++;
+        replace_worker(w);
+        if (was_busy && tab_id >= 0) {
+            fail(tab_id, w->html_file, 0, "[Browser] Error: Renderer crashed.");
+        }
+        return;
+    }
+
+    w->busy = 0;
+    w->tab_id = -1;
+    w->renders++;
+
+    // Superseded renders that finished anyway still feed the cache
+    if (w->slot->status != SLOT_CANCELLED) {
+        RenderResult result = {
+            .tab_id = tab_id,
+            .html_file = w->html_file,
+            .text = w->slot->out,
+            .links = w->slot->links,
+            .links_size = sizeof(w->slot->links),
+            .generation = w->slot->generation,
+            .ok = 1,
+            .prefetch = w->prefetch
+        };
+        if (tab_id >= 0) render_stats.completed++;
+        config.on_done(&result);
+    }
+
+    if (w->renders >= config.recycle_after) {
+        render_stats.recycled++;
+        replace_worker(w);
+    }
+}
+
+static long remaining_ms(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+}
+
+int render_next_timeout() {
+    long nearest = -1;
+    for (int i = 0; i < worker_count; i++) {
+        if (!workers[i].busy) continue;
+        long left = remaining_ms(&workers[i].deadline);
+        if (left < 0) left = 0;
+        if (nearest < 0 || left < nearest) nearest = left;
+    }
+    return (int)nearest;
+}
+
+void render_expire() {
+    for (int i = 0; i < worker_count; i++) {
+        RenderWorker *w = &workers[i];
+        if (!w->busy || remaining_ms(&w->deadline) > 0) continue;
+
+        int tab_id = w->tab_id;
+        render_stats.timed_out++;
+        replace_worker(w);
+        if (tab_id >= 0) {
+            log_warn("[Browser] Render for tab %d timed out", tab_id);
+            fail(tab_id, w->html_file, 0, "[Browser] Error: Render timed out.");
+        }
+    }
+}
+
+int render_busy_count() {
+    int busy = 0;
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].busy) busy++;
+    }
+    return busy;
+}
+
+int render_worker_count() {
+    int alive = 0;
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].pid > 0) alive++;
+    }
+    return alive;
+}
@@ -0,0 +1,114 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <sys/types.h>
+#include <time.h>
+
+// Pre-forked, sandboxed renderer pool.
+// Each worker is a long-lived child process that converts HTML to text
+// in-process (html2text.c) under seccomp strict mode, so it can only
+// read, write and exit. The browser copies the page into the worker's
+// shared-memory slot and rings a one-byte doorbell on a pipe; the worker
+// renders into the same slot and rings back. The browser's event loop
+// polls the doorbells.
+//
+// A tab has at most one render in flight: starting a new one supersedes
+// the old (the worker is told to stop and its result is discarded), and
+// a render that passes its deadline has its worker killed and replaced.
+// Workers are also replaced after a number of renders or if they crash.
+
+#define RENDER_MAX_WORKERS 32
+#define RENDER_DEFAULT_TIMEOUT_MS 5000
+#define RENDER_DEFAULT_RECYCLE 500       // Renders before a worker is replaced
+#define RENDER_INPUT_MAX (1024 * 1024)   // Largest page accepted
+#define RENDER_OUTPUT_MAX (1024 * 1024)  // Longer text is cut off
+#define RENDER_LINKS_MAX 4096            // Room for hrefs found on the page
+
+typedef struct {
+    int tab_id;                  // -1 for prefetches and superseded renders
+    const char *html_file;
+    const char *text;            // The document, or an error message if !ok
+    const char *links;           // NUL-separated hrefs (only if ok)
+    size_t links_size;
+    unsigned int generation;     // Content version of text (only if ok)
+    int ok;
+    int prefetch;
+} RenderResult;
+
+// Receives every finished render; pointers are only valid during the call
+typedef void (*RenderDoneCallback)(const RenderResult *result);
+
+// Run in each worker after fork, before the sandbox is entered, to drop
+// anything inherited from the browser (e.g. shared memory attachments)
+typedef void (*RenderChildSetup)(void);
+
+typedef struct {
+    int workers;
+    int recycle_after;
+    int timeout_ms;
+    RenderDoneCallback on_done;
+    RenderChildSetup child_setup;
+} RenderConfig;
+
+typedef struct {
+    unsigned long started;
+    unsigned long completed;
+    unsigned long superseded;
+    unsigned long timed_out;
+    unsigned long failed;
+    unsigned long crashed;
+    unsigned long recycled;
+} RenderStats;
+
+extern RenderStats render_stats;
+
+// Create the pool. Returns -1 if no worker could be started.
+int render_init(const RenderConfig *config);
+
+// Stop every worker, e.g. on shutdown
+void render_shutdown();
+
+// Whether a worker is idle, i.e. render_start() would not have to refuse
+int render_available();
+
+// Start rendering html_file for a tab, cancelling its previous render.
+// Returns -1 (after reporting the error to the tab) if it cannot start.
+int render_start(int tab_id, const char *html_file);
+
+// Abandon a tab's in-flight render, if any, without answering it.
+// If it still completes, the result is delivered with tab_id -1.
+void render_cancel(int tab_id);
+
+// Render a page in the background for the cache. Returns -1 if no
+// worker is idle or the page cannot be read.
+int render_prefetch(const char *html_file);
+
+// Ask every prefetching worker to stop so foreground renders get them
+void render_preempt();
+
+// Hand an in-flight prefetch of html_file over to a tab. Returns 1 if
+// there was one, so the tab does not need a render of its own.
+int render_adopt(int tab_id, const char *html_file);
+
+// Whether html_file is being rendered right now
+int render_in_flight(const char *html_file);
+
+int render_prefetching();
+
+// Doorbell descriptors to watch for POLLIN, one per worker
+int render_fd_count();
+int render_fd_at(int index);
+
+// Handle a doorbell (or hang-up) on one of those descriptors
+void render_handle(int fd);
+
+// Milliseconds until the nearest deadline, or -1 with nothing running
+int render_next_timeout();
+
+// Replace workers whose render is past its deadline and answer the tab
+void render_expire();
+
+int render_busy_count();
+int render_worker_count();
+
+#endif
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "common.h"
+#include "tabclient.h"
+#include "trace.h"
+#include "instance.h"
+
+// Replays a command trace recorded with ./browser -t against a running
+// ./browser through libtabclient, and reports response latency per
+// command type next to the latency recorded in the trace. The recorded
+// latency is measured inside the browser, from reading the command to
+// queueing its response, so it leaves out both FIFO transfers.
+//
+// By default commands are sent at their recorded times; -s scales the
+// pace. With -s 0 every tab sends its next command as soon as the
+// previous one is answered, so the order within each tab is kept but
+// tabs are no longer interleaved as recorded.
+
+#define REPLAY_TIMEOUT_MS 5000
+#define REPLAY_MAX_OUTSTANDING 256   // Unanswered commands tracked per tab
+
+typedef struct {
+    uint64_t offset_ns;
+    int tab;                         // Index in tabs
+    int cmd_type;
+    char *command;
+    long long recorded_us;           // -1 if the trace has no response
+} ReplayCommand;
+
+typedef struct {
+    int recorded_id;
+    TabClient *client;
+    int next;                        // Its next command, -s 0 only
+    int outstanding[REPLAY_MAX_OUTSTANDING];  // Commands sent, oldest first
+    long long sent_at[REPLAY_MAX_OUTSTANDING];
+    int head;
+    int count;
+} ReplayTab;
+
+typedef struct {
+    long long *samples;
+    int count;
+    int capacity;
+    int unanswered;
+} ReplayStats;
+
+static const char *command_names[CMD_COUNT] = {
+    "load", "reload", "back", "forward", "bookmark", "bookmarks", "open", "delete",
+    "history", "sync on", "sync off", "broadcast", "status", "crash", "unknown",
+    "follow", "unfollow", "subscribe", "unsubscribe", "find"
+};
+
+static ReplayCommand *commands = NULL;
+static int num_commands = 0;
+static ReplayTab *tabs = NULL;
+static int num_tabs = 0;
+static ReplayStats stats[CMD_COUNT];
+static ReplayStats recorded[CMD_COUNT];
+static double speed = 1.0;
+static int base_tab_id = 0;
+
+static void stats_add(ReplayStats *s, long long sample) {
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 1024;
+        s->samples = realloc(s->samples, s->capacity * sizeof(long long));
+        if (!s->samples) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->samples[s->count++] = sample;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile over sorted samples
+static double percentile(const ReplayStats *s, double p) {
+    if (s->count == 0) return 0.0;
+    int rank = (int)(p * s->count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > s->count) rank = s->count;
+    return (double)s->samples[rank - 1];
+}
+
+static int find_tab(int recorded_id) {
+    for (int i = 0; i < num_tabs; i++) {
+        if (tabs[i].recorded_id == recorded_id) return i;
+    }
+    ReplayTab *grown = realloc(tabs, (num_tabs + 1) * sizeof(ReplayTab));
+    if (!grown) return -1;
+    tabs = grown;
+    memset(&tabs[num_tabs], 0, sizeof(ReplayTab));
+    tabs[num_tabs].recorded_id = recorded_id;
+    return num_tabs++;
+}
+
+// Read a trace into commands and tabs. Returns -1 if it is not a trace.
+static int load_trace(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror("fopen");
+        return -1;
+    }
+
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION) {
+        fprintf(stderr, "[Replay] %s is not a command trace\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    int capacity = 0;
+    TraceRecord record;
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        if (record.type == TRACE_RESPONSE) {
+            // Commands are numbered in the order they are stored
+            if (record.seq >= 1 && record.seq <= (uint32_t)num_commands) {
+                commands[record.seq - 1].recorded_us = record.latency_us;
+            }
+            continue;
+        }
+        if (record.type != TRACE_COMMAND || record.command_length >= MAX_MSG) break;
+
+        char command[MAX_MSG];
+        if (fread(command, 1, record.command_length, fp) != record.command_length) break;
+        command[record.command_length] = '\0';
+
+        if (num_commands == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            commands = realloc(commands, capacity * sizeof(ReplayCommand));
+            if (!commands) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        ReplayCommand *c = &commands[num_commands];
+        c->offset_ns = record.offset_ns;
+        c->tab = find_tab(record.tab_id);
+        c->cmd_type = record.cmd_type >= 0 && record.cmd_type < CMD_COUNT ? record.cmd_type
+                                                                           : CMD_UNKNOWN;
+        c->command = strdup(command);
+        c->recorded_us = -1;
+        if (c->tab < 0 || !c->command) {
+            perror("malloc");
+            exit(1);
+        }
+        num_commands++;
+    }
+    fclose(fp);
+
+    for (int i = 0; i < num_commands; i++) {
+        if (commands[i].recorded_us >= 0) {
+            stats_add(&recorded[commands[i].cmd_type], commands[i].recorded_us);
+        }
+    }
+    return 0;
+}
+
+// The oldest unanswered command of a tab is considered lost
+static void drop_oldest(ReplayTab *tab) {
+    stats[commands[tab->outstanding[tab->head]].cmd_type].unanswered++;
+    tab->head = (tab->head + 1) % REPLAY_MAX_OUTSTANDING;
+    tab->count--;
+}
+
+static int send_command(int index) {
+    ReplayCommand *c = &commands[index];
+    ReplayTab *tab = &tabs[c->tab];
+
+    if (tab->count == REPLAY_MAX_OUTSTANDING) drop_oldest(tab);
+    int slot = (tab->head + tab->count) % REPLAY_MAX_OUTSTANDING;
+    tab->outstanding[slot] = index;
+    tab->sent_at[slot] = monotonic_ns();
+    tab->count++;
+
+    if (tab_client_send(tab->client, c->command) < 0) {
+        perror("write to browser");
+        return -1;
+    }
+    return 0;
+}
+
+// Responses are matched to commands in order. A response with nothing
+// outstanding (a page shown to a follower, say) is not a round trip.
+static void on_replay_response(TabClient *client, const TabResponse *response, void *user_data) {
+    ReplayTab *tab = user_data;
+    if (response->from_cache || tab->count == 0) return;
+
+    long long latency_us = (monotonic_ns() - tab->sent_at[tab->head]) / 1000;
+    stats_add(&stats[commands[tab->outstanding[tab->head]].cmd_type], latency_us);
+    tab->head = (tab->head + 1) % REPLAY_MAX_OUTSTANDING;
+    tab->count--;
+}
+
+static int next_for_tab(int tab, int from) {
+    for (int i = from; i < num_commands; i++) {
+        if (commands[i].tab == tab) return i;
+    }
+    return num_commands;
+}
+
+// Send at most one command per tab at a time, each as soon as the last
+// was answered
+static long long run_closed_loop(struct pollfd *pfds, long long *max_lag_ns) {
+    int remaining = num_commands;
+    for (int i = 0; i < num_tabs; i++) {
+        tabs[i].next = next_for_tab(i, 0);
+    }
+    *max_lag_ns = 0;
+
+    long long start = monotonic_ns();
+    while (remaining > 0) {
+        for (int i = 0; i < num_tabs; i++) {
+            ReplayTab *tab = &tabs[i];
+            if (tab->count > 0 || tab->next == num_commands) continue;
+            if (send_command(tab->next) < 0) return -1;
+            tab->next = next_for_tab(i, tab->next + 1);
+            remaining--;
+        }
+
+        int ready = poll(pfds, num_tabs, REPLAY_TIMEOUT_MS);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return -1;
+        }
+        for (int i = 0; i < num_tabs; i++) {
+            if (ready == 0) {
+                while (tabs[i].count > 0) drop_oldest(&tabs[i]);
+            } else if (pfds[i].revents & POLLIN) {
+                tab_client_dispatch(tabs[i].client);
+            }
+        }
+    }
+    return monotonic_ns() - start;
+}
+
+// Send every command at its recorded offset divided by speed, whether
+// or not earlier ones were answered. Responses are read between sends
+// even when behind schedule, or the tabs' queues in the browser fill up.
+static long long run_timed(struct pollfd *pfds, long long *max_lag_ns) {
+    *max_lag_ns = 0;
+
+    long long start = monotonic_ns();
+    int next = 0;
+    while (next < num_commands) {
+        long long now = monotonic_ns();
+        long long due = start + (long long)(commands[next].offset_ns / speed);
+        int timeout = 0;
+        if (due <= now) {
+            if (now - due > *max_lag_ns) *max_lag_ns = now - due;
+            if (send_command(next++) < 0) return -1;
+        } else {
+            timeout = (due - now + 999999) / 1000000;
+        }
+
+        if (poll(pfds, num_tabs, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return -1;
+        }
+        for (int i = 0; i < num_tabs; i++) {
+            if (pfds[i].revents & POLLIN) tab_client_dispatch(tabs[i].client);
+        }
+    }
+    return monotonic_ns() - start;
+}
+
+// Collect the responses still outstanding after the last send
+static void drain(struct pollfd *pfds) {
+    for (;;) {
+        int outstanding = 0;
+        for (int i = 0; i < num_tabs; i++) outstanding += tabs[i].count;
+        if (outstanding == 0) return;
+
+        int ready = poll(pfds, num_tabs, REPLAY_TIMEOUT_MS);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) break;
+        for (int i = 0; i < num_tabs; i++) {
+            if (pfds[i].revents & POLLIN) tab_client_dispatch(tabs[i].client);
+        }
+    }
+    for (int i = 0; i < num_tabs; i++) {
+        while (tabs[i].count > 0) drop_oldest(&tabs[i]);
+    }
+}
+
+static void print_row(const char *name, ReplayStats *s, ReplayStats *rec, double elapsed_s) {
+    qsort(s->samples, s->count, sizeof(long long), compare_ll);
+    qsort(rec->samples, rec->count, sizeof(long long), compare_ll);
+    printf("%-10s %8d %8d %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+           name, s->count, s->unanswered,
+           elapsed_s > 0 ? s->count / elapsed_s : 0.0,
+           percentile(s, 0.50), percentile(s, 0.99), percentile(s, 0.999),
+           percentile(rec, 0.50), percentile(rec, 0.99));
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-s speed] [-b base_tab_id] [-i instance] trace_file\n"
+            "  speed: 1 replays at the recorded pace (default), 2 twice as fast,\n"
+            "         0 as fast as the browser answers\n"
+            "  base_tab_id: replay tabs as base, base+1, ... instead of the recorded ids\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:i:h")) != -1) {
+        switch (opt) {
+            case 's': speed = atof(optarg); break;
+            case 'b': base_tab_id = atoi(optarg); break;
+            case 'i':
+                if (instance_select(optarg) < 0) {
+                    fprintf(stderr, "[Replay] Invalid instance name: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || speed < 0 || base_tab_id < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (load_trace(argv[optind]) < 0) return 1;
+    if (num_commands == 0) {
+        fprintf(stderr, "[Replay] %s has no commands\n", argv[optind]);
+        return 1;
+    }
+
+    if (access(instance_get()->browser_fifo, F_OK) != 0) {
+        fprintf(stderr, "[Replay] %s not found. Make sure ./browser is running.\n",
+                instance_get()->browser_fifo);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    struct pollfd *pfds = calloc(num_tabs, sizeof(struct pollfd));
+    if (!pfds) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < num_tabs; i++) {
+        int tab_id = base_tab_id > 0 ? base_tab_id + i : tabs[i].recorded_id;
+        TabClientCallbacks callbacks = { on_replay_response, NULL, &tabs[i] };
+        tabs[i].client = tab_client_open(tab_id, &callbacks);
+        if (!tabs[i].client) {
+            perror("tab_client_open");
+            return 1;
+        }
+        pfds[i].fd = tab_client_response_fd(tabs[i].client);
+        pfds[i].events = POLLIN;
+    }
+
+    double recorded_s = commands[num_commands - 1].offset_ns / 1e9;
+    if (speed > 0) {
+        printf("[Replay] %d commands from %d tabs over %.3f s, at %gx speed\n",
+               num_commands, num_tabs, recorded_s, speed);
+    } else {
+        printf("[Replay] %d commands from %d tabs over %.3f s, at full speed\n",
+               num_commands, num_tabs, recorded_s);
+    }
+
+    long long max_lag_ns;
+    long long sending_ns = speed > 0 ? run_timed(pfds, &max_lag_ns)
+                                     : run_closed_loop(pfds, &max_lag_ns);
+    drain(pfds);
+
+    for (int i = 0; i < num_tabs; i++) tab_client_close(tabs[i].client);
+    free(pfds);
+    if (sending_ns < 0) return 1;
+
+    double elapsed_s = sending_ns / 1e9;
+    ReplayStats total = { 0 };
+    ReplayStats recorded_total = { 0 };
+    printf("\n%-10s %8s %8s %10s %10s %10s %10s %10s %10s\n",
+           "command", "count", "lost", "ops/s", "p50(us)", "p99(us)", "p999(us)",
+           "rec p50", "rec p99");
+    for (int i = 0; i < CMD_COUNT; i++) {
+        for (int j = 0; j < stats[i].count; j++) stats_add(&total, stats[i].samples[j]);
+        for (int j = 0; j < recorded[i].count; j++) stats_add(&recorded_total, recorded[i].samples[j]);
+        total.unanswered += stats[i].unanswered;
+        if (stats[i].count + stats[i].unanswered > 0) {
+            print_row(command_names[i], &stats[i], &recorded[i], elapsed_s);
+        }
+    }
+    print_row("total", &total, &recorded_total, elapsed_s);
+
+    printf("\nSending took %.3f s (recorded %.3f s)\n", elapsed_s, recorded_s);
+    if (speed > 0) {
+        printf("Max send lag: %.1f ms\n", max_lag_ns / 1e6);
+    }
+
+    for (int i = 0; i < CMD_COUNT; i++) {
+        free(stats[i].samples);
+        free(recorded[i].samples);
+    }
+    free(total.samples);
+    free(recorded_total.samples);
+    for (int i = 0; i < num_commands; i++) free(commands[i].command);
+    free(commands);
+    free(tabs);
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include <string.h>
+#include "scan.h"
+
+#ifdef __x86_64__
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Byte classes, one bit each
+#define CLASS_TAG 1              // '<'
+#define CLASS_ENTITY 2           // '&'
+#define CLASS_SPACE 4            // ' '
+#define CLASS_CONTROL 8          // '\t', '\n', '\r', '\f'
+#define CLASS_SPECIAL (CLASS_TAG | CLASS_ENTITY)
+#define CLASS_WHITE (CLASS_SPACE | CLASS_CONTROL)
+#define CLASS_BREAK (CLASS_SPECIAL | CLASS_CONTROL)
+
+typedef struct {
+    const char *name;
+    size_t (*special)(const char *s, size_t n);
+    size_t (*text)(const char *s, size_t n);
+    size_t (*space)(const char *s, size_t n);
+    size_t (*newlines)(const char *s, size_t n, size_t *positions, size_t max);
+} ScanKernel;
+
+static const unsigned char classes[256] = {
+    ['<'] = CLASS_TAG, ['&'] = CLASS_ENTITY, [' '] = CLASS_SPACE,
+    ['\t'] = CLASS_CONTROL, ['\n'] = CLASS_CONTROL, ['\r'] = CLASS_CONTROL, ['\f'] = CLASS_CONTROL
+};
+
+// Plain text ends at a tag, an entity, a whitespace byte other than a
+// space, or a space followed by more whitespace. Single spaces between
+// words need no collapsing, so the run can be copied as it is.
+static size_t scalar_text_from(const char *s, size_t i, size_t n) {
+    for (; i < n; i++) {
+        int c = classes[(unsigned char)s[i]];
+        if (c & CLASS_BREAK) return i;
+        if ((c & CLASS_SPACE) && i + 1 < n && (classes[(unsigned char)s[i + 1]] & CLASS_WHITE)) return i;
+    }
+    return n;
+}
+
+static size_t scalar_find_from(const char *s, size_t i, size_t n, int bits) {
+    while (i < n && !(classes[(unsigned char)s[i]] & bits)) i++;
+    return i;
+}
+
+static size_t scalar_skip_from(const char *s, size_t i, size_t n, int bits) {
+    while (i < n && (classes[(unsigned char)s[i]] & bits)) i++;
+    return i;
+}
+
+static size_t scalar_newlines_from(const char *s, size_t i, size_t n, size_t *positions, size_t max,
+                                   size_t count) {
+    for (; i < n; i++) {
+        if (s[i] != '\n') continue;
+        if (count < max) positions[count] = i;
+        count++;
+    }
+    return count;
+}
+
+static size_t scalar_special(const char *s, size_t n) {
+    return scalar_find_from(s, 0, n, CLASS_SPECIAL);
+}
+
+static size_t scalar_text(const char *s, size_t n) {
+    return scalar_text_from(s, 0, n);
+}
+
+static size_t scalar_space(const char *s, size_t n) {
+    return scalar_skip_from(s, 0, n, CLASS_WHITE);
+}
+
+static size_t scalar_newlines(const char *s, size_t n, size_t *positions, size_t max) {
+    return scalar_newlines_from(s, 0, n, positions, positions ? max : 0, 0);
+}
+
+#ifdef SCAN_X86
+
+// SSE2: one compare per byte value of the class, 16 bytes at a time
+
+#define SSE2 __attribute__((target("sse2"), always_inline)) static inline
+
+SSE2 unsigned sse2_mask(__m128i v, int bits) {
+    __m128i m = _mm_setzero_si128();
+    if (bits & CLASS_TAG) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    if (bits & CLASS_ENTITY) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+    if (bits & CLASS_SPACE) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    if (bits & CLASS_CONTROL) {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\f')));
+    }
+    return _mm_movemask_epi8(m);
+}
+
+SSE2 size_t sse2_find(const char *s, size_t n, int bits) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = sse2_mask(_mm_loadu_si128((const __m128i *)(s + i)), bits);
+        if (m) return i + __builtin_ctz(m);
+    }
+    return scalar_find_from(s, i, n, bits);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_special(const char *s, size_t n) {
+    return sse2_find(s, n, CLASS_SPECIAL);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_text(const char *s, size_t n) {
+    size_t i = 0;
+    // The next byte is loaded too, to spot spaces followed by whitespace
+    for (; i + 17 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(s + i + 1));
+        unsigned m = sse2_mask(v, CLASS_BREAK) |
+                     (sse2_mask(v, CLASS_SPACE) & sse2_mask(next, CLASS_WHITE));
+        if (m) return i + __builtin_ctz(m);
+    }
+    return scalar_text_from(s, i, n);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_space(const char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = ~sse2_mask(_mm_loadu_si128((const __m128i *)(s + i)), CLASS_WHITE) & 0xffff;
+        if (m) return i + __builtin_ctz(m);
+    }
+    return scalar_skip_from(s, i, n, CLASS_WHITE);
+}
+
+__attribute__((target("sse2"))) static size_t sse2_newlines(const char *s, size_t n, size_t *positions,
+                                                            size_t max) {
+    if (!positions) max = 0;
+    size_t i = 0, count = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        for (; m && count < max; m &= m - 1) positions[count++] = i + __builtin_ctz(m);
+        count += __builtin_popcount(m);
+    }
+    return scalar_newlines_from(s, i, n, positions, max, count);
+}
+
+// AVX2: every class at once with two nibble lookups (vpshufb), 32 bytes
+// at a time. A byte is in the classes both its low and its high nibble
+// allow.
+
+#define AVX2 __attribute__((target("avx2,popcnt"), always_inline)) static inline
+
+AVX2 __m256i avx2_classify(__m256i v) {
+    const __m256i low_table = _mm256_setr_epi8(
+        CLASS_SPACE, 0, 0, 0, 0, 0, CLASS_ENTITY, 0,
+        0, CLASS_CONTROL, CLASS_CONTROL, 0, CLASS_TAG | CLASS_CONTROL, CLASS_CONTROL, 0, 0,
+        CLASS_SPACE, 0, 0, 0, 0, 0, CLASS_ENTITY, 0,
+        0, CLASS_CONTROL, CLASS_CONTROL, 0, CLASS_TAG | CLASS_CONTROL, CLASS_CONTROL, 0, 0);
+    const __m256i high_table = _mm256_setr_epi8(
+        CLASS_CONTROL, 0, CLASS_SPACE | CLASS_ENTITY, CLASS_TAG, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        CLASS_CONTROL, 0, CLASS_SPACE | CLASS_ENTITY, CLASS_TAG, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(v, nibble));
+    __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    return _mm256_and_si256(low, high);
+}
+
+// Bit i set if byte i is in one of the classes in bits
+AVX2 unsigned avx2_mask(__m256i classified, int bits) {
+    __m256i in = _mm256_and_si256(classified, _mm256_set1_epi8(bits));
+    return ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t avx2_special(const char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        // Two compares are cheaper than the lookups for two byte values
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')),
+                                    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+        unsigned bits = _mm256_movemask_epi8(m);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    return scalar_find_from(s, i, n, CLASS_SPECIAL);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t avx2_text(const char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 33 <= n; i += 32) {
+        __m256i v = avx2_classify(_mm256_loadu_si256((const __m256i *)(s + i)));
+        __m256i next = avx2_classify(_mm256_loadu_si256((const __m256i *)(s + i + 1)));
+        unsigned m = avx2_mask(v, CLASS_BREAK) | (avx2_mask(v, CLASS_SPACE) & avx2_mask(next, CLASS_WHITE));
+        if (m) return i + __builtin_ctz(m);
+    }
+    return scalar_text_from(s, i, n);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t avx2_space(const char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned m = ~avx2_mask(avx2_classify(_mm256_loadu_si256((const __m256i *)(s + i))), CLASS_WHITE);
+        if (m) return i + __builtin_ctz(m);
+    }
+    return scalar_skip_from(s, i, n, CLASS_WHITE);
+}
+
+__attribute__((target("avx2,popcnt"))) static size_t avx2_newlines(const char *s, size_t n, size_t *positions,
+                                                                   size_t max) {
+    if (!positions) max = 0;
+    size_t i = 0, count = 0;
+    const __m256i newline = _mm256_set1_epi8('\n');
+    if (max == 0) {
+        // Counting only: add up the matches per byte lane, 255 blocks at most
+        // before the 8-bit lanes could overflow
+        while (i + 32 <= n) {
+            __m256i sums = _mm256_setzero_si256();
+            for (int k = 0; k < 255 && i + 32 <= n; k++, i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+                sums = _mm256_sub_epi8(sums, _mm256_cmpeq_epi8(v, newline));
+            }
+            __m256i total = _mm256_sad_epu8(sums, _mm256_setzero_si256());
+            count += _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                     _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+        }
+        return scalar_newlines_from(s, i, n, positions, 0, count);
+    }
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        for (; m && count < max; m &= m - 1) positions[count++] = i + __builtin_ctz(m);
+        count += __builtin_popcount(m);
+    }
+    return scalar_newlines_from(s, i, n, positions, max, count);
+}
+
+#endif
+
+// Best first
+static const ScanKernel kernels[] = {
+#ifdef SCAN_X86
+    { "avx2", avx2_special, avx2_text, avx2_space, avx2_newlines },
+    { "sse2", sse2_special, sse2_text, sse2_space, sse2_newlines },
+#endif
+    { "scalar", scalar_special, scalar_text, scalar_space, scalar_newlines }
+};
+
+#define KERNEL_COUNT (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static const ScanKernel *active = NULL;
+
+static int supported(const ScanKernel *k) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(k->name, "avx2") == 0) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if (strcmp(k->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+static const ScanKernel *kernel() {
+    const ScanKernel *k = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    if (k) return k;
+    k = &kernels[KERNEL_COUNT - 1];
+    for (int i = 0; i < KERNEL_COUNT; i++) {
+        if (supported(&kernels[i])) {
+            k = &kernels[i];
+            break;
+        }
+    }
+    __atomic_store_n(&active, k, __ATOMIC_RELEASE);
+    return k;
+}
+
+size_t scan_special(const char *s, size_t n) {
+    return kernel()->special(s, n);
+}
+
+size_t scan_text(const char *s, size_t n) {
+    return kernel()->text(s, n);
+}
+
+size_t scan_space(const char *s, size_t n) {
+    return kernel()->space(s, n);
+}
+
+size_t scan_newlines(const char *s, size_t n, size_t *positions, size_t max) {
+    return kernel()->newlines(s, n, positions, max);
+}
+
+const char *scan_kernel() {
+    return kernel()->name;
+}
+
+int scan_select(const char *name) {
+    for (int i = 0; i < KERNEL_COUNT; i++) {
+        if (strcmp(kernels[i].name, name) == 0 && supported(&kernels[i])) {
+            __atomic_store_n(&active, &kernels[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,38 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Byte-scanning kernels for the text pipeline.
+// html_to_text() spends its time looking for the next '<' or '&' and
+// for the end of whitespace runs, and the viewport and the diff split
+// documents into lines. These do the looking 16 (SSE2) or 32 (AVX2)
+// bytes at a time. The best kernel the CPU supports is picked on first
+// use, with a plain C fallback; detection uses cpuid only, so it also
+// works inside the seccomp sandbox of the render workers.
+//
+// Whitespace is what html_to_text() collapses: space, tab, newline,
+// carriage return and form feed (not vertical tab).
+
+// Offset of the first '<' or '&' in s[0..n), or n
+size_t scan_special(const char *s, size_t n);
+
+// Offset of the first '<', '&' or whitespace byte, or n: the end of a
+// run of plain text
+size_t scan_text(const char *s, size_t n);
+
+// Offset of the first byte that is not whitespace, or n
+size_t scan_space(const char *s, size_t n);
+
+// Number of '\n' in s[0..n). The offsets of the first max of them are
+// stored in positions, which may be NULL to only count.
+size_t scan_newlines(const char *s, size_t n, size_t *positions, size_t max);
+
+// Name of the kernel in use: "avx2", "sse2" or "scalar"
+const char *scan_kernel();
+
+// Use the named kernel instead (for benchmarks). Returns -1 if this CPU
+// or build does not have it.
+int scan_select(const char *name);
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "common.h"
+#include "html2text.h"
+#include "scan.h"
+
+// Throughput of the scan kernels (see scan.h) on a large synthetic page,
+// or on a given HTML file, for every kernel this CPU supports. Reports
+// GB/s of input for each pass: finding tags and entities, walking text
+// runs and whitespace the way html_to_text() does, splitting lines, and
+// html_to_text() itself.
+
+static size_t page_mb = 64;
+static int repeats = 5;
+
+// Paragraphs of words with some markup and entities, indented the way
+// generated pages usually are
+static char *synthetic_page(size_t size, size_t *length) {
+    static const char *const words[] = {
+        "the", "browser", "renders", "pages", "in", "a", "sandboxed", "worker", "and",
+        "sends", "text", "to", "each", "tab", "over", "shared", "memory", "while",
+        "scrolling", "stays", "local", "performance", "engineering", "is", "measurement"
+    };
+    char *page = malloc(size + 256);
+    if (!page) return NULL;
+
+    size_t n = 0;
+    unsigned seed = 1;
+    n += sprintf(page, "<html><head><title>Synthetic</title></head><body>\n");
+    while (n < size) {
+        seed = seed * 1103515245 + 12345;
+        unsigned r = (seed >> 16) % 100;
+        if (r < 3) n += sprintf(page + n, "\n  <p class=\"para\">\n    ");
+        else if (r < 5) n += sprintf(page + n, "<a href=\"page%u.html\">link</a> ", r);
+        else if (r < 6) n += sprintf(page + n, "&amp; ");
+        else if (r < 8) n += sprintf(page + n, "<b>bold</b> ");
+        else if (r < 12) n += sprintf(page + n, "\n    ");
+        else n += sprintf(page + n, "%s ", words[(seed >> 8) % (sizeof(words) / sizeof(words[0]))]);
+    }
+    n += sprintf(page + n, "</body></html>\n");
+    *length = n;
+    return page;
+}
+
+static char *read_page(const char *path, size_t *length) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror("fopen");
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *page = malloc(size > 0 ? size : 1);
+    if (!page || fread(page, 1, size, fp) != (size_t)size) {
+        perror("fread");
+        fclose(fp);
+        free(page);
+        return NULL;
+    }
+    fclose(fp);
+    *length = size;
+    return page;
+}
+
+// Every '<' and '&'
+static size_t pass_special(const char *page, size_t length) {
+    size_t found = 0;
+    for (size_t i = 0; i < length; i++) {
+        i += scan_special(page + i, length - i);
+        if (i < length) found++;
+    }
+    return found;
+}
+
+// Alternate text runs and whitespace runs, as html_to_text() does
+static size_t pass_text(const char *page, size_t length) {
+    size_t runs = 0;
+    for (size_t i = 0; i < length; runs++) {
+        size_t n = scan_space(page + i, length - i);
+        if (n == 0) n = scan_text(page + i, length - i);
+        i += n ? n : 1;
+    }
+    return runs;
+}
+
+static size_t pass_lines(const char *page, size_t length) {
+    size_t count = scan_newlines(page, length, NULL, 0);
+    size_t *positions = malloc((count ? count : 1) * sizeof(size_t));
+    if (!positions) return 0;
+    scan_newlines(page, length, positions, count);
+    free(positions);
+    return count;
+}
+
+static char *text_out;
+static size_t text_capacity;
+
+static size_t pass_html_to_text(const char *page, size_t length) {
+    return html_to_text(page, length, text_out, text_capacity, NULL, NULL);
+}
+
+// Best of the repeats, in GB/s
+static double measure(size_t (*pass)(const char *, size_t), const char *page, size_t length,
+                      size_t *result) {
+    long long best = 0;
+    for (int r = 0; r < repeats; r++) {
+        long long start = monotonic_ns();
+        *result = pass(page, length);
+        long long elapsed = monotonic_ns() - start;
+        if (r == 0 || elapsed < best) best = elapsed;
+    }
+    return best > 0 ? (double)length / best : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s page_mb] [-r repeats] [-k kernel] [file.html]\n", prog);
+    fprintf(stderr, "Kernels: avx2, sse2, scalar (default: all this CPU supports)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *only = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:k:h")) != -1) {
+        switch (opt) {
+        case 's': page_mb = strtoul(optarg, NULL, 10); break;
+        case 'r': repeats = atoi(optarg); break;
+        case 'k': only = optarg; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (page_mb == 0 || repeats <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t length;
+    char *page = optind < argc ? read_page(argv[optind], &length)
+                               : synthetic_page(page_mb << 20, &length);
+    if (!page) return 1;
+    text_capacity = length + 1;
+    text_out = malloc(text_capacity);
+    if (!text_out) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("[Scanbench] %s: %.1f MB, best of %d, detected kernel: %s\n",
+           optind < argc ? argv[optind] : "synthetic page", length / 1048576.0, repeats, scan_kernel());
+    printf("%-8s %14s %14s %14s %14s\n", "kernel", "tags GB/s", "text GB/s", "lines GB/s", "html2text GB/s");
+
+    static const char *const kernels[] = { "avx2", "sse2", "scalar" };
+    size_t expected[4] = { 0 };
+    int first = 1;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (only && strcmp(only, kernels[k]) != 0) continue;
+        if (scan_select(kernels[k]) < 0) {
+            printf("%-8s %14s\n", kernels[k], "unsupported");
+            continue;
+        }
+
+        size_t results[4];
+        double special = measure(pass_special, page, length, &results[0]);
+        double text = measure(pass_text, page, length, &results[1]);
+        double lines = measure(pass_lines, page, length, &results[2]);
+        double convert = measure(pass_html_to_text, page, length, &results[3]);
+        printf("%-8s %14.2f %14.2f %14.2f %14.2f\n", kernels[k], special, text, lines, convert);
+
+        // Every kernel has to find the same things
+        if (first) memcpy(expected, results, sizeof(expected));
+        else if (memcmp(expected, results, sizeof(expected)) != 0) {
+            fprintf(stderr, "[Scanbench] %s disagrees with the first kernel\n", kernels[k]);
+            return 1;
+        }
+        first = 0;
+    }
+    printf("[Scanbench] %zu tags and entities, %zu runs, %zu lines, %zu bytes of text\n",
+           expected[0], expected[1], expected[2], expected[3]);
+
+    free(text_out);
+    free(page);
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include "sched.h"
+
+struct SchedItem {
+    SchedItem *next;
+    BrowserMessage msg;
+    struct timespec enqueued;
+};
+
+// Active list per class: tabs with queued work whose next command is of that class
+typedef struct {
+    SchedTab *head;
+    SchedTab *tail;
+} SchedList;
+
+static SchedList lists[SCHED_CLASSES];
+static int queued[SCHED_CLASSES];
+static int meta_streak = 0;      // Metadata commands served while renders waited
+
+static SchedTab **tabs = NULL;
+static int tab_count = 0;
+static int tab_capacity = 0;
+
+SchedClass sched_class(CommandType type) {
+    switch (type) {
+        case CMD_LOAD:
+        case CMD_RELOAD:
+        case CMD_BACK:
+        case CMD_FORWARD:
+        case CMD_BOOKMARK_OPEN:
+        case CMD_FOLLOW:             // Shows the leader's page straight away
+            return SCHED_RENDER;
+        default:
+            return SCHED_META;
+    }
+}
+
+static int sched_cost(SchedClass cls) {
+    return cls == SCHED_RENDER ? SCHED_RENDER_COST : SCHED_META_COST;
+}
+
+static SchedTab *sched_tab(int tab_id) {
+    for (int i = 0; i < tab_count; i++) {
+        if (tabs[i]->tab_id == tab_id) return tabs[i];
+    }
+
+    if (tab_count == tab_capacity) {
+        int capacity = tab_capacity ? tab_capacity * 2 : 16;
+        SchedTab **grown = realloc(tabs, capacity * sizeof(SchedTab *));
+        if (!grown) return NULL;
+        tabs = grown;
+        tab_capacity = capacity;
+    }
+
+    SchedTab *tab = calloc(1, sizeof(SchedTab));
+    if (!tab) return NULL;
+    tab->tab_id = tab_id;
+    tabs[tab_count++] = tab;
+    return tab;
+}
+
+static SchedClass head_class(const SchedTab *tab) {
+    return sched_class(tab->head->msg.cmd_type);
+}
+
+// Append a tab to the list matching its next command
+static void list_append(SchedTab *tab) {
+    SchedList *list = &lists[head_class(tab)];
+    tab->next_active = NULL;
+    tab->credited = 0;
+    tab->listed = 1;
+    if (list->tail) list->tail->next_active = tab;
+    else list->head = tab;
+    list->tail = tab;
+}
+
+// Remove the tab at the front of a list
+static void list_pop(SchedList *list) {
+    SchedTab *tab = list->head;
+    list->head = tab->next_active;
+    if (!list->head) list->tail = NULL;
+    tab->next_active = NULL;
+    tab->listed = 0;
+}
+
+static double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+int sched_push(const BrowserMessage *msg) {
+    SchedTab *tab = sched_tab(msg->tab_id);
+    if (!tab) return -1;
+
+    if (tab->depth >= SCHED_MAX_DEPTH) {
+        tab->refused++;
+        return -1;
+    }
+
+    SchedItem *item = malloc(sizeof(SchedItem));
+    if (!item) return -1;
+    item->next = NULL;
+    item->msg = *msg;
+    clock_gettime(CLOCK_MONOTONIC, &item->enqueued);
+
+    if (tab->tail) tab->tail->next = item;
+    else tab->head = item;
+    tab->tail = item;
+    tab->depth++;
+    if (tab->depth > tab->max_depth) tab->max_depth = tab->depth;
+
+    queued[sched_class(msg->cmd_type)]++;
+
+    if (!tab->listed) {
+        list_append(tab);
+    }
+    return 0;
+}
+
+int sched_ready(int allow_render) {
+    return lists[SCHED_META].head || (allow_render && lists[SCHED_RENDER].head);
+}
+
+int sched_next(BrowserMessage *msg, double *wait_ms, int allow_render) {
+    SchedClass cls;
+    int renders = allow_render && lists[SCHED_RENDER].head;
+    if (!lists[SCHED_META].head && !renders) {
+        return 0;
+    } else if (!renders) {
+        cls = SCHED_META;
+    } else if (!lists[SCHED_META].head || meta_streak >= SCHED_META_BURST) {
+        cls = SCHED_RENDER;
+    } else {
+        cls = SCHED_META;
+    }
+
+    if (cls == SCHED_META && renders) meta_streak++;
+    else meta_streak = 0;
+
+    // Deficit round robin: the front tab earns a quantum once per visit
+    // and runs commands while its credit covers them
+    SchedList *list = &lists[cls];
+    SchedTab *tab = list->head;
+    if (!tab->credited) {
+        tab->deficit += SCHED_QUANTUM;
+        tab->credited = 1;
+    }
+
+    SchedItem *item = tab->head;
+    tab->deficit -= sched_cost(cls);
+
+    list_pop(list);
+    tab->head = item->next;
+    if (!tab->head) tab->tail = NULL;
+    tab->depth--;
+    queued[cls]--;
+
+    if (!tab->head) {
+        tab->deficit = 0;
+    } else if (head_class(tab) == cls && tab->deficit >= sched_cost(cls)) {
+        // Still has credit: stay at the front of this list
+        tab->next_active = list->head;
+        list->head = tab;
+        if (!list->tail) list->tail = tab;
+        tab->listed = 1;
+    } else {
+        if (head_class(tab) != cls) tab->deficit = 0;
+        list_append(tab);
+    }
+
+    *wait_ms = elapsed_ms(&item->enqueued);
+    tab->served++;
+    tab->total_wait_ms += *wait_ms;
+    if (*wait_ms > tab->max_wait_ms) tab->max_wait_ms = *wait_ms;
+
+    *msg = item->msg;
+    free(item);
+    return 1;
+}
+
+int sched_pending() {
+    return queued[SCHED_META] + queued[SCHED_RENDER];
+}
+
+int sched_pending_class(SchedClass cls) {
+    return queued[cls];
+}
+
+int sched_tab_count() {
+    return tab_count;
+}
+
+SchedTab *sched_tab_at(int index) {
+    return tabs[index];
+}
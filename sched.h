@@ -0,0 +1,67 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <time.h>
+#include "common.h"
+
+// Fair command scheduler between the FIFO reader and handle_command().
+// Every tab has its own FIFO of pending commands, so a tab's commands run
+// in the order it sent them. Across tabs, a tab whose next command is
+// cheap metadata (status, history, bookmarks, ...) is served before tabs
+// waiting on a render (load, reload, back, forward, open), and tabs within
+// a class share the browser by deficit round robin.
+
+#define SCHED_QUANTUM 4          // Credit a tab earns each round
+#define SCHED_META_COST 1        // So a tab can run up to 4 metadata commands per round
+#define SCHED_RENDER_COST 4      // ... or one render
+#define SCHED_META_BURST 8       // Metadata commands served before a waiting render must run
+#define SCHED_MAX_DEPTH 256      // Commands a tab can have queued before new ones are refused
+
+typedef enum {
+    SCHED_META,
+    SCHED_RENDER,
+    SCHED_CLASSES
+} SchedClass;
+
+typedef struct SchedItem SchedItem;
+
+typedef struct SchedTab {
+    int tab_id;
+    SchedItem *head;
+    SchedItem *tail;
+    int depth;
+    int deficit;
+    int credited;                // Received its quantum for the current visit
+    int listed;                  // On one of the active lists
+    struct SchedTab *next_active;
+
+    // Tuning statistics
+    int max_depth;
+    unsigned long served;
+    unsigned long refused;
+    double total_wait_ms;
+    double max_wait_ms;
+} SchedTab;
+
+SchedClass sched_class(CommandType type);
+
+// Queue a command. Returns -1 if the tab already has SCHED_MAX_DEPTH queued.
+int sched_push(const BrowserMessage *msg);
+
+// Whether sched_next() would return a command
+int sched_ready(int allow_render);
+
+// Take the next command to run. Returns 0 if nothing is runnable.
+// With allow_render unset (e.g. all render slots busy), tabs waiting on
+// a render are held back. *wait_ms is set to how long the command sat
+// in the queue.
+int sched_next(BrowserMessage *msg, double *wait_ms, int allow_render);
+
+int sched_pending();
+int sched_pending_class(SchedClass cls);
+
+// Visit every tab the scheduler has seen, e.g. for status output
+int sched_tab_count();
+SchedTab *sched_tab_at(int index);
+
+#endif
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include "shard.h"
+#include "log.h"
+
+typedef struct {
+    pid_t pid;                       // 0 if not running
+    int fifo_fd;                     // Write end used for forwarding, -1 until needed
+    long long started_ms;
+} Shard;
+
+static Shard shards[INSTANCE_MAX_SHARDS];
+static int count = 1;
+static const char *shard_binary = NULL;
+static char *const *shard_argv = NULL;
+static int self = 0;
+static long long last_check_ms = 0;
+
+int shard_self() {
+    const char *text = getenv(SHARD_ENV);
+    int shard = text ? atoi(text) : 0;
+    return shard > 0 && shard < INSTANCE_MAX_SHARDS ? shard : 0;
+}
+
+static int spawn(int index) {
+    // Built before fork(): the log writer and broadcast threads may hold
+    // the allocator's lock then, so the child only makes syscalls
+    char index_text[16];
+    snprintf(index_text, sizeof(index_text), "%d", index);
+    char **env = env_with(SHARD_ENV, index_text);
+    if (!env) {
+        perror("malloc");
+        return -1;
+    }
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        free(env);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Shards go down with shard 0, which owns the shared memory
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != parent) _exit(1);
+        close_range(STDERR_FILENO + 1, ~0U, 0);
+        execve(shard_binary, shard_argv, env);
+        // Seen by shard_supervise() as the shard exiting
+        _exit(127);
+    }
+
+    free(env);
+    shards[index].pid = pid;
+    shards[index].started_ms = monotonic_ms();
+    log_info("[Browser] Started shard %d as process %d", index, (int)pid);
+    return 0;
+}
+
+int shard_start(const char *path, char *const argv[], int shard_count) {
+    shard_binary = path;
+    shard_argv = argv;
+    count = shard_count;
+    for (int i = 0; i < INSTANCE_MAX_SHARDS; i++) shards[i].fifo_fd = -1;
+    shards[0].pid = getpid();
+    self = shard_self();
+    if (self != 0) return 0;
+
+    for (int i = 1; i < count; i++) {
+        if (spawn(i) < 0) return -1;
+    }
+    return 0;
+}
+
+int shard_count() {
+    return count;
+}
+
+int shard_running() {
+    int running = 0;
+    for (int i = 0; i < count; i++) {
+        if (shards[i].pid > 0) running++;
+    }
+    return running;
+}
+
+void shard_supervise() {
+    if (count <= 1 || self != 0) return;
+    long long now = monotonic_ms();
+    if (now - last_check_ms < 100) return;
+    last_check_ms = now;
+
+    for (int i = 1; i < count; i++) {
+        Shard *s = &shards[i];
+        if (s->pid > 0) {
+            int status;
+            if (waitpid(s->pid, &status, WNOHANG) != s->pid) continue;
+            log_error("[Browser] Shard %d (process %d) exited with status %d", i, (int)s->pid,
+                      WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            s->pid = 0;
+            if (s->fifo_fd >= 0) {
+                close(s->fifo_fd);
+                s->fifo_fd = -1;
+            }
+        }
+
+        // Its tabs' commands fail until it is back; a shard failing at
+        // startup is not restarted in a tight loop
+        if (now - s->started_ms >= SHARD_RESTART_MS) spawn(i);
+    }
+}
+
+int shard_forward(const BrowserMessage *msg) {
+    int target = instance_shard_of(msg->tab_id, count);
+    if (target == 0) return 0;
+
+    Shard *s = &shards[target];
+    if (s->fifo_fd < 0) {
+        char path[INSTANCE_PATH_MAX + 16];
+        instance_shard_fifo(target, path, sizeof(path));
+        s->fifo_fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (s->fifo_fd < 0) return -1;
+    }
+
+    ssize_t n;
+    do {
+        n = write(s->fifo_fd, msg, sizeof(*msg));
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(*msg)) {
+        // The reader went away: reopen next time
+        if (n < 0 && errno == EPIPE) {
+            close(s->fifo_fd);
+            s->fifo_fd = -1;
+        }
+        return -1;
+    }
+    return 1;
+}
+
+void shard_stop() {
+    for (int i = 1; i < count; i++) {
+        if (shards[i].pid > 0) kill(shards[i].pid, SIGTERM);
+    }
+    for (int i = 1; i < count; i++) {
+        if (shards[i].pid > 0) {
+            while (waitpid(shards[i].pid, NULL, 0) < 0 && errno == EINTR);
+            shards[i].pid = 0;
+        }
+        if (shards[i].fifo_fd >= 0) {
+            close(shards[i].fifo_fd);
+            shards[i].fifo_fd = -1;
+        }
+    }
+}
+
+void shard_path(const char *base, char *path, size_t size) {
+    int self = shard_self();
+    if (self == 0) snprintf(path, size, "%s", base);
+    else snprintf(path, size, "%s.shard%d", base, self);
+}
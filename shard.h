@@ -0,0 +1,50 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include "common.h"
+#include "instance.h"
+
+// Sharded browser.
+// With -s N the browser runs as N processes. Each one serves the tabs
+// that instance_shard_of() assigns to it, through its own FIFO,
+// scheduler, output queues, renderer pool and render cache. The first
+// process (shard 0) creates the shared memory, semaphore and session
+// snapshot, then starts shards 1..N-1 by running its binary again (same
+// arguments) with SHARD_ENV set. The shards attach to what shard 0
+// created, so bookmarks, broadcasts, statistics and tab state stay
+// common to all of them. Shard 0 also restarts shards that die, and it
+// forwards commands that reach its FIFO for another shard's tabs. Tab
+// clients normally write to their shard's FIFO directly.
+
+#define SHARD_ENV "BROWSER_SHARD"
+#define SHARD_RESTART_MS 1000        // Least time between restarts of one shard
+
+// This process's shard, from SHARD_ENV; 0 for the first process
+int shard_self();
+
+// Record the number of shards; shard 0 also starts the others by running
+// path with argv. Returns -1 if one cannot be started.
+int shard_start(const char *path, char *const argv[], int count);
+
+int shard_count();
+
+// Shards currently running, shard 0 included
+int shard_running();
+
+// Shard 0: restart shards that have exited. Cheap enough to call on
+// every event loop iteration.
+void shard_supervise();
+
+// Shard 0: pass a command for another shard's tab on to that shard.
+// Returns 0 if the command is this shard's, 1 if it was forwarded, -1 if
+// the shard cannot take it now.
+int shard_forward(const BrowserMessage *msg);
+
+// Shard 0: stop the other shards and wait for them to exit
+void shard_stop();
+
+// File of this shard: base itself for shard 0, base.shardN otherwise
+void shard_path(const char *base, char *path, size_t size);
+
+#endif
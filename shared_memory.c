@@ -8,14 +8,19 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include "shared_memory.h"
+#include "log.h"
+#include "instance.h"
 
 // Global variables
 static int g_semid = -1;
 
 // Initialize shared memory for tab synchronization
 int init_shared_memory() {
-    int shmid = shmget(SHM_KEY, sizeof(SharedState), IPC_CREAT | 0666);
+    int shmid = shmget(instance_get()->shm_key, sizeof(SharedState), IPC_CREAT | 0666);
     if (shmid < 0) {
         perror("shmget");
         return -1;
@@ -32,7 +37,7 @@ int init_shared_memory() {
     if (shmid != 0) {
         memset(state, 0, sizeof(SharedState));
         state->last_activity = time(NULL);
-        printf("[Shared Memory] Initialized with ID: %d\n", shmid);
+        log_info("[Shared Memory] Initialized with ID: %d", shmid);
     }
     
     // Detach from shared memory
@@ -40,10 +45,15 @@ int init_shared_memory() {
     return shmid;
 }
 
+// The segment created by the browser, without creating it
+int find_shared_memory() {
+    return shmget(instance_get()->shm_key, sizeof(SharedState), 0666);
+}
+
 // Initialize semaphores for synchronization
 int init_semaphores() {
     // Create semaphore
-    g_semid = semget(SEM_KEY, 1, IPC_CREAT | 0666);
+    g_semid = semget(instance_get()->sem_key, 1, IPC_CREAT | 0666);
     if (g_semid < 0) {
         perror("semget");
         return -1;
@@ -57,7 +67,16 @@ int init_semaphores() {
         return -1;
     }
     
-    printf("[Semaphore] Initialized with ID: %d\n", g_semid);
+    log_info("[Semaphore] Initialized with ID: %d", g_semid);
+    return g_semid;
+}
+
+// Attach to the semaphore created by the browser without resetting it
+int attach_semaphores() {
+    g_semid = semget(instance_get()->sem_key, 1, 0666);
+    if (g_semid < 0) {
+        return -1;
+    }
     return g_semid;
 }
 
@@ -106,6 +125,48 @@ void detach_shared_memory(void *segment) {
     }
 }
 
+static const char *broadcast_type_names[BROADCAST_TYPE_COUNT] = {
+    "bookmark-added", "bookmark-removed", "new-tab", "tab-closed", "page-loaded"
+};
+
+const char *broadcast_type_name(BroadcastType type) {
+    return type >= 0 && type < BROADCAST_TYPE_COUNT ? broadcast_type_names[type] : "unknown";
+}
+
+int parse_broadcast_types(const char *list, unsigned int *mask) {
+    *mask = 0;
+    char copy[MAX_MSG];
+    snprintf(copy, sizeof(copy), "%s", list);
+    
+    char *save = NULL;
+    for (char *name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        if (strcmp(name, "all") == 0) {
+            *mask |= BROADCAST_ALL_TYPES;
+        } else if (strcmp(name, "bookmarks") == 0) {
+            *mask |= 1u << BROADCAST_BOOKMARK_ADDED | 1u << BROADCAST_BOOKMARK_REMOVED;
+        } else if (strcmp(name, "tabs") == 0) {
+            *mask |= 1u << BROADCAST_NEW_TAB | 1u << BROADCAST_TAB_CLOSED;
+        } else {
+            int type = 0;
+            while (type < BROADCAST_TYPE_COUNT && strcmp(name, broadcast_type_names[type]) != 0) type++;
+            if (type == BROADCAST_TYPE_COUNT) return -1;
+            *mask |= 1u << type;
+        }
+    }
+    return *mask ? 0 : -1;
+}
+
+// Whether a tab's filter lets a message through. Decided once, by the
+// sender, so receivers never look at messages they filter out.
+static bool filter_accepts(const BroadcastFilter *filter, BroadcastType type, const char *data) {
+    if (filter->ignored & (1u << type)) return false;
+    if (type == BROADCAST_PAGE_LOADED && filter->url_prefix[0] &&
+        strncmp(data, filter->url_prefix, strnlen(filter->url_prefix, MAX_URL_LENGTH)) != 0) {
+        return false;
+    }
+    return true;
+}
+
 // Send broadcast message to all tabs
 void broadcast_message(SharedState *state, BroadcastType type, int sender_tab_id, const char *data) {
     if (!state) return;
@@ -113,7 +174,7 @@ void broadcast_message(SharedState *state, BroadcastType type, int sender_tab_id
     lock_shared_memory();
     
     // Find an available slot or reuse oldest
-    int slot = state->broadcast_count % 10;
+    int slot = state->broadcast_count % MAX_BROADCASTS;
     
     // Prepare broadcast message
     BroadcastMessage *msg = &state->broadcast_messages[slot];
@@ -123,19 +184,46 @@ void broadcast_message(SharedState *state, BroadcastType type, int sender_tab_id
     strncpy(msg->data, data, BROADCAST_MSG_SIZE - 1);
     msg->data[BROADCAST_MSG_SIZE - 1] = '\0';
     
-    // Mark as unprocessed for all tabs
+    // Mark as unprocessed for the tabs whose filters accept it
+    bool wanted = false;
     for (int i = 0; i < MAX_TABS; i++) {
-        msg->processed[i] = (i == sender_tab_id) ? true : false;
+        msg->processed[i] = i == sender_tab_id % MAX_TABS ||
+                            !filter_accepts(&state->filters[i], type, msg->data);
+        wanted |= !msg->processed[i] && state->tab_active[i];
     }
     
     // Update broadcast count
     state->broadcast_count++;
     state->last_activity = time(NULL);
     
+    // Nobody synced wants it: tabs that sync later still find it, but
+    // nothing is woken now
+    if (wanted) __atomic_add_fetch(&state->broadcast_seq, 1, __ATOMIC_RELEASE);
+    
     unlock_shared_memory();
     
-    printf("[Broadcast] Tab %d sent message type %d: %s\n", 
-           sender_tab_id, type, data);
+    if (wanted) wake_broadcast_waiters(state);
+    
+    log_info("[Broadcast] Tab %d sent message type %d: %s", 
+             sender_tab_id, type, data);
+}
+
+// Sleep until broadcast_seq moves past seen_seq (or a spurious wakeup).
+// The futex is shared, so it works across every process attached to the segment.
+int wait_for_broadcast(SharedState *state, unsigned int seen_seq) {
+    if (!state) return -1;
+    
+    if (syscall(SYS_futex, &state->broadcast_seq, FUTEX_WAIT, seen_seq, NULL, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EINTR) {
+        return -1;
+    }
+    return 0;
+}
+
+// Wake every process sleeping in wait_for_broadcast()
+void wake_broadcast_waiters(SharedState *state) {
+    if (!state) return;
+    syscall(SYS_futex, &state->broadcast_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
 }
 
 // Check if there are new broadcasts for this tab
@@ -145,9 +233,9 @@ bool check_new_broadcasts(SharedState *state, int tab_id) {
     lock_shared_memory();
     
     bool has_new = false;
-    for (int i = 0; i < 10; i++) {
+    for (int i = 0; i < MAX_BROADCASTS; i++) {
         BroadcastMessage *msg = &state->broadcast_messages[i];
-        if (msg->timestamp > 0 && !msg->processed[tab_id]) {
+        if (msg->timestamp > 0 && !msg->processed[tab_id % MAX_TABS]) {
             has_new = true;
             break;
         }
@@ -163,38 +251,41 @@ void process_broadcasts(SharedState *state, int tab_id) {
     
     lock_shared_memory();
     
-    for (int i = 0; i < 10; i++) {
+    for (int i = 0; i < MAX_BROADCASTS; i++) {
         BroadcastMessage *msg = &state->broadcast_messages[i];
         
-        if (msg->timestamp > 0 && !msg->processed[tab_id]) {
+        if (msg->timestamp > 0 && !msg->processed[tab_id % MAX_TABS]) {
             // Mark as processed
-            msg->processed[tab_id] = true;
+            msg->processed[tab_id % MAX_TABS] = true;
             
             // Process based on type
             switch (msg->type) {
                 case BROADCAST_BOOKMARK_ADDED:
-                    printf("[Tab %d] Received: Bookmark added by Tab %d: %s\n", 
-                           tab_id, msg->sender_tab_id, msg->data);
+                    log_info("[Tab %d] Received: Bookmark added by Tab %d: %s", 
+                             tab_id, msg->sender_tab_id, msg->data);
                     break;
                     
                 case BROADCAST_BOOKMARK_REMOVED:
-                    printf("[Tab %d] Received: Bookmark removed by Tab %d: %s\n", 
-                           tab_id, msg->sender_tab_id, msg->data);
+                    log_info("[Tab %d] Received: Bookmark removed by Tab %d: %s", 
+                             tab_id, msg->sender_tab_id, msg->data);
                     break;
                     
                 case BROADCAST_NEW_TAB:
-                    printf("[Tab %d] Received: New tab opened: %d\n", 
-                           tab_id, msg->sender_tab_id);
+                    log_info("[Tab %d] Received: New tab opened: %d", 
+                             tab_id, msg->sender_tab_id);
                     break;
                     
                 case BROADCAST_TAB_CLOSED:
-                    printf("[Tab %d] Received: Tab closed: %d\n", 
-                           tab_id, msg->sender_tab_id);
+                    log_info("[Tab %d] Received: Tab closed: %d", 
+                             tab_id, msg->sender_tab_id);
                     break;
                     
                 case BROADCAST_PAGE_LOADED:
-                    printf("[Tab %d] Received: Tab %d loaded page: %s\n", 
-                           tab_id, msg->sender_tab_id, msg->data);
+                    log_info("[Tab %d] Received: Tab %d loaded page: %s", 
+                             tab_id, msg->sender_tab_id, msg->data);
+                    break;
+                    
+                default:
                     break;
             }
         }
@@ -225,7 +316,7 @@ void add_bookmark(SharedState *state, const char *url, const char *title, int se
         broadcast_message(state, BROADCAST_BOOKMARK_ADDED, sender_tab_id, message);
     } else {
         unlock_shared_memory();
-        printf("[Bookmark] Error: Maximum number of bookmarks reached\n");
+        log_warn("[Bookmark] Maximum number of bookmarks reached");
     }
 }
 
@@ -257,7 +348,7 @@ void remove_bookmark(SharedState *state, int bookmark_index, int sender_tab_id)
         broadcast_message(state, BROADCAST_BOOKMARK_REMOVED, sender_tab_id, message);
     } else {
         unlock_shared_memory();
-        printf("[Bookmark] Error: Invalid bookmark index\n");
+        log_warn("[Bookmark] Invalid bookmark index");
     }
 }
 
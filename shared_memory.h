@@ -10,9 +10,11 @@
 
 #define SHM_KEY 9876
 #define SEM_KEY 5432
+#define VISITS_KEY 9877
 #define MAX_BOOKMARKS 50
 #define MAX_URL_LENGTH 256
 #define BROADCAST_MSG_SIZE 1024
+#define MAX_BROADCASTS 10
 
 // Semaphore operations
 union semun {
@@ -34,9 +36,20 @@ typedef enum {
     BROADCAST_BOOKMARK_REMOVED,
     BROADCAST_NEW_TAB,
     BROADCAST_TAB_CLOSED,
-    BROADCAST_PAGE_LOADED
+    BROADCAST_PAGE_LOADED,
+    BROADCAST_TYPE_COUNT
 } BroadcastType;
 
+#define BROADCAST_ALL_TYPES ((1u << BROADCAST_TYPE_COUNT) - 1)
+
+// Broadcasts a tab receives; zeroed, it receives all of them. Filtered
+// messages are marked processed for the tab when they are sent, so
+// neither the tab nor its process wakes up for them.
+typedef struct {
+    unsigned int ignored;               // 1 << type for each type not wanted
+    char url_prefix[MAX_URL_LENGTH];    // Page loads only under this prefix, "" for all
+} BroadcastFilter;
+
 // Broadcast message structure
 typedef struct {
     BroadcastType type;
@@ -57,25 +70,42 @@ typedef struct {
     int bookmark_count;
     
     // Broadcast messaging system
-    BroadcastMessage broadcast_messages[10];
+    BroadcastMessage broadcast_messages[MAX_BROADCASTS];
     int broadcast_count;
+    unsigned int broadcast_seq;  // Futex word, bumped on broadcasts a synced tab receives
+    BroadcastFilter filters[MAX_TABS];
     
     // Global statistics
     int total_pages_loaded;
     char last_loaded_url[MAX_URL_LENGTH];
     time_t last_activity;
+    
+    // Browser processes serving tabs, see instance_shard_of(); 0 means 1
+    int shard_count;
 } SharedState;
 
 // Function prototypes
 int init_shared_memory();
 int init_semaphores();
+int attach_semaphores();
+int find_shared_memory();
 void lock_shared_memory();
 void unlock_shared_memory();
 void *attach_shared_memory(int shmid);
 void detach_shared_memory(void *segment);
 void broadcast_message(SharedState *state, BroadcastType type, int sender_tab_id, const char *data);
 bool check_new_broadcasts(SharedState *state, int tab_id);
+int wait_for_broadcast(SharedState *state, unsigned int seen_seq);
+void wake_broadcast_waiters(SharedState *state);
 void process_broadcasts(SharedState *state, int tab_id);
+
+// Names used by the subscribe/unsubscribe commands
+const char *broadcast_type_name(BroadcastType type);
+
+// Parse a comma separated list of type names (bookmark-added,
+// bookmark-removed, new-tab, tab-closed, page-loaded, or bookmarks,
+// tabs, all) into a mask of 1 << type. Returns -1 on an unknown name.
+int parse_broadcast_types(const char *list, unsigned int *mask);
 void add_bookmark(SharedState *state, const char *url, const char *title, int sender_tab_id);
 void remove_bookmark(SharedState *state, int bookmark_index, int sender_tab_id);
 void cleanup_shared_resources(int shmid, int semid);
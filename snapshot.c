@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "log.h"
+
+static Snapshot *snapshot = NULL;
+static int restored_tabs = 0;
+static int attached = 0;
+
+static int same_layout(const Snapshot *s) {
+    return s->magic == SNAPSHOT_MAGIC && s->version == SNAPSHOT_VERSION &&
+           s->tab_state_size == sizeof(TabState) && s->max_tabs == MAX_TABS &&
+           s->bookmark_size == sizeof(Bookmark) && s->max_bookmarks == MAX_BOOKMARKS;
+}
+
+// A crash can stop the browser half way through updating a tab, so
+// restored tabs are made consistent before they are used
+static void repair_tab(TabState *state, int slot) {
+    if (state->tab_id <= 0 || state->tab_id % MAX_TABS != slot) {
+        memset(state, 0, sizeof(TabState));
+        return;
+    }
+
+    state->current_url[MAX_MSG - 1] = '\0';
+    for (int i = 0; i < 10; i++) state->history[i][MAX_MSG - 1] = '\0';
+    if (state->history_count < 0 || state->history_count > 10) state->history_count = 0;
+    if (state->history_position < -1 || state->history_position >= state->history_count) {
+        state->history_position = state->history_count - 1;
+    }
+
+    // Nothing is in flight any more; activity is counted from now
+    state->known_generation = 0;
+    state->last_active = time(NULL);
+    restored_tabs++;
+}
+
+TabState *snapshot_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("open snapshot");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        (st.st_size != sizeof(Snapshot) && ftruncate(fd, sizeof(Snapshot)) < 0)) {
+        perror("snapshot size");
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, sizeof(Snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap snapshot");
+        return NULL;
+    }
+    snapshot = map;
+
+    restored_tabs = 0;
+    if (st.st_size == sizeof(Snapshot) && same_layout(snapshot)) {
+        for (int i = 0; i < MAX_TABS; i++) repair_tab(&snapshot->tabs[i], i);
+        for (int i = 0; i < MAX_TABS; i++) {
+            // Leaders that did not survive are not followed
+            int leader = snapshot->tabs[i].following;
+            if (leader > 0 && snapshot->tabs[leader % MAX_TABS].tab_id != leader) {
+                snapshot->tabs[i].following = 0;
+            }
+        }
+        if (snapshot->bookmark_count < 0 || snapshot->bookmark_count > MAX_BOOKMARKS) {
+            snapshot->bookmark_count = 0;
+        }
+        log_info("[Session] Restored %d tabs and %d bookmarks from %s (%s)", restored_tabs,
+                 snapshot->bookmark_count, path, snapshot->clean ? "clean shutdown" : "after a crash");
+    } else {
+        if (st.st_size > 0) {
+            log_warn("[Session] %s was written by another version, starting a new session", path);
+        }
+        memset(snapshot, 0, sizeof(Snapshot));
+        snapshot->magic = SNAPSHOT_MAGIC;
+        snapshot->version = SNAPSHOT_VERSION;
+        snapshot->tab_state_size = sizeof(TabState);
+        snapshot->max_tabs = MAX_TABS;
+        snapshot->bookmark_size = sizeof(Bookmark);
+        snapshot->max_bookmarks = MAX_BOOKMARKS;
+    }
+    snapshot->clean = 0;
+    return snapshot->tabs;
+}
+
+TabState *snapshot_attach(const char *path) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open snapshot");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size != sizeof(Snapshot)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, sizeof(Snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap snapshot");
+        return NULL;
+    }
+    if (!same_layout(map)) {
+        munmap(map, sizeof(Snapshot));
+        return NULL;
+    }
+    snapshot = map;
+    attached = 1;
+    return snapshot->tabs;
+}
+
+int snapshot_restored() {
+    return restored_tabs;
+}
+
+void snapshot_restore_shared(SharedState *state) {
+    if (!snapshot) return;
+
+    lock_shared_memory();
+    memcpy(state->bookmarks, snapshot->bookmarks, sizeof(state->bookmarks));
+    state->bookmark_count = snapshot->bookmark_count;
+    state->total_pages_loaded = snapshot->total_pages_loaded;
+    memcpy(state->last_loaded_url, snapshot->last_loaded_url, MAX_URL_LENGTH);
+    state->last_loaded_url[MAX_URL_LENGTH - 1] = '\0';
+
+    // Tabs that were synced are still running and attach again by key
+    for (int i = 0; i < MAX_TABS; i++) {
+        if (snapshot->tabs[i].tab_id == 0) continue;
+        state->active_tab_count++;
+        state->tab_active[i] = snapshot->tabs[i].is_synced != 0;
+    }
+    unlock_shared_memory();
+}
+
+// The shared memory lock also keeps the broadcast manager's checkpoints
+// from racing snapshot_close()
+void snapshot_checkpoint(SharedState *state) {
+    if (!state) return;
+
+    lock_shared_memory();
+    if (snapshot && (snapshot->bookmark_count != state->bookmark_count ||
+                     snapshot->total_pages_loaded != state->total_pages_loaded ||
+                     memcmp(snapshot->bookmarks, state->bookmarks, sizeof(state->bookmarks)) != 0)) {
+        memcpy(snapshot->bookmarks, state->bookmarks, sizeof(state->bookmarks));
+        snapshot->bookmark_count = state->bookmark_count;
+        snapshot->total_pages_loaded = state->total_pages_loaded;
+        memcpy(snapshot->last_loaded_url, state->last_loaded_url, MAX_URL_LENGTH);
+        snapshot->checkpointed = time(NULL);
+        // Start writing back now; the page cache already has it
+        msync(snapshot, sizeof(Snapshot), MS_ASYNC);
+    }
+    unlock_shared_memory();
+}
+
+void snapshot_close(SharedState *state) {
+    snapshot_checkpoint(state);
+
+    lock_shared_memory();
+    if (snapshot && attached) {
+        munmap(snapshot, sizeof(Snapshot));
+        snapshot = NULL;
+    } else if (snapshot) {
+        snapshot->clean = 1;
+        if (msync(snapshot, sizeof(Snapshot), MS_SYNC) < 0) perror("msync snapshot");
+        munmap(snapshot, sizeof(Snapshot));
+        snapshot = NULL;
+    }
+    unlock_shared_memory();
+}
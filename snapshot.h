@@ -0,0 +1,64 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "common.h"
+#include "shared_memory.h"
+
+// Session snapshots.
+// The browser's TabStates live in a file mapped MAP_SHARED, so every
+// change is in the page cache the moment it is made and outlives a
+// crash of the browser process. Bookmarks and page statistics live in
+// the System V segment the tabs attach to, which cleanup() removes;
+// snapshot_checkpoint() copies them into the file when they change.
+// On startup a snapshot with the same layout is mapped as it is, without
+// parsing, and its bookmarks and statistics are copied into the new
+// segment.
+
+#define SNAPSHOT_MAGIC 0x50414e53    // "SNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_DEFAULT_PATH "browser_session.snap"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t tab_state_size;         // Layout check: a snapshot written by a
+    uint32_t max_tabs;               // build with other sizes is discarded
+    uint32_t bookmark_size;
+    uint32_t max_bookmarks;
+    int64_t checkpointed;            // Time of the last checkpoint
+    uint32_t clean;                  // Closed by snapshot_close()
+
+    // Copied from SharedState
+    Bookmark bookmarks[MAX_BOOKMARKS];
+    int bookmark_count;
+    int total_pages_loaded;
+    char last_loaded_url[MAX_URL_LENGTH];
+
+    TabState tabs[MAX_TABS];
+} Snapshot;
+
+// Map the snapshot at path, starting a new one if there is none or it
+// has another layout. Returns its TabStates, or NULL if the file cannot
+// be mapped. Restored tabs keep their history and sync settings.
+TabState *snapshot_open(const char *path);
+
+// Map the snapshot another process opened, for a browser shard. Its
+// header belongs to that process: snapshot_close() only unmaps it.
+TabState *snapshot_attach(const char *path);
+
+// Tabs brought back by snapshot_open()
+int snapshot_restored();
+
+// Copy the restored bookmarks and statistics into a new segment and mark
+// restored synced tabs active
+void snapshot_restore_shared(SharedState *state);
+
+// Copy bookmarks and statistics from the segment if they changed.
+// Takes the shared memory lock.
+void snapshot_checkpoint(SharedState *state);
+
+// Checkpoint, write the file out and unmap it
+void snapshot_close(SharedState *state);
+
+#endif
@@ -4,17 +4,20 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
-#include <pthread.h>
+#include <errno.h>
 #include <ncurses.h>
-#include <sys/shm.h>
-#include <sys/types.h>
-#include <sys/ipc.h>
+#include <poll.h>
 #include <signal.h>
 #include <time.h>
 #include <menu.h>
 #include <panel.h>
 #include "common.h"
 #include "shared_memory.h"
+#include "tabclient.h"
+#include "viewport.h"
+#include "log.h"
+#include "instance.h"
+#include "visits.h"
 
 // UI Constants - Simplified for basic UI
 #define COLOR_TITLE     1
@@ -26,22 +29,33 @@
 #define COLOR_HIGHLIGHT 7
 #define COLOR_WARNING   8
 
+// Screen regions tracked for damage; only dirty regions are redrawn
+#define DIRTY_TITLE     0x01
+#define DIRTY_CONTENT   0x02
+#define DIRTY_STATUS    0x04
+#define DIRTY_CMD       0x08
+#define DIRTY_MENU      0x10
+#define DIRTY_ALL       0x1f
+
+// What the command line is currently collecting
+enum { INPUT_NONE, INPUT_COMMAND, INPUT_LOAD, INPUT_FIND };
+
+// Panel slots, bottom to top
+enum { PANEL_TITLE, PANEL_CONTENT, PANEL_STATUS, PANEL_CMD, PANEL_MENU, NUM_PANELS };
+
 int tab_id;
-int write_fd;
-char response_fifo[64];
-WINDOW *mainwin;
+TabClient *client = NULL;
 WINDOW *cmdwin;
 WINDOW *contentwin;
 WINDOW *statuswin;
-WINDOW *notificationwin;
 WINDOW *titlewin;
 WINDOW *menuwin;
-PANEL *panels[5];
-int shmid = -1;
-int semid = -1;
-SharedState *shared_state = NULL;
-pthread_t response_thread;
-pthread_t sync_thread;
+PANEL *panels[NUM_PANELS];
+
+// Everything runs on one thread: a single poll() over the terminal,
+// the response FIFO and the broadcast eventfd drives the whole tab
+int dirty = DIRTY_ALL;
+Viewport viewport;
 int running = 1;
 int is_synced = 0;
 char notification[MAX_MSG];
@@ -64,39 +78,33 @@ int num_menu_items = 8;
 
 // Tab state
 char current_url[MAX_MSG] = "";
+unsigned int shown_generation = 0;   // Generation of the page in the viewport, 0 for text
 int is_connected = 0;
 
-// Global variable to track if a key was just pressed
-int key_just_pressed = 0;
+// Command line editor state
+int input_mode = INPUT_NONE;
+char input_line[MAX_MSG];
+int input_len = 0;
+
+// Inline URL completion from the browser's visit index, read directly
+// from its shared memory (attached on first use)
+VisitIndex *visit_index = NULL;
+char completion[MAX_URL_LENGTH];     // What would follow the typed URL
 
 // Forward declaration
-void update_status();
+void mark_dirty(int regions);
 
 void cleanup() {
-    // Stop threads
     running = 0;
-    pthread_cancel(response_thread);
-    pthread_cancel(sync_thread);
-    
-    // Clean up shared memory if attached
-    if (shared_state != NULL) {
-        // Update tab status in shared memory
-        if (is_synced) {
-            lock_shared_memory();
-            shared_state->tab_active[tab_id % MAX_TABS] = false;
-            unlock_shared_memory();
-            
-            // Broadcast tab closed message
-            broadcast_message(shared_state, BROADCAST_TAB_CLOSED, tab_id, "Tab closed");
-        }
-        
-        detach_shared_memory(shared_state);
-        printf("[Tab %d] Detached from shared memory.\n", tab_id);
-    }
     
-    // Remove FIFO
-    unlink(response_fifo);
-    printf("[Tab %d] FIFO removed.\n", tab_id);
+    // Announces the close to synced tabs, detaches shared memory and removes the FIFO
+    if (client != NULL) {
+        tab_client_close(client);
+        client = NULL;
+        printf("[Tab %d] Disconnected and FIFO removed.\n", tab_id);
+    }
+    visits_detach(visit_index);
+    log_close();
 }
 
 void signal_handler(int sig) {
@@ -106,32 +114,15 @@ void signal_handler(int sig) {
     exit(0);
 }
 
-// Changed name to avoid conflict with shared_memory.h
-int init_shared_memory_connection() {
-    // Try to access shared memory
-    shmid = shmget(SHM_KEY, sizeof(SharedState), 0666);
-    if (shmid < 0) {
-        // Can't access shared memory yet
-        return -1;
-    }
-    
-    // Attach to shared memory - use proper casting
-    shared_state = (SharedState *)attach_shared_memory(shmid);
-    if (!shared_state) {
-        perror("shmat");
+// Send a text command to the browser, keeping the local sync flag in step
+int send_command(const char *command) {
+    if (tab_client_send(client, command) < 0) {
         return -1;
     }
-    
-    // Try to access semaphores
-    semid = semget(SEM_KEY, 1, 0666);
-    if (semid < 0) {
-        perror("semget");
-        detach_shared_memory(shared_state);
-        shared_state = NULL;
-        return -1;
+    if (is_synced != tab_client_is_synced(client)) {
+        is_synced = tab_client_is_synced(client);
+        mark_dirty(DIRTY_STATUS);
     }
-    
-    printf("[Tab %d] Attached to shared memory with ID: %d\n", tab_id, shmid);
     return 0;
 }
 
@@ -140,103 +131,158 @@ void draw_borders(WINDOW *win) {
     box(win, '|', '-');
 }
 
+// Flag screen regions for the next render_ui()
+void mark_dirty(int regions) {
+    dirty |= regions;
+}
+
 // Show notification that persists longer
 void show_notification(const char *message) {
-    if (!statuswin) return;
-    
-    // Clear notification line
-    int rows, cols;
-    getmaxyx(statuswin, rows, cols);
-    wmove(statuswin, rows - 1, 1);
-    wclrtoeol(statuswin);
-    
-    // Display new notification
-    mvwprintw(statuswin, rows - 1, 2, "Message: %s", message);
-    wrefresh(statuswin);
-    
     // Store for persistence - show for 10 seconds instead of 5
     strncpy(notification, message, MAX_MSG - 1);
     notification[MAX_MSG - 1] = '\0';
     notification_time = time(NULL) + 10; // Show for 10 seconds
+    dirty |= DIRTY_STATUS;
 }
 
-// Update notification based on timestamp
-void check_notification() {
-    if (notification[0] != '\0' && notification_time > time(NULL)) {
-        int rows, cols;
-        getmaxyx(statuswin, rows, cols);
-        mvwprintw(statuswin, rows - 1, 2, "Message: %s", notification);
-        wrefresh(statuswin);
+// Drop the notification once it has been shown long enough.
+// Returns the poll() timeout in ms until the next expiry, or -1 for none.
+int check_notification() {
+    if (notification[0] == '\0') return -1;
+    
+    time_t now = time(NULL);
+    if (notification_time <= now) {
+        notification[0] = '\0';
+        dirty |= DIRTY_STATUS;
+        return -1;
     }
+    return (int)(notification_time - now) * 1000;
 }
 
-// Simplified UI update function
-void update_ui() {
-    clear();
-    
+// Create the windows and panels once; layout_ui() sizes them
+void create_ui() {
+    titlewin = newwin(1, 1, 0, 0);
+    contentwin = newwin(1, 1, 0, 0);
+    statuswin = newwin(1, 1, 0, 0);
+    cmdwin = newwin(1, 1, 0, 0);
+    menuwin = newwin(num_menu_items + 2, 30, 3, 5);
+    
+    panels[PANEL_TITLE] = new_panel(titlewin);
+    panels[PANEL_CONTENT] = new_panel(contentwin);
+    panels[PANEL_STATUS] = new_panel(statuswin);
+    panels[PANEL_CMD] = new_panel(cmdwin);
+    panels[PANEL_MENU] = new_panel(menuwin);
+    hide_panel(panels[PANEL_MENU]);
+    
+    keypad(cmdwin, TRUE);
+}
+
+// Fit the existing windows to the terminal; called at start and on KEY_RESIZE
+void layout_ui() {
     int term_rows, term_cols;
     getmaxyx(stdscr, term_rows, term_cols);
-    
-    // Title area - simple text
-    mvprintw(0, 0, "=== Mini Browser - Tab %d ===", tab_id);
-    mvprintw(1, 0, "URL: %s", current_url);
-    refresh();
-    
-    // Content area - simple box
-    contentwin = newwin(term_rows - 6, term_cols, 2, 0);
+    if (term_rows < 8) term_rows = 8;
+    if (term_cols < 32) term_cols = 32;
+    
+    wresize(titlewin, 2, term_cols);
+    move_panel(panels[PANEL_TITLE], 0, 0);
+    wresize(contentwin, term_rows - 6, term_cols);
+    move_panel(panels[PANEL_CONTENT], 2, 0);
+    viewport_resize(&viewport, term_rows - 8, term_cols - 4); // Inside the border
+    wresize(statuswin, 3, term_cols);
+    move_panel(panels[PANEL_STATUS], term_rows - 4, 0);
+    wresize(cmdwin, 1, term_cols);
+    move_panel(panels[PANEL_CMD], term_rows - 1, 0);
+    
+    // Everything moved, so the whole screen has to be repainted once
+    clearok(curscr, TRUE);
+    mark_dirty(DIRTY_ALL);
+}
+
+// The draw_* functions only update window contents; render_ui() flushes them
+
+void draw_title() {
+    werase(titlewin);
+    mvwprintw(titlewin, 0, 0, "=== Mini Browser - Tab %d ===", tab_id);
+    mvwprintw(titlewin, 1, 0, "URL: %s", current_url);
+}
+
+// Draws only the visible slice of the document: O(visible lines)
+void draw_content() {
+    werase(contentwin);
     draw_borders(contentwin);
-    mvwprintw(contentwin, 0, 2, "Content:");
-    wrefresh(contentwin);
     
-    // Status area - simple text
-    statuswin = newwin(3, term_cols, term_rows - 4, 0);
+    if (viewport.line_count > 1) {
+        int last = viewport.top_line + viewport.rows;
+        if (last > viewport.line_count) last = viewport.line_count;
+        mvwprintw(contentwin, 0, 2, "Content: lines %d-%d of %d", 
+                  viewport.top_line + 1, last, viewport.line_count);
+    } else {
+        mvwprintw(contentwin, 0, 2, "Content:");
+    }
+    
+    int search_len = strlen(viewport.search);
+    for (int row = 0; row < viewport.rows; row++) {
+        int line = viewport.top_line + row;
+        int length;
+        const char *text = viewport_line(&viewport, line, &length);
+        if (!text) break;
+        if (length <= viewport.left_col) continue;
+        
+        int visible = length - viewport.left_col;
+        if (visible > viewport.cols) visible = viewport.cols;
+        mvwaddnstr(contentwin, row + 1, 2, text + viewport.left_col, visible);
+        
+        // Highlight the current search match if it is on screen
+        if (line == viewport.match_line && search_len > 0) {
+            int col = viewport.match_col - viewport.left_col;
+            if (col >= 0 && col < viewport.cols) {
+                mvwchgat(contentwin, row + 1, 2 + col, search_len, A_REVERSE, 0, NULL);
+            }
+        }
+    }
+}
+
+void draw_status() {
+    werase(statuswin);
     draw_borders(statuswin);
     mvwprintw(statuswin, 0, 2, "Status: %s | Sync: %s", 
               is_connected ? "Connected" : "Disconnected", 
               is_synced ? "On" : "Off");
-    mvwprintw(statuswin, 1, 2, "F1:Menu F2:Load F3:Reload F10:Exit c:Command");
-    wrefresh(statuswin);
+    mvwprintw(statuswin, 1, 2, "F1:Menu F2:Load F3:Reload F10:Exit c:Command PgUp/PgDn:Scroll /:Find n:Next");
     
-    // Command/notification area
-    cmdwin = newwin(1, term_cols, term_rows - 1, 0);
-    mvwprintw(cmdwin, 0, 0, "Command > ");
-    wrefresh(cmdwin);
-    
-    // Simple menu window (hidden by default)
-    menuwin = newwin(num_menu_items + 2, 25, 3, 5);
-    
-    // Set notification window
-    notificationwin = statuswin;
-    
-    // Restore any active notification
-    if (notification[0] != '\0' && notification_time > time(NULL)) {
-        int rows, cols;
-        getmaxyx(statuswin, rows, cols);
+    if (notification[0] != '\0') {
+        int rows = getmaxy(statuswin);
         mvwprintw(statuswin, rows - 1, 2, "Message: %s", notification);
-        wrefresh(statuswin);
     }
-    
-    refresh();
 }
 
-// Simplified status update
-void update_status() {
-    if (!statuswin) return;
-    
-    mvwprintw(statuswin, 0, 2, "Status: %s | Sync: %s", 
-              is_connected ? "Connected" : "Disconnected", 
-              is_synced ? "On" : "Off");
-    wrefresh(statuswin);
+void draw_cmd() {
+    werase(cmdwin);
+    switch (input_mode) {
+        case INPUT_LOAD: mvwprintw(cmdwin, 0, 0, "Load > "); break;
+        case INPUT_FIND: mvwprintw(cmdwin, 0, 0, "Find > "); break;
+        default:         mvwprintw(cmdwin, 0, 0, "Command > "); break;
+    }
     
-    // Preserve notification if it exists
-    check_notification();
+    // Show the tail of the line if it is wider than the window
+    int avail = getmaxx(cmdwin) - getcurx(cmdwin) - 1;
+    int start = input_len > avail ? input_len - avail : 0;
+    waddnstr(cmdwin, input_line + start, input_len - start);
+    
+    // The completion is dimmed after the cursor; Tab or Right accepts it
+    if (completion[0] != '\0') {
+        int y, x;
+        getyx(cmdwin, y, x);
+        wattron(cmdwin, A_DIM);
+        waddnstr(cmdwin, completion, getmaxx(cmdwin) - x - 1);
+        wattroff(cmdwin, A_DIM);
+        wmove(cmdwin, y, x);
+    }
 }
 
 // Simplified menu display
-void display_menu() {
-    if (!menuwin) return;
-    
-    // Create a new menu window each time to ensure it's visible
+void draw_menu() {
     werase(menuwin);
     draw_borders(menuwin);
     mvwprintw(menuwin, 0, 2, "Menu");
@@ -250,249 +296,309 @@ void display_menu() {
             mvwprintw(menuwin, i + 1, 2, "   %s", tab_menu_items[i]);
         }
     }
+}
+
+// Show or hide the menu overlay; the panel library repaints what it covered
+void set_menu_visible(int visible) {
+    show_menu = visible;
+    if (visible) {
+        show_panel(panels[PANEL_MENU]);
+        mark_dirty(DIRTY_MENU);
+    } else {
+        hide_panel(panels[PANEL_MENU]);
+        mark_dirty(DIRTY_CMD);
+    }
+}
+
+// Redraw the dirty regions and push them to the terminal with one doupdate().
+// Does nothing when nothing changed, so an idle tab writes no bytes.
+void render_ui() {
+    int regions = dirty;
+    dirty = 0;
+    
+    if (regions == 0) {
+        return;
+    }
+    
+    if (regions & DIRTY_TITLE) draw_title();
+    if (regions & DIRTY_CONTENT) draw_content();
+    if (regions & DIRTY_STATUS) draw_status();
+    if (regions & DIRTY_CMD) draw_cmd();
+    if ((regions & DIRTY_MENU) && show_menu) draw_menu();
+    
+    update_panels();
+    if (input_mode != INPUT_NONE) {
+        // Leave the terminal cursor at the end of the line being edited
+        wnoutrefresh(cmdwin);
+    }
+    doupdate();
+}
+
+// Turn a broadcast from another tab into a notification
+void on_tab_broadcast(TabClient *c, const BroadcastMessage *msg, void *user_data) {
+    char notification_msg[MAX_MSG];
+    
+    // Process based on type
+    switch (msg->type) {
+        case BROADCAST_BOOKMARK_ADDED:
+            snprintf(notification_msg, MAX_MSG, 
+                    "💾 Tab %d added bookmark: %.400s", 
+                    msg->sender_tab_id, msg->data);
+            break;
+            
+        case BROADCAST_BOOKMARK_REMOVED:
+            snprintf(notification_msg, MAX_MSG, 
+                    "🗑️ Tab %d removed bookmark: %.400s", 
+                    msg->sender_tab_id, msg->data);
+            break;
+            
+        case BROADCAST_NEW_TAB:
+            snprintf(notification_msg, MAX_MSG, 
+                    "📄 New tab opened: %d", 
+                    msg->sender_tab_id);
+            break;
+            
+        case BROADCAST_TAB_CLOSED:
+            snprintf(notification_msg, MAX_MSG, 
+                    "❌ Tab %d closed", 
+                    msg->sender_tab_id);
+            break;
+            
+        case BROADCAST_PAGE_LOADED:
+            snprintf(notification_msg, MAX_MSG, 
+                    "🔄 Tab %d loaded page: %.400s", 
+                    msg->sender_tab_id, msg->data);
+            break;
+            
+        default:
+            return; // Skip showing notification
+    }
     
-    // Force refresh and bring to front
-    redrawwin(menuwin);
-    wrefresh(menuwin);
+    // Show notification
+    show_notification(notification_msg);
 }
 
-// Process broadcast messages
-void *sync_thread_func(void *arg) {
-    // Try to attach to shared memory if not already attached
-    if (!shared_state && init_shared_memory_connection() < 0) {
-        printf("[Tab %d] Failed to attach to shared memory for sync thread\n", tab_id);
-        pthread_exit(NULL);
+// Keep a response from the browser in the viewport and repaint it.
+// Cached pages arrive first from libtabclient; the browser's "not
+// modified" that follows only repaints if something else was shown since.
+void on_tab_response(TabClient *c, const TabResponse *response, void *user_data) {
+    if (strcmp(current_url, response->url) != 0) {
+        snprintf(current_url, sizeof(current_url), "%s", response->url);
+        mark_dirty(DIRTY_TITLE);
     }
     
-    while (running) {
-        if (shared_state && is_synced) {
-            // Check for new broadcasts
-            if (check_new_broadcasts(shared_state, tab_id)) {
-                lock_shared_memory();
-                
-                // Process each message
-                for (int i = 0; i < 10; i++) {
-                    BroadcastMessage *msg = &shared_state->broadcast_messages[i];
-                    
-                    if (msg->timestamp > 0 && !msg->processed[tab_id]) {
-                        // Mark as processed
-                        msg->processed[tab_id] = true;
-                        
-                        // Only process if not from self
-                        if (msg->sender_tab_id != tab_id) {
-                            char notification_msg[MAX_MSG];
-                            
-                            // Process based on type
-                            switch (msg->type) {
-                                case BROADCAST_BOOKMARK_ADDED:
-                                    snprintf(notification_msg, MAX_MSG, 
-                                            "💾 Tab %d added bookmark: %s", 
-                                            msg->sender_tab_id, msg->data);
-                                    break;
-                                    
-                                case BROADCAST_BOOKMARK_REMOVED:
-                                    snprintf(notification_msg, MAX_MSG, 
-                                            "🗑️ Tab %d removed bookmark: %s", 
-                                            msg->sender_tab_id, msg->data);
-                                    break;
-                                    
-                                case BROADCAST_NEW_TAB:
-                                    snprintf(notification_msg, MAX_MSG, 
-                                            "📄 New tab opened: %d", 
-                                            msg->sender_tab_id);
-                                    break;
-                                    
-                                case BROADCAST_TAB_CLOSED:
-                                    snprintf(notification_msg, MAX_MSG, 
-                                            "❌ Tab %d closed", 
-                                            msg->sender_tab_id);
-                                    break;
-                                    
-                                case BROADCAST_PAGE_LOADED:
-                                    snprintf(notification_msg, MAX_MSG, 
-                                            "🔄 Tab %d loaded page: %s", 
-                                            msg->sender_tab_id, msg->data);
-                                    break;
-                                    
-                                default:
-                                    continue; // Skip showing notification
-                            }
-                            
-                            // Show notification
-                            show_notification(notification_msg);
-                        }
-                    }
-                }
-                
-                unlock_shared_memory();
+    if (response->kind == RESP_NOT_MODIFIED &&
+        (!response->text || response->generation == shown_generation)) {
+        return;
+    }
+    
+    // A patch to what is on screen keeps the scroll position and only
+    // repaints the content if a changed line is visible
+    if (response->kind == RESP_PATCH && response->base_generation == shown_generation) {
+        int line_count = viewport.line_count;
+        if (viewport_update_text(&viewport, response->text, response->length) == 0) {
+            shown_generation = response->generation;
+            if (viewport.line_count != line_count ||
+                (response->last_changed >= viewport.top_line &&
+                 response->first_changed < viewport.top_line + viewport.rows)) {
+                mark_dirty(DIRTY_CONTENT);
             }
         }
-        
-        // Check every second
-        sleep(1);
+        return;
+    }
+    
+    if (viewport_set_text(&viewport, response->text, response->length) == 0) {
+        shown_generation = response->kind == RESP_TEXT ? 0 : response->generation;
+        dirty |= DIRTY_CONTENT | DIRTY_TITLE | DIRTY_STATUS;
+    }
+}
+
+// Start collecting a line on the command line without blocking the loop
+void begin_input(int mode) {
+    input_mode = mode;
+    input_len = 0;
+    input_line[0] = '\0';
+    completion[0] = '\0';
+    curs_set(1);
+    mark_dirty(DIRTY_CMD);
+}
+
+// Look up the most frecent visited URL that the typed one begins, for
+// "Load >" and for a "load " command
+void update_completion() {
+    completion[0] = '\0';
+    const char *prefix = NULL;
+    if (input_mode == INPUT_LOAD) {
+        prefix = input_line;
+    } else if (input_mode == INPUT_COMMAND && strncmp(input_line, "load ", 5) == 0) {
+        prefix = input_line + 5;
     }
+    if (prefix == NULL || prefix[0] == '\0') return;
     
-    return NULL;
+    if (visit_index == NULL) visit_index = visits_attach(0);
+    char url[MAX_URL_LENGTH];
+    if (visits_complete(visit_index, prefix, url, sizeof(url))) {
+        snprintf(completion, sizeof(completion), "%s", url + strlen(prefix));
+    }
 }
 
-// Hàm lắng nghe và hiển thị nội dung
-void *listen_response(void *arg) {
-    int read_fd = open(response_fifo, O_RDONLY);
-    if (read_fd < 0) {
-        perror("open response fifo");
-        pthread_exit(NULL);
+// Scrolling and search keys for the content area; returns 1 if handled
+int handle_content_key(int ch) {
+    switch (ch) {
+        case KEY_NPAGE: viewport_page(&viewport, 1); break;
+        case KEY_PPAGE: viewport_page(&viewport, -1); break;
+        case KEY_DOWN:  viewport_scroll(&viewport, 1); break;
+        case KEY_UP:    viewport_scroll(&viewport, -1); break;
+        case KEY_RIGHT: viewport_hscroll(&viewport, viewport.cols / 2); break;
+        case KEY_LEFT:  viewport_hscroll(&viewport, -viewport.cols / 2); break;
+        case KEY_HOME:  viewport_home(&viewport); break;
+        case KEY_END:   viewport_end(&viewport); break;
+        case '/':       begin_input(INPUT_FIND); return 1;
+        case 'n':
+            if (viewport_search_next(&viewport) < 0) {
+                show_notification("Not found");
+            }
+            break;
+        default:
+            return 0;
     }
+    dirty |= DIRTY_CONTENT;
+    return 1;
+}
 
-    char response[MAX_MSG * 2];
-    while (running) {
-        // Use non-blocking reads with a timeout
-        fd_set readfds;
-        struct timeval tv;
-        
-        FD_ZERO(&readfds);
-        FD_SET(read_fd, &readfds);
-        
-        // Set 1 second timeout
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        
-        int result = select(read_fd + 1, &readfds, NULL, NULL, &tv);
-        
-        if (result > 0 && FD_ISSET(read_fd, &readfds)) {
-            // Clear buffer
-            memset(response, 0, sizeof(response));
-            
-            // Use buffered read for better performance
-            size_t total_read = 0;
-            size_t bytes_read = 0;
+// Run a command typed on the command line
+void run_command(const char *input) {
+    // Process command
+    if (strcmp(input, "exit") == 0) {
+        running = 0; 
+        return;
+    }
+    
+    // Send command to browser
+    if (send_command(input) < 0) {
+        show_notification("Error sending command!");
+    } else {
+        char notification_text[MAX_MSG];
+        snprintf(notification_text, MAX_MSG, "Command sent: %.480s", input);
+        show_notification(notification_text);
+    }
+}
+
+// Act on a finished line
+void submit_input() {
+    int mode = input_mode;
+    input_mode = INPUT_NONE;
+    curs_set(0);
+    mark_dirty(DIRTY_CMD);
+    
+    if (input_len == 0) {
+        return;
+    }
+    
+    char command[MAX_MSG];
+    switch (mode) {
+        case INPUT_COMMAND:
+            run_command(input_line);
+            break;
             
-            do {
-                bytes_read = read(read_fd, response + total_read, 
-                                 sizeof(response) - total_read - 1);
-                if (bytes_read > 0) {
-                    total_read += bytes_read;
-                }
-            } while (bytes_read > 0 && total_read < sizeof(response) - 1);
+        case INPUT_LOAD:
+            snprintf(command, sizeof(command), "load %.*s", 
+                    (int)(sizeof(command) - 6), input_line);
+            run_command(command);
+            break;
             
-            if (total_read > 0) {
-                response[total_read] = '\0'; // Null terminate
-                
-                werase(contentwin);
-                draw_borders(contentwin);
-                mvwprintw(contentwin, 0, 2, "Content:");
-                
-                int win_rows, win_cols;
-                getmaxyx(contentwin, win_rows, win_cols);
-                int max_line_len = win_cols - 4;
-                int max_lines = win_rows - 1;
-                
-                int line = 1;
-                char *token = strtok(response, "\n");
-                while (token && line < max_lines) {
-                    mvwprintw(contentwin, line++, 2, "%.80s", token);
-                    token = strtok(NULL, "\n");
-                }
-                wrefresh(contentwin);
-                
-                // Update URL display
-                mvprintw(1, 0, "URL: %-80s", current_url);
-                refresh();
-                
-                update_status();
+        case INPUT_FIND:
+            if (viewport_search(&viewport, input_line) < 0) {
+                show_notification("Not found");
             }
-        }
+            mark_dirty(DIRTY_CONTENT);
+            break;
     }
+}
 
-    close(read_fd);
-    return NULL;
+// Line editing keys while the command line is active
+void handle_input_key(int ch) {
+    switch (ch) {
+        case 10:
+        case 13:
+        case KEY_ENTER:
+            submit_input();
+            break;
+            
+        case 27: // ESC cancels
+            input_mode = INPUT_NONE;
+            curs_set(0);
+            break;
+            
+        case 9: // Tab
+        case KEY_RIGHT:
+            if (completion[0] != '\0') {
+                input_len += snprintf(input_line + input_len, sizeof(input_line) - 6 - input_len,
+                                      "%s", completion);
+                if (input_len > (int)sizeof(input_line) - 7) input_len = sizeof(input_line) - 7;
+            }
+            break;
+            
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            if (input_len > 0) {
+                input_line[--input_len] = '\0';
+            }
+            break;
+            
+        default:
+            if (ch >= 32 && ch < 256 && input_len < (int)sizeof(input_line) - 6) {
+                input_line[input_len++] = (char)ch;
+                input_line[input_len] = '\0';
+            }
+            break;
+    }
+    update_completion();
+    mark_dirty(DIRTY_CMD);
 }
 
 // Handle menu selection
 void handle_menu_action() {
-    BrowserMessage msg;
-    msg.tab_id = tab_id;
-    msg.timestamp = time(NULL);
-    msg.use_shared_memory = 0;
-    msg.shared_memory_id = -1;
-    char input[MAX_MSG];
-    
     switch (selected_menu_item) {
         case 0: // Load Page
             show_notification("Enter URL to load");
-            echo();
-            wmove(cmdwin, 0, 11);  // Position after "Command > "
-            wgetnstr(cmdwin, input, MAX_MSG - 6);
-            noecho();
-            
-            if (strlen(input) > 0) {
-                snprintf(msg.command, sizeof(msg.command), "load %.*s", 
-                        (int)(sizeof(msg.command) - 6), input);
-                msg.cmd_type = CMD_LOAD;
-                strncpy(current_url, input, MAX_MSG - 1);
-                current_url[MAX_MSG - 1] = '\0';
-                update_ui();
-                if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                    perror("write");
-                    show_notification("Error sending command!");
-                } else {
-                    show_notification("Page loading...");
-                }
-            }
+            begin_input(INPUT_LOAD);
             break;
             
         case 1: // Reload
-            strcpy(msg.command, "reload");
-            msg.cmd_type = CMD_RELOAD;
-            if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                perror("write");
+            if (send_command("reload") < 0) {
+                show_notification("Error sending command!");
             }
             break;
             
         case 2: // Back
-            strcpy(msg.command, "back");
-            msg.cmd_type = CMD_BACK;
-            if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                perror("write");
+            if (send_command("back") < 0) {
+                show_notification("Error sending command!");
             }
             break;
             
         case 3: // Forward
-            strcpy(msg.command, "forward");
-            msg.cmd_type = CMD_FORWARD;
-            if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                perror("write");
+            if (send_command("forward") < 0) {
+                show_notification("Error sending command!");
             }
             break;
             
         case 4: // Bookmarks
-            strcpy(msg.command, "bookmarks");
-            msg.cmd_type = CMD_BOOKMARK_LIST;
-            if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                perror("write");
+            if (send_command("bookmarks") < 0) {
+                show_notification("Error sending command!");
             }
             break;
             
         case 5: // History
-            strcpy(msg.command, "history");
-            msg.cmd_type = CMD_HISTORY;
-            if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                perror("write");
+            if (send_command("history") < 0) {
+                show_notification("Error sending command!");
             }
             break;
             
         case 6: // Toggle Sync
-            if (is_synced) {
-                strcpy(msg.command, "sync off");
-                msg.cmd_type = CMD_SYNC_OFF;
-                is_synced = 0;
-            } else {
-                strcpy(msg.command, "sync on");
-                msg.cmd_type = CMD_SYNC_ON;
-                is_synced = 1;
-            }
-            update_status();
-            if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                perror("write");
+            if (send_command(is_synced ? "sync off" : "sync on") < 0) {
+                show_notification("Error sending command!");
             }
             break;
             
@@ -502,37 +608,120 @@ void handle_menu_action() {
     }
     
     // Hide menu after action
-    show_menu = 0;
+    set_menu_visible(0);
+}
+
+// Dispatch one key press from the terminal
+void handle_key(int ch) {
+    // Resize the existing windows instead of recreating them
+    if (ch == KEY_RESIZE) {
+        layout_ui();
+        return;
+    }
+    
+    if (input_mode != INPUT_NONE) {
+        handle_input_key(ch);
+        return;
+    }
+    
+    // Only hide menu if a key is pressed AND it's not a menu navigation key
+    if (show_menu && ch != KEY_UP && ch != KEY_DOWN && ch != 10 && ch != 27 && ch != KEY_F(1)) {
+        // Only close the menu if a non-menu key is pressed
+        set_menu_visible(0);
+    }
+    
+    if (show_menu) { // Xử lý khi menu đang hiện
+        switch (ch) {
+            case KEY_UP:
+                selected_menu_item = (selected_menu_item + num_menu_items - 1) % num_menu_items;
+                mark_dirty(DIRTY_MENU);
+                break;
+            case KEY_DOWN:
+                selected_menu_item = (selected_menu_item + 1) % num_menu_items;
+                mark_dirty(DIRTY_MENU);
+                break;
+            case 10: // Enter
+                handle_menu_action();
+                break;
+            case 27: // ESC
+            case KEY_F(1):
+                set_menu_visible(0);
+                break;
+        }
+        return;
+    }
+    
+    // Xử lý khi không ở trong menu
+    switch (ch) {
+        case KEY_F(1): // F1 - Show menu
+            selected_menu_item = 0;
+            set_menu_visible(1);
+            show_notification("Menu displayed - Use arrow keys to navigate");
+            break;
+        case KEY_F(2): // F2 - Load (Dùng chế độ nhập lệnh)
+        case 'c':      // c - Command mode
+            begin_input(INPUT_COMMAND);
+            break;
+
+        case KEY_F(3): // F3 - Reload
+            show_notification("Reloading page...");
+            if (send_command("reload") < 0) show_notification("Error sending command!");
+            break;
+            
+        // Các phím F khác có thể thêm tương tự hoặc để trong menu F1
+        
+        case KEY_F(10): // F10 - Exit
+            running = 0;
+            break;
+            
+        default:
+            handle_content_key(ch);
+            break;
+    }
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <tab_id>\n", argv[0]);
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <tab_id> [instance]\n", argv[0]);
         return 1;
     }
     tab_id = atoi(argv[1]);
     
+    // Browser instance to connect to, by default INSTANCE_ENV's
+    if (instance_select(argc == 3 ? argv[2] : NULL) < 0) {
+        fprintf(stderr, "[Tab %d] Invalid instance name\n", tab_id);
+        return 1;
+    }
+    
     printf("[Tab %d] Bat dau khoi tao...\n", tab_id);
     fflush(stdout);
 
     // Set up signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    
+    // Library messages must not reach the ncurses screen: log to the file only
+    LogConfig log_config = {
+        .path = instance_get()->log_path,
+        .max_bytes = LOG_DEFAULT_MAX_BYTES,
+        .keep = LOG_DEFAULT_KEEP,
+        .echo_fd = -1,
+        .level = LOG_LEVEL_INFO
+    };
+    log_open(&log_config);
 
-    // Tạo FIFO
-    snprintf(response_fifo, sizeof(response_fifo), "%s%d", RESPONSE_FIFO_PREFIX, tab_id);
-    mkfifo(response_fifo, 0666);
-    printf("[Tab %d] Response FIFO '%s' created.\n", tab_id, response_fifo);
-    fflush(stdout);
-
-    // Kết nối tới browser FIFO
+    // Tạo FIFO và kết nối tới browser FIFO
     printf("[Tab %d] Dang ket noi toi browser...\n", tab_id);
     fflush(stdout);
-    write_fd = open(BROWSER_FIFO, O_WRONLY);
-    if (write_fd < 0) {
+    TabClientCallbacks callbacks = {
+        .on_response = on_tab_response,
+        .on_broadcast = on_tab_broadcast,
+        .user_data = NULL
+    };
+    client = tab_client_open(tab_id, &callbacks);
+    if (client == NULL) {
         perror("open browser fifo");
         fprintf(stderr, "[Tab %d] Loi: Khong the ket noi toi browser. Dam bao ./browser dang chay.\n", tab_id);
-        unlink(response_fifo); // Xóa response fifo nếu không kết nối được
         exit(1);
     }
     is_connected = 1;
@@ -540,7 +729,7 @@ int main(int argc, char *argv[]) {
     fflush(stdout);
     
     // Kết nối shared memory (không bắt buộc phải thành công ngay)
-    if (init_shared_memory_connection() == 0) {
+    if (tab_client_attach_shared(client) == 0) {
         printf("[Tab %d] Da ket noi Shared Memory.\n", tab_id);
     } else {
         printf("[Tab %d] Canh bao: Chua ket noi Shared Memory.\n", tab_id);
@@ -555,216 +744,66 @@ int main(int argc, char *argv[]) {
     }
     cbreak();
     noecho();
+    curs_set(0);
+    set_escdelay(25);
     keypad(stdscr, TRUE);
     
-    // Draw UI and start threads
-    update_ui();
-    
     // Disable fancy colors, just use basic UI
     if (has_colors()) {
         start_color();
         init_pair(1, COLOR_WHITE, COLOR_BLACK);
     }
     
-    // CRITICAL: Start the response thread to receive data from browser
-    if (pthread_create(&response_thread, NULL, listen_response, NULL) != 0) {
-        endwin();
-        fprintf(stderr, "[Tab %d] Error: Cannot create response thread.\n", tab_id);
-        exit(1);
-    }
-    
-    // Optional: Start sync thread for tab synchronization
-    if (pthread_create(&sync_thread, NULL, sync_thread_func, NULL) != 0) {
+    // Create the windows once, then draw UI
+    viewport_init(&viewport);
+    refresh();
+    create_ui();
+    layout_ui();
+    nodelay(cmdwin, TRUE); // Keys are read only when poll() says stdin is ready
+    
+    // Wake-ups: 0 = terminal, 1 = browser responses, 2 = broadcasts (optional)
+    struct pollfd fds[3];
+    int nfds = 2;
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = tab_client_response_fd(client);
+    fds[1].events = POLLIN;
+    fds[2].fd = tab_client_broadcast_fd(client);
+    fds[2].events = POLLIN;
+    if (fds[2].fd >= 0) {
+        nfds = 3;
+    } else {
         // Non-critical, just show warning
         show_notification("Warning: Sync functionality unavailable");
-    } else {
-        printf("[Tab %d] Sync thread started\n", tab_id);
     }
     
     // Notification that will persist
     show_notification("SIMPLIFIED UI: Testing functionality - English interface");
     
-    // Main event loop
-    int ch;
-    BrowserMessage msg;
-    msg.tab_id = tab_id;
-    char input[MAX_MSG];
-    
+    // Main event loop: sleeps in poll() until there is input, a response,
+    // a broadcast or a notification to expire
     while (running) {
-        // Reset key press flag at the start of each loop
-        key_just_pressed = 0;
+        int timeout_ms = check_notification();
+        render_ui();
         
-        if (show_menu) {
-            display_menu();
-        } else {
-            // Check and refresh notifications if needed
-            check_notification();
-            
-            // Periodic refresh to keep UI stable
-            touchwin(stdscr);
-            refresh();
+        int ready = poll(fds, nfds, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            break;
         }
         
-        timeout(100); // Shorter timeout for more responsive UI
-        ch = getch();
-        
-        // Mark that a key was pressed if not ERR
-        if (ch != ERR) {
-            key_just_pressed = 1;
+        // Always drain ncurses: a SIGWINCH interrupts poll() and shows up as KEY_RESIZE
+        int ch;
+        while (running && (ch = wgetch(cmdwin)) != ERR) {
+            handle_key(ch);
         }
         
-        // Handle menu display
-        // IMPORTANT CHANGE: Only hide menu if a key is pressed AND it's not a menu navigation key
-        if (show_menu && ch != ERR && ch != KEY_UP && ch != KEY_DOWN && ch != 10 && ch != 27 && ch != KEY_F(1)) {
-            // Only close the menu if a non-menu key is pressed
-            werase(menuwin);
-            wrefresh(menuwin);
-            show_menu = 0;
-            update_ui(); // Redraw the UI after hiding menu
-        }
-
-        if (ch == ERR) { // Timeout
-            continue;
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            tab_client_dispatch(client);
         }
         
-        if (show_menu) { // Xử lý khi menu đang hiện
-            switch (ch) {
-                case KEY_UP:
-                    selected_menu_item = (selected_menu_item + num_menu_items - 1) % num_menu_items;
-                    display_menu();
-                    break;
-                case KEY_DOWN:
-                    selected_menu_item = (selected_menu_item + 1) % num_menu_items;
-                    display_menu();
-                    break;
-                case 10: // Enter
-                    handle_menu_action();
-                    // Sau khi xử lý xong, ẩn menu và vẽ lại UI chính
-                    werase(menuwin);
-                    wrefresh(menuwin);
-                    show_menu = 0;
-                    update_ui(); // Vẽ lại UI
-                    refresh(); // Refresh màn hình chính
-                    break;
-                case 27: // ESC
-                case KEY_F(1):
-                    werase(menuwin);
-                    wrefresh(menuwin);
-                    show_menu = 0;
-                    update_ui(); // Vẽ lại UI
-                    refresh(); // Refresh màn hình chính
-                    break;
-            }
-        } else { // Xử lý khi không ở trong menu
-            switch (ch) {
-                case KEY_F(1): // F1 - Show menu
-                    show_menu = 1;
-                    selected_menu_item = 0;
-                    // Clear any existing menu and draw fresh
-                    if (menuwin) delwin(menuwin);
-                    menuwin = newwin(num_menu_items + 2, 30, 3, 5);
-                    display_menu();
-                    show_notification("Menu displayed - Use arrow keys to navigate");
-                    break;
-                case KEY_F(2): // F2 - Load (Dùng chế độ nhập lệnh)
-                case 'c':      // c - Command mode
-                    // Clear the command line
-                    werase(cmdwin);
-                    mvwprintw(cmdwin, 0, 0, "Command > ");
-                    wrefresh(cmdwin);
-                    
-                    echo(); curs_set(1); // Show cursor and typing
-                    wmove(cmdwin, 0, 10);
-                    
-                    wgetnstr(cmdwin, input, sizeof(input) - 1);
-                    
-                    noecho(); curs_set(0);
-                    
-                    if (strlen(input) > 0) {
-                        // Process command
-                        if (strcmp(input, "exit") == 0) {
-                            running = 0; 
-                            break;
-                        }
-                        
-                        msg.timestamp = time(NULL);
-                        strncpy(msg.command, input, sizeof(msg.command) - 1);
-                        msg.command[sizeof(msg.command) - 1] = '\0';
-                        
-                        // CRITICAL: Set command type based on input
-                        if (strncmp(input, "load ", 5) == 0) {
-                            strncpy(current_url, input + 5, sizeof(current_url) - 1);
-                            current_url[sizeof(current_url) - 1] = '\0';
-                            update_ui(); // Update URL on UI
-                            msg.cmd_type = CMD_LOAD;
-                        } else if (strcmp(input, "reload") == 0) {
-                            msg.cmd_type = CMD_RELOAD;
-                        } else if (strcmp(input, "back") == 0) {
-                            msg.cmd_type = CMD_BACK;
-                        } else if (strcmp(input, "forward") == 0) {
-                            msg.cmd_type = CMD_FORWARD;
-                        } else if (strcmp(input, "history") == 0) {
-                            msg.cmd_type = CMD_HISTORY;
-                        } else if (strcmp(input, "bookmark") == 0) {
-                            msg.cmd_type = CMD_BOOKMARK;
-                        } else if (strcmp(input, "bookmarks") == 0) {
-                            msg.cmd_type = CMD_BOOKMARK_LIST;
-                        } else if (strncmp(input, "open ", 5) == 0) {
-                            msg.cmd_type = CMD_BOOKMARK_OPEN;
-                        } else if (strncmp(input, "delete ", 7) == 0) {
-                            msg.cmd_type = CMD_BOOKMARK_DELETE;
-                        } else if (strcmp(input, "sync on") == 0) {
-                            msg.cmd_type = CMD_SYNC_ON;
-                            is_synced = 1; update_status();
-                        } else if (strcmp(input, "sync off") == 0) {
-                            msg.cmd_type = CMD_SYNC_OFF;
-                            is_synced = 0; update_status();
-                        } else if (strcmp(input, "status") == 0) {
-                            msg.cmd_type = CMD_STATUS;
-                        } else {
-                            msg.cmd_type = CMD_UNKNOWN;
-                        }
-                        
-                        // Send command to browser
-                        if (write(write_fd, &msg, sizeof(msg)) < 0) {
-                            perror("write to browser");
-                            show_notification("Error sending command!");
-                        } else {
-                            char notification_text[MAX_MSG];
-                            snprintf(notification_text, MAX_MSG, "Command sent: %s", input);
-                            show_notification(notification_text);
-                        }
-                    }
-                    
-                    // Restore the command line
-                    werase(cmdwin);
-                    mvwprintw(cmdwin, 0, 0, "Command > ");
-                    wrefresh(cmdwin);
-                    break;
-
-                case KEY_F(3): // F3 - Reload
-                    show_notification("Reloading page...");
-                    strcpy(msg.command, "reload");
-                    msg.cmd_type = CMD_RELOAD;
-                    if (write(write_fd, &msg, sizeof(msg)) < 0) perror("write reload");
-                    break;
-                    
-                // Các phím F khác có thể thêm tương tự hoặc để trong menu F1
-                
-                case KEY_F(10): // F10 - Exit
-                    running = 0;
-                    break;
-                    
-                 // Thêm xử lý thay đổi kích thước màn hình nếu cần
-                case KEY_RESIZE:
-                    update_ui(); // Vẽ lại UI khi thay đổi kích thước
-                    refresh(); // Refresh màn hình chính
-                    break;
-            }
+        if (ready > 0 && nfds > 2 && (fds[2].revents & POLLIN)) {
+            tab_client_poll_broadcasts(client);
         }
-        
-        // Always refresh the UI after processing input
-        update_status();
     }
 
     // Dọn dẹp trước khi thoát
@@ -772,8 +811,6 @@ int main(int argc, char *argv[]) {
     printf("[Tab %d] Dang don dep...\n", tab_id);
     fflush(stdout);
     cleanup(); 
-    close(write_fd);
     printf("[Tab %d] Da thoat.\n", tab_id);
     return 0;
 }
-
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "tabclient.h"
+#include "diff.h"
+#include "instance.h"
+
+#define RESPONSE_BUFFER_INITIAL 4096
+
+typedef struct {
+    char url[MAX_MSG];
+    unsigned int generation;
+    char *text;                  // NULL if the slot is free
+    size_t length;
+    unsigned long last_used;
+} TabDocument;
+
+struct TabClient {
+    int tab_id;
+    int shard;               // Browser process the tab's commands go to
+    int read_fd;
+    char response_fifo[INSTANCE_PATH_MAX + 16];
+    int synced;
+    int attached;
+    int event_fd;            // -1 until tab_client_broadcast_fd() is called
+    TabClient *next_listener;
+    TabClientCallbacks callbacks;
+
+    // Partial response data carried over between reads
+    char *buffer;
+    size_t buffer_len;
+    size_t buffer_cap;
+
+    // Where the browser last said the tab is. Stale while a navigation
+    // is on its way, so back/forward are not served locally then.
+    char url[MAX_MSG];
+    char back_url[MAX_MSG];
+    char forward_url[MAX_MSG];
+    int navigating;
+
+    TabDocument documents[TAB_CLIENT_CACHE_ENTRIES];
+    size_t document_bytes;
+    unsigned long document_clock;
+};
+
+// Process-wide resources shared by every client
+static pthread_mutex_t process_lock = PTHREAD_MUTEX_INITIALIZER;
+static int browser_fds[INSTANCE_MAX_SHARDS] = { [0 ... INSTANCE_MAX_SHARDS - 1] = -1 };
+static int browser_fd_refs[INSTANCE_MAX_SHARDS];
+static SharedState *shared_state = NULL;
+static int shared_refs = 0;
+
+// Broadcast bridge: one thread waits on the futex and signals listeners
+static TabClient *listeners = NULL;
+static pthread_t bridge_thread;
+static int bridge_running = 0;
+static int bridge_stop = 0;
+
+// Whether a broadcast is waiting for the tab. Read without the lock:
+// the sender sets the flags before it bumps broadcast_seq, and a stale
+// answer only costs one extra tab_client_poll_broadcasts().
+static int broadcast_pending(int tab_id) {
+    int slot = tab_id % MAX_TABS;
+    for (int i = 0; i < MAX_BROADCASTS; i++) {
+        BroadcastMessage *msg = &shared_state->broadcast_messages[i];
+        if (!__atomic_load_n(&msg->processed[slot], __ATOMIC_RELAXED) &&
+            __atomic_load_n(&msg->timestamp, __ATOMIC_RELAXED) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *broadcast_bridge(void *arg) {
+    unsigned int seen = __atomic_load_n(&shared_state->broadcast_seq, __ATOMIC_ACQUIRE);
+    
+    for (;;) {
+        wait_for_broadcast(shared_state, seen);
+        
+        pthread_mutex_lock(&process_lock);
+        if (bridge_stop) {
+            pthread_mutex_unlock(&process_lock);
+            break;
+        }
+        unsigned int now = __atomic_load_n(&shared_state->broadcast_seq, __ATOMIC_ACQUIRE);
+        if (now != seen) {
+            seen = now;
+            // Tabs that filter the new messages out are not woken
+            for (TabClient *c = listeners; c; c = c->next_listener) {
+                if (broadcast_pending(c->tab_id)) eventfd_write(c->event_fd, 1);
+            }
+        }
+        pthread_mutex_unlock(&process_lock);
+    }
+    return NULL;
+}
+
+// Remove a client from the listener list, stopping the bridge with the last one
+static void remove_listener(TabClient *client) {
+    pthread_mutex_lock(&process_lock);
+    for (TabClient **p = &listeners; *p; p = &(*p)->next_listener) {
+        if (*p == client) {
+            *p = client->next_listener;
+            break;
+        }
+    }
+    int stop = bridge_running && listeners == NULL;
+    if (stop) {
+        bridge_stop = 1;
+        bridge_running = 0;
+    }
+    pthread_mutex_unlock(&process_lock);
+    
+    if (stop) {
+        // Bumping the word (not just waking) means the bridge cannot miss
+        // the stop by entering FUTEX_WAIT right after this wake
+        __atomic_add_fetch(&shared_state->broadcast_seq, 1, __ATOMIC_RELEASE);
+        wake_broadcast_waiters(shared_state);
+        pthread_join(bridge_thread, NULL);
+        bridge_stop = 0;
+    }
+    close(client->event_fd);
+    client->event_fd = -1;
+}
+
+// Number of browser shards, read from the segment without attaching
+// for good; 1 if there is no browser yet
+static int browser_shard_count() {
+    int shmid = find_shared_memory();
+    if (shmid < 0) return 1;
+    SharedState *state = shmat(shmid, NULL, SHM_RDONLY);
+    if (state == (void *)-1) return 1;
+    int count = state->shard_count;
+    shmdt(state);
+    return count < 1 || count > INSTANCE_MAX_SHARDS ? 1 : count;
+}
+
+// Open (or reuse) the write end of a shard's browser FIFO.
+// Messages are smaller than PIPE_BUF, so concurrent writes stay atomic.
+static int acquire_browser_fd(int shard) {
+    pthread_mutex_lock(&process_lock);
+    if (browser_fds[shard] < 0) {
+        char path[INSTANCE_PATH_MAX + 16];
+        instance_shard_fifo(shard, path, sizeof(path));
+        browser_fds[shard] = open(path, O_WRONLY);
+    }
+    int fd = browser_fds[shard];
+    if (fd >= 0) browser_fd_refs[shard]++;
+    pthread_mutex_unlock(&process_lock);
+    return fd;
+}
+
+static void release_browser_fd(int shard) {
+    pthread_mutex_lock(&process_lock);
+    if (--browser_fd_refs[shard] == 0 && browser_fds[shard] >= 0) {
+        close(browser_fds[shard]);
+        browser_fds[shard] = -1;
+    }
+    pthread_mutex_unlock(&process_lock);
+}
+
+static int acquire_shared_state() {
+    pthread_mutex_lock(&process_lock);
+    if (!shared_state) {
+        int shmid = shmget(instance_get()->shm_key, sizeof(SharedState), 0666);
+        if (shmid < 0 || attach_semaphores() < 0) {
+            pthread_mutex_unlock(&process_lock);
+            return -1;
+        }
+        shared_state = (SharedState *)attach_shared_memory(shmid);
+        if (!shared_state) {
+            pthread_mutex_unlock(&process_lock);
+            return -1;
+        }
+    }
+    shared_refs++;
+    pthread_mutex_unlock(&process_lock);
+    return 0;
+}
+
+static void release_shared_state() {
+    pthread_mutex_lock(&process_lock);
+    if (--shared_refs == 0 && shared_state) {
+        detach_shared_memory(shared_state);
+        shared_state = NULL;
+    }
+    pthread_mutex_unlock(&process_lock);
+}
+
+TabClient *tab_client_open(int tab_id, const TabClientCallbacks *callbacks) {
+    TabClient *client = calloc(1, sizeof(TabClient));
+    if (!client) return NULL;
+
+    client->tab_id = tab_id;
+    client->event_fd = -1;
+    if (callbacks) client->callbacks = *callbacks;
+
+    snprintf(client->response_fifo, sizeof(client->response_fifo), "%s%d",
+             instance_get()->response_prefix, tab_id);
+    if (mkfifo(client->response_fifo, 0666) < 0 && errno != EEXIST) {
+        free(client);
+        return NULL;
+    }
+
+    // O_RDWR keeps the FIFO from reporting EOF while the browser has it closed
+    client->read_fd = open(client->response_fifo, O_RDWR | O_NONBLOCK);
+    if (client->read_fd < 0) {
+        int saved = errno;
+        unlink(client->response_fifo);
+        free(client);
+        errno = saved;
+        return NULL;
+    }
+
+    // Straight to the tab's shard; shard 0 forwards anything sent to it
+    // instead, so a shard still starting is reached through it
+    client->shard = instance_shard_of(tab_id, browser_shard_count());
+    int fd = acquire_browser_fd(client->shard);
+    if (fd < 0 && client->shard != 0) {
+        client->shard = 0;
+        fd = acquire_browser_fd(0);
+    }
+    if (fd < 0) {
+        int saved = errno;
+        close(client->read_fd);
+        unlink(client->response_fifo);
+        free(client);
+        errno = saved;
+        return NULL;
+    }
+
+    return client;
+}
+
+void tab_client_close(TabClient *client) {
+    if (!client) return;
+
+    if (client->event_fd >= 0) {
+        remove_listener(client);
+    }
+
+    if (client->attached) {
+        if (client->synced) {
+            lock_shared_memory();
+            shared_state->tab_active[client->tab_id % MAX_TABS] = false;
+            unlock_shared_memory();
+
+            broadcast_message(shared_state, BROADCAST_TAB_CLOSED, client->tab_id, "Tab closed");
+        }
+        release_shared_state();
+    }
+
+    close(client->read_fd);
+    unlink(client->response_fifo);
+    release_browser_fd(client->shard);
+
+    for (int i = 0; i < TAB_CLIENT_CACHE_ENTRIES; i++) {
+        free(client->documents[i].text);
+    }
+    free(client->buffer);
+    free(client);
+}
+
+int tab_client_id(TabClient *client) {
+    return client->tab_id;
+}
+
+int tab_client_is_synced(TabClient *client) {
+    return client->synced;
+}
+
+int tab_client_response_fd(TabClient *client) {
+    return client->read_fd;
+}
+
+CommandType tab_client_command_type(const char *command) {
+    return get_command_type(command);
+}
+
+static TabDocument *find_document(TabClient *client, const char *url) {
+    for (int i = 0; i < TAB_CLIENT_CACHE_ENTRIES; i++) {
+        TabDocument *doc = &client->documents[i];
+        if (doc->text && strcmp(doc->url, url) == 0) {
+            doc->last_used = ++client->document_clock;
+            return doc;
+        }
+    }
+    return NULL;
+}
+
+static void drop_document(TabClient *client, TabDocument *doc) {
+    client->document_bytes -= doc->length;
+    free(doc->text);
+    doc->text = NULL;
+}
+
+// Keep a copy of a document, evicting the least recently used ones to
+// stay within TAB_CLIENT_CACHE_BYTES
+static void store_document(TabClient *client, const char *url, unsigned int generation,
+                           const char *text, size_t length) {
+    if (url[0] == '\0' || length > TAB_CLIENT_CACHE_BYTES) return;
+
+    TabDocument *doc = find_document(client, url);
+    if (doc) drop_document(client, doc);
+
+    for (;;) {
+        TabDocument *free_slot = NULL;
+        TabDocument *oldest = NULL;
+        for (int i = 0; i < TAB_CLIENT_CACHE_ENTRIES; i++) {
+            TabDocument *d = &client->documents[i];
+            if (!d->text) {
+                if (!free_slot) free_slot = d;
+            } else if (!oldest || d->last_used < oldest->last_used) {
+                oldest = d;
+            }
+        }
+        if (free_slot && client->document_bytes + length <= TAB_CLIENT_CACHE_BYTES) {
+            doc = free_slot;
+            break;
+        }
+        drop_document(client, oldest);
+    }
+
+    doc->text = malloc(length ? length : 1);
+    if (!doc->text) return;
+    memcpy(doc->text, text, length);
+    doc->length = length;
+    doc->generation = generation;
+    snprintf(doc->url, sizeof(doc->url), "%s", url);
+    doc->last_used = ++client->document_clock;
+    client->document_bytes += length;
+}
+
+// The page name the browser files "load <path>" under: the last path
+// component without its extension
+static void load_target(const char *path, char *url, size_t size) {
+    const char *name = strrchr(path, '/');
+    snprintf(url, size, "%s", name ? name + 1 : path);
+    char *dot = strrchr(url, '.');
+    if (dot) *dot = '\0';
+}
+
+int tab_client_send(TabClient *client, const char *command) {
+    BrowserMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.tab_id = client->tab_id;
+    msg.cmd_type = tab_client_command_type(command);
+    msg.use_shared_memory = 0;
+    msg.shared_memory_id = -1;
+    msg.timestamp = time(NULL);
+    strncpy(msg.command, command, sizeof(msg.command) - 1);
+
+    // Which page this navigation leads to, if the client can tell
+    char target[MAX_MSG] = "";
+    switch (msg.cmd_type) {
+        case CMD_LOAD:
+            load_target(command + 5, target, sizeof(target));
+            break;
+        case CMD_RELOAD:
+            snprintf(target, sizeof(target), "%s", client->url);
+            break;
+        case CMD_BACK:
+            if (!client->navigating) snprintf(target, sizeof(target), "%s", client->back_url);
+            break;
+        case CMD_FORWARD:
+            if (!client->navigating) snprintf(target, sizeof(target), "%s", client->forward_url);
+            break;
+        default:
+            break;
+    }
+    TabDocument *doc = target[0] ? find_document(client, target) : NULL;
+    if (doc) msg.known_generation = doc->generation;
+
+    if (write(browser_fds[client->shard], &msg, sizeof(msg)) != sizeof(msg)) {
+        return -1;
+    }
+
+    if (msg.cmd_type == CMD_LOAD || msg.cmd_type == CMD_RELOAD || msg.cmd_type == CMD_BACK ||
+        msg.cmd_type == CMD_FORWARD || msg.cmd_type == CMD_BOOKMARK_OPEN) {
+        client->navigating = 1;
+    }
+
+    // Paint the cached copy now; the browser's reply confirms or replaces it
+    if (doc && msg.cmd_type != CMD_RELOAD && client->callbacks.on_response) {
+        TabResponse response = {
+            .kind = RESP_PAGE,
+            .generation = doc->generation,
+            .url = doc->url,
+            .back_url = "",
+            .forward_url = "",
+            .text = doc->text,
+            .length = doc->length,
+            .from_cache = 1
+        };
+        client->callbacks.on_response(client, &response, client->callbacks.user_data);
+    }
+
+    if (msg.cmd_type == CMD_SYNC_ON) {
+        client->synced = 1;
+    } else if (msg.cmd_type == CMD_SYNC_OFF) {
+        client->synced = 0;
+    }
+    return 0;
+}
+
+// Copy a length-prefixed string out of a frame
+static void take_string(const char *p, size_t length, char *out, size_t size) {
+    if (length >= size) length = size - 1;
+    memcpy(out, p, length);
+    out[length] = '\0';
+}
+
+// Patch the cached copy the browser diffed against. If it is gone (or a
+// patch was lost to backpressure) ask for the whole page again.
+static int apply_patch(TabClient *client, const ResponseHeader *header, const char *patch,
+                       TabResponse *response) {
+    PatchHeader patch_header;
+    TabDocument *doc = NULL;
+    if (header->body_length >= sizeof(patch_header)) {
+        memcpy(&patch_header, patch, sizeof(patch_header));
+        doc = find_document(client, client->url);
+        if (doc && doc->generation != patch_header.base_generation) doc = NULL;
+    }
+
+    size_t length;
+    char *text = doc ? patch_apply(doc->text, doc->length, patch, header->body_length, &length,
+                                   &response->first_changed, &response->last_changed) : NULL;
+    if (!text) {
+        // Unless the tab has moved on, revalidate against what is cached
+        if (!client->navigating) tab_client_send(client, "reload");
+        return -1;
+    }
+
+    store_document(client, client->url, header->generation, text, length);
+    free(text);
+    doc = find_document(client, client->url);
+    if (!doc) return -1;
+    response->base_generation = patch_header.base_generation;
+    response->text = doc->text;
+    response->length = doc->length;
+    return 0;
+}
+
+// Deliver one complete frame
+static void handle_frame(TabClient *client, const ResponseHeader *header, const char *p) {
+    take_string(p, header->url_length, client->url, sizeof(client->url));
+    p += header->url_length;
+    take_string(p, header->back_length, client->back_url, sizeof(client->back_url));
+    p += header->back_length;
+    take_string(p, header->forward_length, client->forward_url, sizeof(client->forward_url));
+    p += header->forward_length;
+    client->navigating = 0;
+
+    TabResponse response = {
+        .kind = header->kind,
+        .generation = header->generation,
+        .url = client->url,
+        .back_url = client->back_url,
+        .forward_url = client->forward_url,
+        .text = p,
+        .length = header->body_length,
+        .from_cache = 0
+    };
+
+    if (header->kind == RESP_PAGE) {
+        store_document(client, client->url, header->generation, p, header->body_length);
+    } else if (header->kind == RESP_PATCH) {
+        if (apply_patch(client, header, p, &response) < 0) return;
+    } else if (header->kind == RESP_NOT_MODIFIED) {
+        TabDocument *doc = find_document(client, client->url);
+        if (doc && doc->generation == header->generation) {
+            response.text = doc->text;
+            response.length = doc->length;
+        } else {
+            response.text = NULL;
+            response.length = 0;
+        }
+    }
+
+    if (client->callbacks.on_response) {
+        client->callbacks.on_response(client, &response, client->callbacks.user_data);
+    }
+}
+
+int tab_client_dispatch(TabClient *client) {
+    int delivered = 0;
+
+    for (;;) {
+        if (client->buffer_cap - client->buffer_len < RESPONSE_BUFFER_INITIAL) {
+            size_t cap = client->buffer_cap ? client->buffer_cap * 2 : RESPONSE_BUFFER_INITIAL * 2;
+            char *buffer = realloc(client->buffer, cap);
+            if (!buffer) return -1;
+            client->buffer = buffer;
+            client->buffer_cap = cap;
+        }
+
+        ssize_t n = read(client->read_fd, client->buffer + client->buffer_len,
+                         client->buffer_cap - client->buffer_len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        if (n == 0) break;
+        client->buffer_len += n;
+
+        // Every response is a ResponseHeader followed by its strings and body
+        size_t start = 0;
+        while (client->buffer_len - start >= sizeof(ResponseHeader)) {
+            ResponseHeader header;
+            memcpy(&header, client->buffer + start, sizeof(header));
+            // Not at a frame, e.g. the rest of one cut off before this tab
+            // was reading: skip ahead to the next header
+            if (header.magic != RESPONSE_MAGIC) {
+                start++;
+                continue;
+            }
+            size_t length = sizeof(header) + header.url_length + header.back_length +
+                            header.forward_length + header.body_length;
+            if (client->buffer_len - start < length) break;
+
+            handle_frame(client, &header, client->buffer + start + sizeof(header));
+            delivered++;
+            start += length;
+        }
+
+        if (start > 0) {
+            memmove(client->buffer, client->buffer + start, client->buffer_len - start);
+            client->buffer_len -= start;
+        }
+    }
+
+    return delivered;
+}
+
+int tab_client_attach_shared(TabClient *client) {
+    if (client->attached) return 0;
+    if (acquire_shared_state() < 0) return -1;
+    client->attached = 1;
+    return 0;
+}
+
+int tab_client_broadcast_fd(TabClient *client) {
+    if (client->event_fd >= 0) return client->event_fd;
+    if (!client->attached) return -1;
+    
+    client->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (client->event_fd < 0) return -1;
+    
+    pthread_mutex_lock(&process_lock);
+    client->next_listener = listeners;
+    listeners = client;
+    if (!bridge_running) {
+        if (pthread_create(&bridge_thread, NULL, broadcast_bridge, NULL) == 0) {
+            bridge_running = 1;
+        }
+    }
+    pthread_mutex_unlock(&process_lock);
+    
+    // Start readable so broadcasts sent before registration are picked up
+    eventfd_write(client->event_fd, 1);
+    return client->event_fd;
+}
+
+int tab_client_poll_broadcasts(TabClient *client) {
+    if (client->event_fd >= 0) {
+        eventfd_t ignored;
+        eventfd_read(client->event_fd, &ignored);
+    }
+    if (!client->attached || !client->synced) return 0;
+
+    // Copy pending messages out so callbacks run without the lock held
+    BroadcastMessage pending[MAX_BROADCASTS];
+    int count = 0;
+    int slot = client->tab_id % MAX_TABS;
+
+    lock_shared_memory();
+    for (int i = 0; i < MAX_BROADCASTS; i++) {
+        BroadcastMessage *msg = &shared_state->broadcast_messages[i];
+        if (msg->timestamp > 0 && !msg->processed[slot]) {
+            msg->processed[slot] = true;
+            if (msg->sender_tab_id != client->tab_id) {
+                pending[count++] = *msg;
+            }
+        }
+    }
+    unlock_shared_memory();
+
+    if (client->callbacks.on_broadcast) {
+        for (int i = 0; i < count; i++) {
+            client->callbacks.on_broadcast(client, &pending[i], client->callbacks.user_data);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,99 @@
+#ifndef TABCLIENT_H
+#define TABCLIENT_H
+
+#include <stddef.h>
+#include "common.h"
+#include "shared_memory.h"
+
+// Headless tab client library (libtabclient).
+// Owns the response FIFO, the connection to BROWSER_FIFO and the
+// broadcast bookkeeping of one tab, without any terminal output.
+// Clients are not thread-safe individually, but any number of clients
+// can live in one process; they share a single browser FIFO descriptor
+// and a single shared memory attachment.
+//
+// Each client keeps the documents it received, keyed by URL and the
+// browser's content generation. A back, forward or load of a cached page
+// is answered from that cache straight away (from_cache set) and the
+// browser is asked to revalidate it: it replies with RESP_NOT_MODIFIED
+// instead of the document if the generation is still current, or with
+// RESP_PATCH, which the client applies to its copy, if little changed.
+
+#define TAB_CLIENT_CACHE_ENTRIES 16
+#define TAB_CLIENT_CACHE_BYTES (4 * 1024 * 1024)
+
+typedef struct TabClient TabClient;
+
+typedef struct {
+    ResponseKind kind;
+    unsigned int generation;
+    const char *url;             // Page the tab is on after this response
+    const char *back_url;        // Its history neighbours, "" if none
+    const char *forward_url;
+    const char *text;            // length bytes, not NUL-terminated. For
+    size_t length;               // RESP_NOT_MODIFIED the cached copy, if any,
+                                 // for RESP_PATCH the patched document.
+    int from_cache;              // Served locally; the browser's reply follows
+    unsigned int base_generation; // RESP_PATCH only: the version it was applied to
+    int first_changed;           // and the lines of text that changed or moved
+    int last_changed;
+} TabResponse;
+
+// Called once for every complete response received from the browser, and
+// for every navigation answered from the client's cache. Pointers are
+// only valid during the call.
+typedef void (*TabResponseCallback)(TabClient *client, const TabResponse *response,
+                                    void *user_data);
+
+// Called once for every broadcast sent by another tab
+typedef void (*TabBroadcastCallback)(TabClient *client, const BroadcastMessage *msg,
+                                     void *user_data);
+
+typedef struct {
+    TabResponseCallback on_response;
+    TabBroadcastCallback on_broadcast;
+    void *user_data;
+} TabClientCallbacks;
+
+// Create the response FIFO and connect to the browser.
+// Returns NULL with errno set if the browser is not reachable.
+TabClient *tab_client_open(int tab_id, const TabClientCallbacks *callbacks);
+
+// Announce the tab as closed (if synced), remove its FIFO and free it
+void tab_client_close(TabClient *client);
+
+int tab_client_id(TabClient *client);
+int tab_client_is_synced(TabClient *client);
+
+// Descriptor to watch for POLLIN; call tab_client_dispatch() when readable
+int tab_client_response_fd(TabClient *client);
+
+// Classify and send a text command such as "load hello" or "sync on".
+// Navigations to a cached page invoke on_response before returning.
+int tab_client_send(TabClient *client, const char *command);
+
+// Read whatever is available and invoke on_response for each complete
+// response. Never blocks. Returns the number of responses delivered,
+// or -1 on error.
+int tab_client_dispatch(TabClient *client);
+
+// Attach to the browser's shared memory. Optional: only needed for
+// broadcasts. Returns 0 on success, -1 if the browser has not created it.
+int tab_client_attach_shared(TabClient *client);
+
+// Descriptor (an eventfd) that becomes readable when a broadcast may be
+// pending; call tab_client_poll_broadcasts() when it is. A single bridge
+// thread per process turns the shared-memory futex into these wakeups,
+// so callers can wait on it in poll() with no periodic polling.
+// Returns -1 if shared memory is not attached.
+int tab_client_broadcast_fd(TabClient *client);
+
+// Invoke on_broadcast for every pending broadcast from other tabs and
+// mark them processed. Does nothing unless the tab is synced.
+// Returns the number of broadcasts delivered.
+int tab_client_poll_broadcasts(TabClient *client);
+
+// Map a text command to its CommandType
+CommandType tab_client_command_type(const char *command);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "trace.h"
+#include "log.h"
+
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+// Command awaiting its first response, per tab
+typedef struct {
+    int tab_id;
+    uint32_t seq;
+    uint64_t received_ns;
+} TracePending;
+
+static FILE *trace_file = NULL;
+static char *trace_buffer = NULL;
+static uint64_t trace_start_ns;
+static uint32_t trace_seq = 0;
+static TracePending pending[MAX_TABS];
+
+// A failed write ends the trace rather than the browser
+static void trace_write(const void *data, size_t length) {
+    if (fwrite(data, 1, length, trace_file) != length) {
+        log_warn("[Trace] Write failed, recording stopped: %s", strerror(errno));
+        trace_close();
+    }
+}
+
+int trace_open(const char *path) {
+    trace_file = fopen(path, "wb");
+    if (!trace_file) {
+        perror("fopen trace");
+        return -1;
+    }
+    // Records are small; write them out in large blocks
+    trace_buffer = malloc(TRACE_BUFFER_SIZE);
+    if (trace_buffer) setvbuf(trace_file, trace_buffer, _IOFBF, TRACE_BUFFER_SIZE);
+
+    trace_start_ns = monotonic_ns();
+    trace_seq = 0;
+    memset(pending, 0, sizeof(pending));
+
+    TraceFileHeader header = { TRACE_MAGIC, TRACE_VERSION, (int64_t)time(NULL) };
+    trace_write(&header, sizeof(header));
+    if (!trace_file) return -1;
+
+    log_info("[Trace] Recording commands to %s", path);
+    return 0;
+}
+
+int trace_resume(const char *path, uint64_t started_ns, uint32_t seq) {
+    trace_file = fopen(path, "ab");
+    if (!trace_file) {
+        perror("fopen trace");
+        return -1;
+    }
+    trace_buffer = malloc(TRACE_BUFFER_SIZE);
+    if (trace_buffer) setvbuf(trace_file, trace_buffer, _IOFBF, TRACE_BUFFER_SIZE);
+
+    // CLOCK_MONOTONIC is system-wide, so the old process's start still applies
+    trace_start_ns = started_ns;
+    trace_seq = seq;
+    memset(pending, 0, sizeof(pending));
+    return 0;
+}
+
+uint64_t trace_started_ns() {
+    return trace_start_ns;
+}
+
+void trace_close() {
+    if (!trace_file) return;
+    fclose(trace_file);
+    trace_file = NULL;
+    free(trace_buffer);
+    trace_buffer = NULL;
+}
+
+int trace_enabled() {
+    return trace_file != NULL;
+}
+
+unsigned long trace_commands() {
+    return trace_seq;
+}
+
+void trace_command(const BrowserMessage *msg) {
+    if (!trace_file) return;
+
+    size_t length = strnlen(msg->command, MAX_MSG);
+    uint64_t now = monotonic_ns();
+    TraceRecord record = {
+        .type = TRACE_COMMAND,
+        .command_length = length,
+        .seq = ++trace_seq,
+        .offset_ns = now - trace_start_ns,
+        .tab_id = msg->tab_id,
+        .cmd_type = msg->cmd_type,
+        .known_generation = msg->known_generation
+    };
+    trace_write(&record, sizeof(record));
+    if (trace_file) trace_write(msg->command, length);
+
+    // An earlier command still unanswered is left without a response
+    TracePending *p = &pending[msg->tab_id % MAX_TABS];
+    p->tab_id = msg->tab_id;
+    p->seq = record.seq;
+    p->received_ns = now;
+}
+
+void trace_response(int tab_id, size_t bytes) {
+    if (!trace_file) return;
+
+    TracePending *p = &pending[tab_id % MAX_TABS];
+    if (p->seq == 0 || p->tab_id != tab_id) return;
+
+    uint64_t now = monotonic_ns();
+    TraceRecord record = {
+        .type = TRACE_RESPONSE,
+        .seq = p->seq,
+        .offset_ns = now - trace_start_ns,
+        .tab_id = tab_id,
+        .response_bytes = bytes,
+        .latency_us = (now - p->received_ns) / 1000
+    };
+    p->seq = 0;
+    trace_write(&record, sizeof(record));
+}
@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "common.h"
+
+// Command traces.
+// With -t the browser records every BrowserMessage it receives to a
+// binary trace, together with the size and latency of the first response
+// the tab was sent for it. ./replay feeds a trace back to a browser.
+//
+// A trace is a TraceFileHeader followed by TraceRecords. TRACE_COMMAND
+// records are followed by command_length bytes of command text (no NUL).
+// A TRACE_RESPONSE record refers to the command with the same seq; it
+// is missing for commands that were never answered.
+
+#define TRACE_MAGIC 0x43525442       // "BTRC"
+#define TRACE_VERSION 4              // 2: subscribe/unsubscribe renumbered CMD_UNKNOWN, 3: find,
+                                     // 4: CMD_UNKNOWN back at 14, newer commands after it
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t started;                 // Wall clock time of offset 0
+} TraceFileHeader;
+
+typedef enum {
+    TRACE_COMMAND = 1,
+    TRACE_RESPONSE
+} TraceRecordType;
+
+typedef struct {
+    uint16_t type;
+    uint16_t command_length;
+    uint32_t seq;                    // Numbers commands from 1
+    uint64_t offset_ns;              // Since the trace started
+    int32_t tab_id;
+    int32_t cmd_type;
+    uint32_t known_generation;
+    uint32_t response_bytes;         // TRACE_RESPONSE only: frame size
+    uint32_t latency_us;             // and time since the command arrived
+} TraceRecord;
+
+// Start recording to path (appending to an existing trace is not
+// supported: the file is truncated). Returns -1 on error.
+int trace_open(const char *path);
+
+// Write out buffered records and close the trace
+void trace_close();
+
+// Hot restart: the new process appends to the old one's trace, with
+// offsets and command numbers carrying on from where it stopped
+uint64_t trace_started_ns();
+int trace_resume(const char *path, uint64_t started_ns, uint32_t seq);
+
+int trace_enabled();
+unsigned long trace_commands();
+
+// Record a command as it is read from BROWSER_FIFO
+void trace_command(const BrowserMessage *msg);
+
+// Record a frame queued for a tab; only the first after a command counts
+void trace_response(int tab_id, size_t bytes);
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "upgrade.h"
+
+#define UPGRADE_MAX_FDS (UPGRADE_MAX_QUEUES + 1)
+
+int upgrade_start(const char *path, char *const argv[], pid_t *child) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+
+    // Built here: other threads may hold the allocator's lock at fork(),
+    // so the child only makes async-signal-safe calls
+    char fd_text[16];
+    snprintf(fd_text, sizeof(fd_text), "%d", sv[1]);
+    char **env = env_with(UPGRADE_FD_ENV, fd_text);
+    if (!env) {
+        perror("malloc");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        free(env);
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Only the new process's end survives exec. A failed exec shows
+        // up in the old process as the new one exiting.
+        fcntl(sv[1], F_SETFD, 0);
+        execve(path, argv, env);
+        _exit(127);
+    }
+
+    free(env);
+    close(sv[1]);
+    *child = pid;
+    return sv[0];
+}
+
+int upgrade_wait_ready(int sock) {
+    char ready;
+    ssize_t n;
+    do {
+        n = read(sock, &ready, 1);
+    } while (n < 0 && errno == EINTR);
+    return n == 1 ? 1 : -1;
+}
+
+// Whole buffers over the stream socket
+static int send_all(int sock, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(sock, data, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int receive_all(int sock, char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = recv(sock, data, length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+int upgrade_send(int sock, const UpgradeState *state, const int *fds, char *const partials[]) {
+    int fd_count = 1 + state->queue_count;
+    char control[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov = { (void *)state, sizeof(*state) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = CMSG_SPACE(fd_count * sizeof(int))
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(*state)) {
+        perror("sendmsg");
+        return -1;
+    }
+
+    for (int i = 0; i < state->queue_count; i++) {
+        if (send_all(sock, partials[i], state->partial_length[i]) < 0) {
+            perror("send partial response");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int upgrade_inherited() {
+    const char *value = getenv(UPGRADE_FD_ENV);
+    if (!value) return -1;
+
+    int sock = atoi(value);
+    unsetenv(UPGRADE_FD_ENV);
+    // Not passed on to renderers or to the next upgrade
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    return sock;
+}
+
+int upgrade_receive(int sock, UpgradeState *state, int *fds, char *partials[]) {
+    char ready = 1;
+    if (write(sock, &ready, 1) != 1) {
+        perror("write upgrade socket");
+        return -1;
+    }
+
+    char control[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+    struct iovec iov = { state, sizeof(*state) };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(*state) || state->magic != UPGRADE_MAGIC ||
+        state->queue_count < 0 || state->queue_count > UPGRADE_MAX_QUEUES) {
+        fprintf(stderr, "[Browser] No state received from the old process\n");
+        return -1;
+    }
+
+    int count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+    }
+    if (count != 1 + state->queue_count) {
+        fprintf(stderr, "[Browser] Expected %d descriptors from the old process, got %d\n",
+                1 + state->queue_count, count);
+        for (int i = 0; i < count; i++) close(fds[i]);
+        return -1;
+    }
+
+    for (int i = 0; i < state->queue_count; i++) {
+        uint32_t length = state->partial_length[i];
+        partials[i] = length > 0 ? malloc(length) : NULL;
+        if ((length > 0 && !partials[i]) || receive_all(sock, partials[i], length) < 0 ||
+            state->partial_offset[i] > length) {
+            fprintf(stderr, "[Browser] Partial response for tab %d not received\n", state->tab_ids[i]);
+            for (int j = 0; j <= i; j++) free(partials[j]);
+            for (int j = 0; j < count; j++) close(fds[j]);
+            return -1;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,68 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "common.h"
+
+// Hot restart.
+// On SIGUSR2 the browser starts its binary again (the path it was
+// started from, so a rebuilt binary takes over; same arguments) with one
+// end of a Unix socketpair named in UPGRADE_FD_ENV. The new process
+// starts its renderer pool and reports ready. The old process then stops
+// reading BROWSER_FIFO, finishes the commands it had already read,
+// flushes the tabs' queues, and sends an UpgradeState over the socket
+// with BROWSER_FIFO and every open response FIFO attached (SCM_RIGHTS).
+// Responses not started by then are dropped; one a FIFO is in the
+// middle of follows the state, and the new process finishes it before
+// writing anything else to that tab.
+// It exits without unlinking the FIFO or removing the shared memory and
+// semaphore, which the new process attaches to as they are. Commands
+// that tabs send meanwhile wait in the FIFO, so tabs only see a pause.
+//
+// If the new process fails before it is ready, the old one carries on.
+
+#define UPGRADE_FD_ENV "BROWSER_UPGRADE_FD"
+#define UPGRADE_MAGIC 0x52475055         // "UPGR"
+#define UPGRADE_MAX_QUEUES 64            // Response FIFOs handed over; others are reopened
+#define UPGRADE_DRAIN_MS 2000            // Longest wait for queued work before handing over
+#define UPGRADE_READY_MS 10000           // Longest wait for the new process to start
+
+typedef struct {
+    uint32_t magic;
+    pid_t pid;                           // Old process
+    int shmid;
+    int semid;
+    uint64_t trace_started;              // Trace position, if recording
+    uint32_t trace_seq;
+    int queue_count;
+    int tab_ids[UPGRADE_MAX_QUEUES];     // Owner of each response FIFO, in the
+                                         // order they follow BROWSER_FIFO
+    uint32_t partial_length[UPGRADE_MAX_QUEUES]; // Response partly written to it, 0 if none
+    uint32_t partial_offset[UPGRADE_MAX_QUEUES]; // ... and how much of it is written
+} UpgradeState;
+
+// Old process: start path with the same arguments. Returns the socket
+// to watch for POLLIN, or -1.
+int upgrade_start(const char *path, char *const argv[], pid_t *child);
+
+// Old process: read the new process's ready byte once the socket is
+// readable. Returns 1 if it is ready, -1 if it died first.
+int upgrade_wait_ready(int sock);
+
+// Old process: send the state and descriptors (fds[0] is BROWSER_FIFO,
+// then one per tab_ids entry), then partials[i] (partial_length[i]
+// bytes) for every response FIFO
+int upgrade_send(int sock, const UpgradeState *state, const int *fds, char *const partials[]);
+
+// New process: the socket inherited from the old one, -1 if this is a
+// normal start
+int upgrade_inherited();
+
+// New process: report ready and wait for the old process's state.
+// Returns the number of descriptors received into fds, or -1. The
+// partly written responses are stored in partials (malloc'd, NULL if
+// none).
+int upgrade_receive(int sock, UpgradeState *state, int *fds, char *partials[]);
+
+#endif
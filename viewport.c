@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include "viewport.h"
+#include "scan.h"
+
+void viewport_init(Viewport *vp) {
+    memset(vp, 0, sizeof(*vp));
+    vp->match_line = -1;
+}
+
+void viewport_free(Viewport *vp) {
+    free(vp->text);
+    free(vp->line_offsets);
+    viewport_init(vp);
+}
+
+// Clamp the scroll position to the document and window size
+static void viewport_clamp(Viewport *vp) {
+    int max_top = vp->line_count - vp->rows;
+    if (vp->top_line > max_top) vp->top_line = max_top;
+    if (vp->top_line < 0) vp->top_line = 0;
+
+    int max_left = vp->widest_line - vp->cols;
+    if (vp->left_col > max_left) vp->left_col = max_left;
+    if (vp->left_col < 0) vp->left_col = 0;
+}
+
+int viewport_set_text(Viewport *vp, const char *text, size_t length) {
+    // Drop a single trailing newline so it does not show up as an empty line
+    if (length > 0 && text[length - 1] == '\n') length--;
+
+    char *copy = malloc(length + 1);
+    if (!copy) return -1;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    // Count lines first so the offset table is allocated once, then fill
+    // it with the newline positions, which become line starts below
+    size_t newlines = scan_newlines(copy, length, NULL, 0);
+    int count = newlines + 1;
+
+    size_t *offsets = malloc(count * sizeof(size_t));
+    if (!offsets) {
+        free(copy);
+        return -1;
+    }
+    offsets[0] = 0;
+    scan_newlines(copy, length, offsets + 1, newlines);
+
+    int widest = 0;
+    for (int i = 0; i < count; i++) {
+        size_t end = i + 1 < count ? offsets[i + 1] : length;
+        if ((int)(end - offsets[i]) > widest) widest = end - offsets[i];
+        if (i + 1 < count) offsets[i + 1] = end + 1;
+    }
+
+    free(vp->text);
+    free(vp->line_offsets);
+    vp->text = copy;
+    vp->length = length;
+    vp->line_offsets = offsets;
+    vp->line_count = count;
+    vp->widest_line = widest;
+    vp->top_line = 0;
+    vp->left_col = 0;
+    vp->match_line = -1;
+    return 0;
+}
+
+int viewport_update_text(Viewport *vp, const char *text, size_t length) {
+    int top_line = vp->top_line;
+    int left_col = vp->left_col;
+    if (viewport_set_text(vp, text, length) < 0) return -1;
+    vp->top_line = top_line;
+    vp->left_col = left_col;
+    viewport_clamp(vp);
+    return 0;
+}
+
+void viewport_resize(Viewport *vp, int rows, int cols) {
+    vp->rows = rows > 0 ? rows : 1;
+    vp->cols = cols > 0 ? cols : 1;
+    viewport_clamp(vp);
+}
+
+const char *viewport_line(const Viewport *vp, int line, int *length) {
+    if (line < 0 || line >= vp->line_count) {
+        *length = 0;
+        return NULL;
+    }
+    size_t start = vp->line_offsets[line];
+    size_t end = (line + 1 < vp->line_count) ? vp->line_offsets[line + 1] - 1 : vp->length;
+    *length = end - start;
+    return vp->text + start;
+}
+
+void viewport_scroll(Viewport *vp, int lines) {
+    vp->top_line += lines;
+    viewport_clamp(vp);
+}
+
+void viewport_page(Viewport *vp, int pages) {
+    // Keep one line of overlap so the reader does not lose their place
+    int step = vp->rows > 1 ? vp->rows - 1 : 1;
+    viewport_scroll(vp, pages * step);
+}
+
+void viewport_hscroll(Viewport *vp, int cols) {
+    vp->left_col += cols;
+    viewport_clamp(vp);
+}
+
+void viewport_home(Viewport *vp) {
+    vp->top_line = 0;
+    vp->left_col = 0;
+}
+
+void viewport_end(Viewport *vp) {
+    vp->top_line = vp->line_count;
+    viewport_clamp(vp);
+}
+
+// Search lines [from, from + line_count) with wrap-around
+static int viewport_find(Viewport *vp, int from_line, int from_col) {
+    size_t needle_len = strlen(vp->search);
+    if (needle_len == 0 || vp->line_count == 0) return -1;
+
+    for (int i = 0; i <= vp->line_count; i++) {
+        int line = (from_line + i) % vp->line_count;
+        int length;
+        const char *text = viewport_line(vp, line, &length);
+        int skip = (i == 0) ? from_col : 0;
+        if (skip > length) continue;
+
+        const char *hit = memmem(text + skip, length - skip, vp->search, needle_len);
+        if (hit) {
+            vp->match_line = line;
+            vp->match_col = hit - text;
+
+            // Bring the match into view, centred vertically when scrolling
+            if (line < vp->top_line || line >= vp->top_line + vp->rows) {
+                vp->top_line = line - vp->rows / 2;
+            }
+            if (vp->match_col < vp->left_col ||
+                vp->match_col + (int)needle_len > vp->left_col + vp->cols) {
+                vp->left_col = vp->match_col - vp->cols / 4;
+            }
+            viewport_clamp(vp);
+            return line;
+        }
+    }
+
+    vp->match_line = -1;
+    return -1;
+}
+
+int viewport_search(Viewport *vp, const char *needle) {
+    strncpy(vp->search, needle, VIEWPORT_SEARCH_MAX - 1);
+    vp->search[VIEWPORT_SEARCH_MAX - 1] = '\0';
+    return viewport_find(vp, vp->top_line, 0);
+}
+
+int viewport_search_next(Viewport *vp) {
+    if (vp->match_line < 0) return viewport_find(vp, vp->top_line, 0);
+    return viewport_find(vp, vp->match_line, vp->match_col + 1);
+}
@@ -0,0 +1,54 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include <stddef.h>
+
+#define VIEWPORT_SEARCH_MAX 128
+
+// Line-indexed document buffer with a scrollable window onto it.
+// Line offsets are computed once when the text is set, so drawing only
+// touches the lines that are actually visible.
+typedef struct {
+    char *text;              // Owned copy of the document
+    size_t length;
+    size_t *line_offsets;    // Start of each line within text
+    int line_count;
+    int widest_line;         // Longest line in bytes, bounds horizontal scroll
+
+    int top_line;            // First visible line
+    int left_col;            // First visible column
+    int rows;                // Visible rows, set by viewport_resize()
+    int cols;                // Visible columns
+
+    char search[VIEWPORT_SEARCH_MAX];
+    int match_line;          // -1 when there is no current match
+    int match_col;
+} Viewport;
+
+void viewport_init(Viewport *vp);
+void viewport_free(Viewport *vp);
+
+// Replace the document and scroll back to the top. Returns 0 or -1 on OOM.
+int viewport_set_text(Viewport *vp, const char *text, size_t length);
+
+// Replace the document but keep the scroll position, e.g. after a reload
+int viewport_update_text(Viewport *vp, const char *text, size_t length);
+
+// Size of the visible window; keeps the scroll position in range
+void viewport_resize(Viewport *vp, int rows, int cols);
+
+// Pointer to line number `line` (not NUL terminated) and its length
+const char *viewport_line(const Viewport *vp, int line, int *length);
+
+void viewport_scroll(Viewport *vp, int lines);
+void viewport_page(Viewport *vp, int pages);
+void viewport_hscroll(Viewport *vp, int cols);
+void viewport_home(Viewport *vp);
+void viewport_end(Viewport *vp);
+
+// Find `needle` starting after the current match (or at the top line) and
+// scroll it into view. Wraps around. Returns the matching line or -1.
+int viewport_search(Viewport *vp, const char *needle);
+int viewport_search_next(Viewport *vp);
+
+#endif
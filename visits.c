@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/shm.h>
+#include "common.h"
+#include "visits.h"
+#include "instance.h"
+#include "log.h"
+
+#define VISITS_READ_TRIES 64             // Reader retries before giving up on a busy index
+
+static unsigned hash_url(const char *url) {
+    return hash_string(url) % VISITS_HASH_SIZE;
+}
+
+static int valid_entry(int e) {
+    return e >= 0 && e < VISITS_MAX_URLS;
+}
+
+// The higher scoring of two entries (-1 for none); the first on a tie,
+// which is the shorter URL when one is a prefix of the other
+static int better(const VisitIndex *index, int a, int b) {
+    if (!valid_entry(a)) return valid_entry(b) ? b : -1;
+    if (!valid_entry(b)) return a;
+    return index->entries[b].score > index->entries[a].score ? b : a;
+}
+
+// First sorted position whose URL is not below url (with len > 0: whose
+// first len characters are above url's)
+static int search(const VisitIndex *index, int count, const char *url, size_t len) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int e = index->sorted[mid];
+        if (!valid_entry(e)) return -1;
+        const char *other = index->entries[e].url;
+        int cmp = len > 0 ? strncmp(other, url, len) <= 0 : strcmp(other, url) < 0;
+        if (cmp) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Bring the max tree up to date after sorted positions [from, to) changed
+static void refresh_tree(VisitIndex *index, int from, int to) {
+    if (from >= to) return;
+    for (int i = from; i < to; i++) {
+        index->best[VISITS_MAX_URLS + i] = i < index->count ? index->sorted[i] : -1;
+    }
+    int lo = (VISITS_MAX_URLS + from) / 2, hi = (VISITS_MAX_URLS + to - 1) / 2;
+    while (lo >= 1) {
+        for (int k = lo; k <= hi; k++) {
+            index->best[k] = better(index, index->best[2 * k], index->best[2 * k + 1]);
+        }
+        lo /= 2;
+        hi /= 2;
+    }
+}
+
+static int find_entry(const VisitIndex *index, const char *url) {
+    for (int e = index->hash[hash_url(url)]; valid_entry(e); e = index->entries[e].hash_next) {
+        if (strcmp(index->entries[e].url, url) == 0) return e;
+    }
+    return -1;
+}
+
+// Drop the lowest scoring URL; its entry is free afterwards
+static int evict(VisitIndex *index) {
+    int victim = 0;
+    for (int e = 1; e < index->count; e++) {
+        if (index->entries[e].score < index->entries[victim].score) victim = e;
+    }
+
+    int32_t *link = &index->hash[hash_url(index->entries[victim].url)];
+    while (*link != victim) link = &index->entries[*link].hash_next;
+    *link = index->entries[victim].hash_next;
+
+    int pos = search(index, index->count, index->entries[victim].url, 0);
+    memmove(&index->sorted[pos], &index->sorted[pos + 1],
+            (index->count - pos - 1) * sizeof(index->sorted[0]));
+    index->count--;
+    refresh_tree(index, pos, index->count + 1);
+    return victim;
+}
+
+static void reset(VisitIndex *index) {
+    memset(index, 0, sizeof(*index));
+    memset(index->hash, 0xff, sizeof(index->hash));
+    memset(index->best, 0xff, sizeof(index->best));
+    index->magic = VISITS_MAGIC;
+}
+
+VisitIndex *visits_create() {
+    // A segment left by a browser that did not clean up (maybe of
+    // another size) goes first
+    visits_remove();
+
+    int shmid = shmget(instance_get()->visits_key, sizeof(VisitIndex), IPC_CREAT | 0666);
+    if (shmid < 0) {
+        perror("shmget");
+        return NULL;
+    }
+    VisitIndex *index = shmat(shmid, NULL, 0);
+    if (index == (void *)-1) {
+        perror("shmat");
+        return NULL;
+    }
+    reset(index);
+    log_info("[Visits] Index created with ID: %d", shmid);
+    return index;
+}
+
+VisitIndex *visits_attach(int writable) {
+    int shmid = shmget(instance_get()->visits_key, sizeof(VisitIndex), 0);
+    if (shmid < 0) return NULL;
+    VisitIndex *index = shmat(shmid, NULL, writable ? 0 : SHM_RDONLY);
+    if (index == (void *)-1) return NULL;
+    if (index->magic != VISITS_MAGIC) {
+        shmdt(index);
+        return NULL;
+    }
+    return index;
+}
+
+void visits_detach(VisitIndex *index) {
+    if (index) shmdt(index);
+}
+
+void visits_remove() {
+    int shmid = shmget(instance_get()->visits_key, 0, 0);
+    if (shmid >= 0) shmctl(shmid, IPC_RMID, NULL);
+}
+
+void visits_record(VisitIndex *index, const char *url, time_t when) {
+    if (!index || url[0] == '\0') return;
+    double weight = (double)when / VISITS_HALF_LIFE_S;
+
+    lock_shared_memory();
+    uint32_t seq = index->seq;
+    __atomic_store_n(&index->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    char key[MAX_URL_LENGTH];
+    snprintf(key, sizeof(key), "%s", url);
+    int e = find_entry(index, key);
+    if (e >= 0) {
+        // log2(2^score + 2^weight), without leaving the double's range
+        VisitEntry *entry = &index->entries[e];
+        double high = entry->score > weight ? entry->score : weight;
+        double low = entry->score > weight ? weight : entry->score;
+        entry->score = high + log2(1.0 + exp2(low - high));
+        entry->visits++;
+        entry->last_visit = when;
+        int pos = search(index, index->count, key, 0);
+        refresh_tree(index, pos, pos + 1);
+    } else {
+        e = index->count < VISITS_MAX_URLS ? index->count : evict(index);
+        VisitEntry *entry = &index->entries[e];
+        snprintf(entry->url, sizeof(entry->url), "%s", key);
+        entry->visits = 1;
+        entry->last_visit = when;
+        entry->score = weight;
+
+        unsigned bucket = hash_url(key);
+        entry->hash_next = index->hash[bucket];
+        index->hash[bucket] = e;
+
+        int pos = search(index, index->count, key, 0);
+        memmove(&index->sorted[pos + 1], &index->sorted[pos],
+                (index->count - pos) * sizeof(index->sorted[0]));
+        index->sorted[pos] = e;
+        index->count++;
+        refresh_tree(index, pos, index->count);
+    }
+    index->total_visits++;
+
+    __atomic_store_n(&index->seq, seq + 2, __ATOMIC_RELEASE);
+    unlock_shared_memory();
+}
+
+int visits_complete(const VisitIndex *index, const char *prefix, char *out, size_t size) {
+    size_t len = strlen(prefix);
+    if (!index || len == 0 || len >= MAX_URL_LENGTH) return 0;
+
+    for (int tries = 0; tries < VISITS_READ_TRIES; tries++) {
+        uint32_t seq = __atomic_load_n(&index->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        // The range of URLs starting with prefix, and its best
+        int count = index->count;
+        if (count < 0 || count > VISITS_MAX_URLS) continue;
+        int lo = search(index, count, prefix, 0);
+        int hi = search(index, count, prefix, len);
+        int found = -1;
+        if (lo >= 0 && hi >= 0) {
+            int l = VISITS_MAX_URLS + lo, r = VISITS_MAX_URLS + hi;
+            while (l < r) {
+                if (l & 1) found = better(index, found, index->best[l++]);
+                if (r & 1) found = better(index, found, index->best[--r]);
+                l /= 2;
+                r /= 2;
+            }
+        }
+        char url[MAX_URL_LENGTH];
+        if (found >= 0) memcpy(url, index->entries[found].url, sizeof(url));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&index->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        if (found < 0) return 0;
+        url[sizeof(url) - 1] = '\0';
+        if (strncmp(url, prefix, len) != 0) return 0;
+        snprintf(out, size, "%s", url);
+        return 1;
+    }
+    return 0;
+}
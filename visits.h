@@ -0,0 +1,69 @@
+#ifndef VISITS_H
+#define VISITS_H
+
+#include <stdint.h>
+#include <time.h>
+#include "shared_memory.h"
+
+// Browser-wide visit index.
+// Every page any tab loads is recorded in a System V segment of its own
+// (the instance's visits_key) with its visit count, last visit and a
+// frecency score. Tabs attach it read-only and complete URLs from it
+// while the user types, without asking the browser.
+//
+// The score is log2 of the sum of 2^(t / VISITS_HALF_LIFE_S) over the
+// visit times t. A visit counts half as much per half-life, but the
+// score itself never has to be decayed: comparing two scores gives the
+// same order at any time.
+//
+// URLs are kept sorted, so the ones starting with a prefix are a range.
+// A max tree over the sorted order gives the best scoring URL in a range
+// in O(log n). When the index is full, the lowest scoring URL makes room.
+//
+// Writers (the browser shards) hold the shared memory lock. Readers take
+// no lock: seq is odd while an update is in progress, and a reader that
+// sees it change retries.
+
+#define VISITS_MAGIC 0x54495356          // "VSIT"
+#define VISITS_MAX_URLS 16384            // Power of two, for the max tree
+#define VISITS_HASH_SIZE 32768
+#define VISITS_HALF_LIFE_S (3 * 24 * 3600)
+
+typedef struct {
+    char url[MAX_URL_LENGTH];
+    uint32_t visits;
+    int32_t hash_next;                   // Next entry in the same hash bucket, -1 at the end
+    int64_t last_visit;
+    double score;
+} VisitEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    int32_t count;
+    uint64_t total_visits;
+    int32_t hash[VISITS_HASH_SIZE];      // First entry per bucket, -1 if none
+    int32_t sorted[VISITS_MAX_URLS];     // Entries in URL order
+    int32_t best[2 * VISITS_MAX_URLS];   // Max tree: best[VISITS_MAX_URLS + i] is
+                                         // sorted[i], parents the higher scoring child
+    VisitEntry entries[VISITS_MAX_URLS];
+} VisitIndex;
+
+// Browser: create the instance's index, empty, and attach it
+VisitIndex *visits_create();
+
+// Attach the instance's index, read-only for tabs. NULL if there is none.
+VisitIndex *visits_attach(int writable);
+void visits_detach(VisitIndex *index);
+
+// Browser: remove the instance's index
+void visits_remove();
+
+// Record a visit to url. Takes the shared memory lock.
+void visits_record(VisitIndex *index, const char *url, time_t when);
+
+// Best scoring URL starting with prefix, copied to out. Returns 1 if
+// there is one, 0 if not (or if writers kept it busy).
+int visits_complete(const VisitIndex *index, const char *prefix, char *out, size_t size);
+
+#endif